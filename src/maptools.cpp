@@ -34,48 +34,89 @@
 #endif
 #include <nlohmann/json.hpp>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <string>
 #include <cstdlib>
 #include <stdexcept>
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <limits>
+#include <cstring>
+#include <filesystem>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include "pngsave.h"
 #include "maptools_version.h"
-
+#include "maptools_batch.h"
+#include "maptools_cache.h"
+#include "maptools_timings.h"
+#include "maptools_trace.h"
+#include "maptools_log.h"
+#include "maptools_journal.h"
+#include "maptools_subprocess.h"
+#include "maptools_output.h"
+#include "maptools_stats.h"
+#include "maptools_progress.h"
+#include "maptools_resources.h"
+#include "maptools_previewsizes.h"
+#include "maptools_parallel.h"
+
+// Adapts wzmaplib logging to the MapToolsLog backend
 class MapToolDebugLogger : public WzMap::LoggingProtocol
 {
 public:
-	MapToolDebugLogger(bool verbose)
+	MapToolDebugLogger(bool verbose, bool outputAllToStdErr = false)
 	: verbose(verbose)
+	, outputAllToStdErr(outputAllToStdErr)
 	{ }
 	virtual ~MapToolDebugLogger() { }
 	virtual void printLog(WzMap::LoggingProtocol::LogLevel level, const char *function, int line, const char *str) override
 	{
-		std::ostream* pOutputStream = &(std::cout);
-		if (level == WzMap::LoggingProtocol::LogLevel::Error)
-		{
-			pOutputStream = &(std::cerr);
-		}
-		std::string levelStr;
 		switch (level)
 		{
 			case WzMap::LoggingProtocol::LogLevel::Info_Verbose:
 			case WzMap::LoggingProtocol::LogLevel::Info:
 				if (!verbose) { return; }
-				levelStr = "INFO";
+				MapToolsLog::write(MapToolsLog::Level::Info, outputAllToStdErr, function, line, str);
 				break;
 			case WzMap::LoggingProtocol::LogLevel::Warning:
-				levelStr = "WARNING";
+				MapToolsLog::write(MapToolsLog::Level::Warning, outputAllToStdErr, function, line, str);
 				break;
 			case WzMap::LoggingProtocol::LogLevel::Error:
-				levelStr = "ERROR";
+				MapToolsLog::write(MapToolsLog::Level::Error, true, function, line, str);
 				break;
 		}
-		(*pOutputStream) << levelStr << ": [" << function << ":" << line << "] " << str << std::endl;
 	}
 private:
 	bool verbose = false;
+	bool outputAllToStdErr = false;
 };
 
+// "-" as an output path means stdout
+static bool isStdoutOutputPath(const std::string& path)
+{
+	return path == "-";
+}
+
+static bool writeBinaryToStdout(const std::vector<uint8_t>& data)
+{
+	std::cout.flush();
+#if defined(_WIN32)
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	if (fwrite(data.data(), 1, data.size(), stdout) != data.size())
+	{
+		return false;
+	}
+	return fflush(stdout) == 0;
+}
+
 static optional<WzMap::MapPreviewColor> convertHexColorToPreviewColor(const std::string& input)
 {
 	if (input.empty())
@@ -240,24 +281,93 @@ bool lexical_cast(const std::string &input, MapPreviewColorScheme::DrawOptions &
 } // namespace WzMap
 
 
-static bool convertMapPackage(const std::string& mapPackageContentsPath, const std::string& outputPath, WzMap::LevelFormat levelFormat, WzMap::OutputFormat outputFormat, uint32_t mapSeed, bool copyAdditionalFiles, bool verbose, bool exportUncompressed, bool fixedLastMod, optional<std::string> override_map_name = nullopt, std::shared_ptr<WzMap::IOProvider> mapIO = std::shared_ptr<WzMap::IOProvider>(new WzMap::StdIOProvider()))
+static bool inputPathIsFile(const std::string& path)
+{
+	if (path.empty())
+	{
+		return false;
+	}
+	return CLI::ExistingFile(path).empty();
+}
+
+// A loaded map package, and the map loaded from it
+struct LoadedMapPackage
+{
+	std::unique_ptr<WzMap::MapPackage> package;
+	std::shared_ptr<WzMap::Map> map;
+};
+
+static std::unique_ptr<LoadedMapPackage> loadMapPackageContents(const std::string& mapPackageContentsPath, uint32_t mapSeed, std::shared_ptr<WzMap::LoggingProtocol> logger, std::shared_ptr<WzMap::IOProvider> mapIO = std::shared_ptr<WzMap::IOProvider>(new WzMap::StdIOProvider()))
 {
-	auto logger = std::make_shared<MapToolDebugLogger>(new MapToolDebugLogger(verbose));
+	auto result = std::unique_ptr<LoadedMapPackage>(new LoadedMapPackage());
 
-	auto wzMapPackage = WzMap::MapPackage::loadPackage(mapPackageContentsPath, logger, mapIO);
-	if (!wzMapPackage)
+	MapToolsScopedPhase loadPackagePhase("load package");
+	result->package = WzMap::MapPackage::loadPackage(mapPackageContentsPath, logger, mapIO);
+	loadPackagePhase.stop();
+	if (!result->package)
 	{
 		std::cerr << "Failed to load map archive package from: " << mapPackageContentsPath << std::endl;
-		return false;
+		return nullptr;
 	}
 
-	auto wzMap = wzMapPackage->loadMap(mapSeed, logger);
-	if (!wzMap)
+	MapToolsScopedPhase loadMapPhase("load map");
+	result->map = result->package->loadMap(mapSeed, logger);
+	loadMapPhase.stop();
+	if (!result->map)
 	{
 		// Failed to load map
 		std::cerr << "Failed to load map from map archive path: " << mapPackageContentsPath << std::endl;
-		return false;
+		return nullptr;
+	}
+
+	return result;
+}
+
+#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
+static std::shared_ptr<WzMap::IOProvider> openMapArchive(const std::string& mapArchive)
+{
+	MapToolsScopedPhase phase("open archive");
+	auto zipArchive = WzMapZipIO::openZipArchiveFS(mapArchive.c_str());
+	if (!zipArchive)
+	{
+		std::cerr << "Failed to open map archive file: " << mapArchive << std::endl;
+		return nullptr;
+	}
+	return zipArchive;
+}
+
+static std::unique_ptr<LoadedMapPackage> loadMapPackageArchive(const std::string& mapArchive, uint32_t mapSeed, std::shared_ptr<WzMap::LoggingProtocol> logger)
+{
+	auto zipArchive = openMapArchive(mapArchive);
+	if (!zipArchive)
+	{
+		return nullptr;
+	}
+
+	return loadMapPackageContents("", mapSeed, logger, zipArchive);
+}
+#endif // !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
+
+// Loads a map package from either a .wz archive or an extracted package folder
+static std::unique_ptr<LoadedMapPackage> loadMapPackageFromInputPath(const std::string& inputPath, uint32_t mapSeed, std::shared_ptr<WzMap::LoggingProtocol> logger)
+{
+	if (inputPathIsFile(inputPath))
+	{
+#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
+		return loadMapPackageArchive(inputPath, mapSeed, logger);
+#else
+		std::cerr << "ERROR: maptools was compiled without support for .wz archives, and cannot open: " << inputPath << std::endl;
+		return nullptr;
+#endif
 	}
+	return loadMapPackageContents(inputPath, mapSeed, logger);
+}
+
+static bool exportLoadedMapPackage(LoadedMapPackage& loadedPackage, const std::string& outputPath, WzMap::LevelFormat levelFormat, WzMap::OutputFormat outputFormat, bool copyAdditionalFiles, bool exportUncompressed, bool fixedLastMod, optional<std::string> override_map_name, std::shared_ptr<WzMap::LoggingProtocol> logger)
+{
+	// (declared first, so that finalizing the output archive, when exportIO is released, is included)
+	MapToolsScopedPhase exportPhase("export map");
+	auto& wzMapPackage = loadedPackage.package;
 
 	std::string outputBasePath;
 	std::shared_ptr<WzMap::IOProvider> exportIO;
@@ -285,6 +395,7 @@ static bool convertMapPackage(const std::string& mapPackageContentsPath, const s
 		}
 		outputBasePath.clear();
 #else
+		(void)fixedLastMod;
 		std::cerr << "maptools was not compiled with map archive (.wz) support - you must pass --output-uncompressed" << std::endl;
 		return false;
 #endif // !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
@@ -304,7 +415,12 @@ static bool convertMapPackage(const std::string& mapPackageContentsPath, const s
 		return false;
 	}
 
-	auto inputMapFormat = wzMap->loadedMapFormat();
+	return true;
+}
+
+static void printConvertedMapPackageSummary(LoadedMapPackage& loadedPackage, const std::string& outputPath, WzMap::LevelFormat levelFormat, WzMap::OutputFormat outputFormat)
+{
+	auto inputMapFormat = loadedPackage.map->loadedMapFormat();
 
 	std::cout << "Converted map package:" << std::endl
 			<< "\t - from format [";
@@ -319,17 +435,33 @@ static bool convertMapPackage(const std::string& mapPackageContentsPath, const s
 	std::cout << "] -> [" << outputFormat << "]" << std::endl;
 	std::cout << "\t - with: " << levelFormat << std::endl;
 	std::cout << "\t - saved to: " << outputPath << std::endl;
+}
+
+static bool convertMapPackage(const std::string& mapPackageContentsPath, const std::string& outputPath, WzMap::LevelFormat levelFormat, WzMap::OutputFormat outputFormat, uint32_t mapSeed, bool copyAdditionalFiles, bool verbose, bool exportUncompressed, bool fixedLastMod, optional<std::string> override_map_name = nullopt, std::shared_ptr<WzMap::IOProvider> mapIO = std::shared_ptr<WzMap::IOProvider>(new WzMap::StdIOProvider()))
+{
+	auto logger = std::make_shared<MapToolDebugLogger>(verbose);
+
+	auto loadedPackage = loadMapPackageContents(mapPackageContentsPath, mapSeed, logger, mapIO);
+	if (!loadedPackage)
+	{
+		return false;
+	}
+
+	if (!exportLoadedMapPackage(*loadedPackage, outputPath, levelFormat, outputFormat, copyAdditionalFiles, exportUncompressed, fixedLastMod, override_map_name, logger))
+	{
+		return false;
+	}
 
+	printConvertedMapPackageSummary(*loadedPackage, outputPath, levelFormat, outputFormat);
 	return true;
 }
 
 #if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
 static bool convertMapPackage_FromArchive(const std::string& mapArchive, const std::string& outputPath, WzMap::LevelFormat levelFormat, WzMap::OutputFormat outputFormat, uint32_t mapSeed, bool copyAdditionalFiles, bool verbose, bool outputUncompressed, bool fixedLastMod, optional<std::string> override_map_name)
 {
-	auto zipArchive = WzMapZipIO::openZipArchiveFS(mapArchive.c_str());
+	auto zipArchive = openMapArchive(mapArchive);
 	if (!zipArchive)
 	{
-		std::cerr << "Failed to open map archive file: " << mapArchive << std::endl;
 		return false;
 	}
 
@@ -339,7 +471,9 @@ static bool convertMapPackage_FromArchive(const std::string& mapArchive, const s
 
 static bool convertMap(WzMap::MapType mapType, uint32_t mapMaxPlayers, const std::string& inputMapDirectory, const std::string& outputMapDirectory, WzMap::OutputFormat outputFormat, uint32_t mapSeed, bool verbose)
 {
-	auto wzMap = WzMap::Map::loadFromPath(inputMapDirectory, mapType, mapMaxPlayers, mapSeed, std::make_shared<MapToolDebugLogger>(new MapToolDebugLogger(verbose)));
+	MapToolsScopedPhase loadMapPhase("load map");
+	auto wzMap = WzMap::Map::loadFromPath(inputMapDirectory, mapType, mapMaxPlayers, mapSeed, std::make_shared<MapToolDebugLogger>(verbose));
+	loadMapPhase.stop();
 	if (!wzMap)
 	{
 		// Failed to load map
@@ -347,7 +481,8 @@ static bool convertMap(WzMap::MapType mapType, uint32_t mapMaxPlayers, const std
 		return false;
 	}
 
-	if (!wzMap->exportMapToPath(*(wzMap.get()), outputMapDirectory, mapType, mapMaxPlayers, outputFormat, std::make_shared<MapToolDebugLogger>(new MapToolDebugLogger(verbose))))
+	MapToolsScopedPhase exportPhase("export map");
+	if (!wzMap->exportMapToPath(*(wzMap.get()), outputMapDirectory, mapType, mapMaxPlayers, outputFormat, std::make_shared<MapToolDebugLogger>(verbose)))
 	{
 		// Failed to export map
 		std::cerr << "Failed to export map to: " << outputMapDirectory << std::endl;
@@ -489,7 +624,7 @@ enum class MapToolsPreviewColorProvider
 	WZPlayerColors
 };
 
-static std::unique_ptr<WzMap::MapPreviewImage> generateMapPreview_FromMapObject_Impl(WzMap::Map& map, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const WzMap::LevelDetails &levelDetails)
+static WzMap::MapPreviewColorScheme buildMapPreviewColorScheme(MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const WzMap::LevelDetails &levelDetails)
 {
 	WzMap::MapPreviewColorScheme previewColorScheme;
 	previewColorScheme.hqColor = {255, 0, 255, 255};
@@ -518,19 +653,78 @@ static std::unique_ptr<WzMap::MapPreviewImage> generateMapPreview_FromMapObject_
 	}
 	previewColorScheme.drawOptions = drawOptions;
 
-	return WzMap::generate2DMapPreview(map, previewColorScheme, WzMap::MapStatsConfiguration(levelDetails.type));
+	return previewColorScheme;
+}
+
+// The fixed (non-terrain) colors of a preview color scheme, used to seed an indexed PNG palette
+// (terrain colors are shaded by tile height, so they are collected from the preview image itself)
+static std::vector<PngPaletteColor> buildMapPreviewPaletteHint(WzMap::MapPreviewColorScheme& previewColorScheme)
+{
+	std::vector<PngPaletteColor> paletteHint;
+	auto addColor = [&paletteHint](const WzMap::MapPreviewColor& color) {
+		paletteHint.push_back(PngPaletteColor{color.r, color.g, color.b});
+	};
+	addColor(previewColorScheme.hqColor);
+	addColor(previewColorScheme.oilResourceColor);
+	addColor(previewColorScheme.oilBarrelColor);
+	if (previewColorScheme.playerColorProvider)
+	{
+		addColor(previewColorScheme.playerColorProvider->getPlayerColor(PLAYER_SCAVENGERS));
+		for (int8_t player = 0; player < 16; ++player)
+		{
+			addColor(previewColorScheme.playerColorProvider->getPlayerColor(player));
+		}
+	}
+	return paletteHint;
 }
 
-static bool generateMapPreviewPNG_FromMapObject(WzMap::Map& map, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const WzMap::LevelDetails &levelDetails)
+// Renders the preview image (and, if an indexed PNG was requested, fills in the palette hint of previewPngOptions)
+static std::unique_ptr<WzMap::MapPreviewImage> generateMapPreview_FromMapObject_Impl(WzMap::Map& map, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const WzMap::LevelDetails &levelDetails, PngSaveOptions& previewPngOptions)
 {
-	auto previewResult = generateMapPreview_FromMapObject_Impl(map, playerColorProvider, scavsColor, drawOptions, levelDetails);
+	MapToolsScopedPhase renderPhase("render preview");
+	auto previewColorScheme = buildMapPreviewColorScheme(playerColorProvider, scavsColor, drawOptions, levelDetails);
+	auto previewResult = WzMap::generate2DMapPreview(map, previewColorScheme, WzMap::MapStatsConfiguration(levelDetails.type));
+	renderPhase.stop();
 	if (!previewResult)
 	{
 		std::cerr << "Failed to generate map preview" << std::endl;
+		return nullptr;
+	}
+
+	if (previewPngOptions.indexedColor)
+	{
+		previewPngOptions.paletteHint = buildMapPreviewPaletteHint(previewColorScheme);
+	}
+	return previewResult;
+}
+
+static bool encodeMapPreviewPNG(WzMap::MapPreviewImage& previewImage, const PngSaveOptions& pngOptions, std::vector<uint8_t>& pngData)
+{
+	MapToolsScopedPhase phase("encode png");
+	if (!savePngToMemory(pngData, previewImage.imageData.data(), static_cast<int>(previewImage.width), static_cast<int>(previewImage.height), pngOptions))
+	{
+		std::cerr << "Failed to encode preview PNG" << std::endl;
 		return false;
 	}
+	return true;
+}
+
+// Outputs already-encoded preview PNG data to a file (or stdout)
+static bool outputMapPreviewPNGData(const std::vector<uint8_t>& pngData, const std::string& outputPNGPath)
+{
+	MapToolsScopedPhase phase("write output");
+	if (isStdoutOutputPath(outputPNGPath))
+	{
+		if (!writeBinaryToStdout(pngData))
+		{
+			std::cerr << "Failed to write preview PNG to stdout" << std::endl;
+			return false;
+		}
+		return true;
+	}
 
-	if (!savePng(outputPNGPath.c_str(), previewResult->imageData.data(), static_cast<int>(previewResult->width), static_cast<int>(previewResult->height)))
+	WzMap::StdIOProvider stdOutput;
+	if (!stdOutput.writeFullFile(outputPNGPath, reinterpret_cast<const char*>(pngData.data()), static_cast<uint32_t>(pngData.size())))
 	{
 		std::cerr << "Failed to save preview PNG" << std::endl;
 		return false;
@@ -542,45 +736,140 @@ static bool generateMapPreviewPNG_FromMapObject(WzMap::Map& map, const std::stri
 	return true;
 }
 
-static bool generateMapPreviewPNG_FromPackageContents(const std::string& mapPackageContentsPath, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, uint32_t mapSeed, bool verbose, std::shared_ptr<WzMap::IOProvider> mapIO = std::shared_ptr<WzMap::IOProvider>(new WzMap::StdIOProvider()))
+struct MapPreviewSizePNGData
 {
-	auto logger = std::make_shared<MapToolDebugLogger>(new MapToolDebugLogger(verbose));
+	unsigned width = 0;
+	unsigned height = 0;
+	std::vector<uint8_t> pngData;
+};
 
-	auto wzMapPackage = WzMap::MapPackage::loadPackage(mapPackageContentsPath, logger, mapIO);
-	if (!wzMapPackage)
+// Encodes each of the sizes (--sizes) of the preview - all derived from the one rendered preview, and encoded concurrently
+// (on up to pngOptions.numThreads threads in total - split between the sizes, then between the strips of each size)
+static bool encodeMapPreviewSizesPNG(WzMap::MapPreviewImage& previewImage, const MapToolsPreviewSizes& previewSizes, const PngSaveOptions& pngOptions, std::vector<MapPreviewSizePNGData>& outputs)
+{
+	MapToolsScopedPhase phase("encode png sizes");
+	outputs.clear();
+	outputs.resize(previewSizes.sizes.size());
+	std::vector<char> succeeded(previewSizes.sizes.size(), 0);
+	unsigned numSizeThreads = static_cast<unsigned>(std::min<size_t>(std::max(pngOptions.numThreads, 1u), previewSizes.sizes.size()));
+	unsigned numStripThreads = std::max(pngOptions.numThreads / std::max(numSizeThreads, 1u), 1u);
+	auto encodeSize = [&](size_t idx) {
+		const MapToolsPreviewSize& size = previewSizes.sizes[idx];
+		MapToolsPreviewSizePlan plan = planPreviewSize(size, previewImage.width, previewImage.height);
+		uint8_t* pixels = previewImage.imageData.data();
+		std::vector<uint8_t> downscaledPixels;
+		if (plan.downscaled)
+		{
+			downscaledPixels.resize(static_cast<size_t>(plan.width) * plan.height * 3);
+			downscaleRGBBoxFilter(pixels, previewImage.width, previewImage.height, downscaledPixels.data(), plan.width, plan.height);
+			pixels = downscaledPixels.data();
+		}
+		PngSaveOptions sizePngOptions = pngOptions;
+		sizePngOptions.scale = plan.scale;
+		sizePngOptions.numThreads = numStripThreads;
+		outputs[idx].width = plan.outputWidth();
+		outputs[idx].height = plan.outputHeight();
+		succeeded[idx] = savePngToMemory(outputs[idx].pngData, pixels, plan.width, plan.height, sizePngOptions);
+	};
+	if (!previewSizes.sizes.empty())
+	{
+		parallelFor(previewSizes.sizes.size(), numSizeThreads, encodeSize);
+	}
+	for (size_t idx = 0; idx < previewSizes.sizes.size(); ++idx)
+	{
+		if (!succeeded[idx])
+		{
+			std::cerr << "Failed to encode preview PNG (size: " << previewSizes.sizes[idx].spec << ")" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Outputs already-encoded preview sizes to files alongside outputPNGPath (named by the --sizes-template)
+static bool outputMapPreviewSizesPNGData(const std::vector<MapPreviewSizePNGData>& outputs, const MapToolsPreviewSizes& previewSizes, const std::string& outputPNGPath)
+{
+	MapToolsScopedPhase phase("write output");
+	WzMap::StdIOProvider stdOutput;
+	std::vector<std::string> outputPaths;
+	for (size_t idx = 0; idx < outputs.size(); ++idx)
+	{
+		std::string sizeOutputPath = makePreviewSizeOutputPath(outputPNGPath, previewSizes.nameTemplate, previewSizes.sizes[idx]);
+		if (!stdOutput.writeFullFile(sizeOutputPath, reinterpret_cast<const char*>(outputs[idx].pngData.data()), static_cast<uint32_t>(outputs[idx].pngData.size())))
+		{
+			std::cerr << "Failed to save preview PNG: " << sizeOutputPath << std::endl;
+			return false;
+		}
+		outputPaths.push_back(sizeOutputPath);
+	}
+
+	std::cout << "Generated map previews:" << std::endl;
+	for (const auto& path : outputPaths)
+	{
+		std::cout << "\t - saved to: " << path << std::endl;
+	}
+	return true;
+}
+
+static bool generateMapPreviewPNG_FromMapObject(WzMap::Map& map, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const PngSaveOptions& pngOptions, const MapToolsPreviewSizes& previewSizes, const WzMap::LevelDetails &levelDetails)
+{
+	PngSaveOptions previewPngOptions = pngOptions;
+	auto previewResult = generateMapPreview_FromMapObject_Impl(map, playerColorProvider, scavsColor, drawOptions, levelDetails, previewPngOptions);
+	if (!previewResult)
 	{
-		std::cerr << "Failed to load map archive package from: " << mapPackageContentsPath << std::endl;
 		return false;
 	}
 
-	auto wzMap = wzMapPackage->loadMap(mapSeed, logger);
-	if (!wzMap)
+	if (!previewSizes.sizes.empty())
+	{
+		std::vector<MapPreviewSizePNGData> outputs;
+		if (!encodeMapPreviewSizesPNG(*previewResult, previewSizes, previewPngOptions, outputs))
+		{
+			return false;
+		}
+		return outputMapPreviewSizesPNGData(outputs, previewSizes, outputPNGPath);
+	}
+
+	// Encode in-memory, then output the PNG (to a file or stdout)
+	std::vector<uint8_t> pngData;
+	if (!encodeMapPreviewPNG(*previewResult, previewPngOptions, pngData))
+	{
+		return false;
+	}
+	return outputMapPreviewPNGData(pngData, outputPNGPath);
+}
+
+static bool generateMapPreviewPNG_FromPackageContents(const std::string& mapPackageContentsPath, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const PngSaveOptions& pngOptions, const MapToolsPreviewSizes& previewSizes, uint32_t mapSeed, bool verbose, std::shared_ptr<WzMap::IOProvider> mapIO = std::shared_ptr<WzMap::IOProvider>(new WzMap::StdIOProvider()))
+{
+	auto logger = std::make_shared<MapToolDebugLogger>(verbose, isStdoutOutputPath(outputPNGPath)); // keep stdout clean when streaming the PNG
+
+	auto loadedPackage = loadMapPackageContents(mapPackageContentsPath, mapSeed, logger, mapIO);
+	if (!loadedPackage)
 	{
-		// Failed to load map
-		std::cerr << "Failed to load map from map archive path: " << mapPackageContentsPath << std::endl;
 		return false;
 	}
 
-	return generateMapPreviewPNG_FromMapObject(*(wzMap.get()), outputPNGPath, playerColorProvider, scavsColor, drawOptions, wzMapPackage->levelDetails());
+	return generateMapPreviewPNG_FromMapObject(*(loadedPackage->map.get()), outputPNGPath, playerColorProvider, scavsColor, drawOptions, pngOptions, previewSizes, loadedPackage->package->levelDetails());
 }
 
 #if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
-static bool generateMapPreviewPNG_FromArchive(const std::string& mapArchive, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, uint32_t mapSeed, bool verbose)
+static bool generateMapPreviewPNG_FromArchive(const std::string& mapArchive, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const PngSaveOptions& pngOptions, const MapToolsPreviewSizes& previewSizes, uint32_t mapSeed, bool verbose)
 {
-	auto zipArchive = WzMapZipIO::openZipArchiveFS(mapArchive.c_str());
+	auto zipArchive = openMapArchive(mapArchive);
 	if (!zipArchive)
 	{
-		std::cerr << "Failed to open map archive file: " << mapArchive << std::endl;
 		return false;
 	}
 
-	return generateMapPreviewPNG_FromPackageContents("", outputPNGPath, playerColorProvider, scavsColor, drawOptions, mapSeed, verbose, zipArchive);
+	return generateMapPreviewPNG_FromPackageContents("", outputPNGPath, playerColorProvider, scavsColor, drawOptions, pngOptions, previewSizes, mapSeed, verbose, zipArchive);
 }
 #endif // !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
 
-static bool generateMapPreviewPNG_FromMapDirectory(WzMap::MapType mapType, uint32_t mapMaxPlayers, const std::string& inputMapDirectory, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, uint32_t mapSeed, bool verbose)
+static bool generateMapPreviewPNG_FromMapDirectory(WzMap::MapType mapType, uint32_t mapMaxPlayers, const std::string& inputMapDirectory, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const PngSaveOptions& pngOptions, const MapToolsPreviewSizes& previewSizes, uint32_t mapSeed, bool verbose)
 {
-	auto wzMap = WzMap::Map::loadFromPath(inputMapDirectory, mapType, mapMaxPlayers, mapSeed, std::make_shared<MapToolDebugLogger>(new MapToolDebugLogger(verbose)));
+	MapToolsScopedPhase loadMapPhase("load map");
+	auto wzMap = WzMap::Map::loadFromPath(inputMapDirectory, mapType, mapMaxPlayers, mapSeed, std::make_shared<MapToolDebugLogger>(verbose, isStdoutOutputPath(outputPNGPath)));
+	loadMapPhase.stop();
 	if (!wzMap)
 	{
 		// Failed to load map
@@ -602,7 +891,7 @@ static bool generateMapPreviewPNG_FromMapDirectory(WzMap::MapType mapType, uint3
 	synthesizedLevelDetails.tileset = mapTilesetResult.value();
 	synthesizedLevelDetails.mapFolderPath = "";
 
-	return generateMapPreviewPNG_FromMapObject(*(wzMap.get()), outputPNGPath, playerColorProvider, scavsColor, drawOptions, synthesizedLevelDetails);
+	return generateMapPreviewPNG_FromMapObject(*(wzMap.get()), outputPNGPath, playerColorProvider, scavsColor, drawOptions, pngOptions, previewSizes, synthesizedLevelDetails);
 }
 
 namespace nlohmann {
@@ -767,7 +1056,7 @@ inline std::string levelFormatToString(optional<WzMap::LevelFormat> levelFormat)
 	return ""; // silence warning
 }
 
-static nlohmann::ordered_json generateMapInfoJSON_FromPackage(WzMap::MapPackage& mapPackage, const WzMap::MapStats& stats, std::shared_ptr<MapToolDebugLogger> logger)
+static nlohmann::ordered_json generateMapInfoJSON_FromPackage(WzMap::MapPackage& mapPackage, WzMap::Map& loadedMap, const WzMap::MapStats& stats, std::shared_ptr<MapToolDebugLogger> logger)
 {
 	nlohmann::ordered_json output = generateMapInfoJSON_FromMapStats(mapPackage.levelDetails(),stats, logger);
 
@@ -792,49 +1081,47 @@ static nlohmann::ordered_json generateMapInfoJSON_FromPackage(WzMap::MapPackage&
 	{
 		std::cerr << "Loaded level details format is missing ??" << std::endl;
 	}
-	// The loaded map format
-	auto pMap = mapPackage.loadMap(0);
-	if (pMap)
-	{
-		auto loadedMapFormat = pMap->loadedMapFormat();
-		output["mapFormat"] = loadedFormatToString(loadedMapFormat);
-	}
-	else
-	{
-		std::cerr << "Failed to load map from archive package ??" << std::endl;
-	}
+	// The loaded map format (from the same loaded map that the stats were calculated from)
+	output["mapFormat"] = loadedFormatToString(loadedMap.loadedMapFormat());
 	// Whether the map package is a new "flat" map package
 	output["flatMapPackage"] = mapPackage.isFlatMapPackage();
 
 	return output;
 }
 
-static optional<nlohmann::ordered_json> generateMapInfoJSON_FromPackageContents(const std::string& mapPackageContentsPath, uint32_t mapSeed, std::shared_ptr<MapToolDebugLogger> logger, std::shared_ptr<WzMap::IOProvider> mapIO = std::shared_ptr<WzMap::IOProvider>(new WzMap::StdIOProvider()))
+static optional<nlohmann::ordered_json> generateMapInfoJSON_FromLoadedPackage(LoadedMapPackage& loadedPackage, std::shared_ptr<MapToolDebugLogger> logger)
 {
-	auto wzMapPackage = WzMap::MapPackage::loadPackage(mapPackageContentsPath, logger, mapIO);
-	if (!wzMapPackage)
+	const auto& levelDetails = loadedPackage.package->levelDetails();
+	MapToolsScopedPhase statsPhase("map stats");
+	auto mapStatsResult = loadedPackage.map->calculateMapStats(levelDetails.players, WzMap::MapStatsConfiguration(levelDetails.type));
+	statsPhase.stop();
+	if (!mapStatsResult.has_value())
 	{
-		std::cerr << "Failed to load map archive package from: " << mapPackageContentsPath << std::endl;
+		std::cerr << "Failed to calculate map info / stats" << std::endl;
 		return nullopt;
 	}
 
-	auto mapStatsResult = wzMapPackage->calculateMapStats(mapSeed);
-	if (!mapStatsResult.has_value())
+	return generateMapInfoJSON_FromPackage(*(loadedPackage.package.get()), *(loadedPackage.map.get()), mapStatsResult.value(), logger);
+}
+
+static optional<nlohmann::ordered_json> generateMapInfoJSON_FromPackageContents(const std::string& mapPackageContentsPath, uint32_t mapSeed, std::shared_ptr<MapToolDebugLogger> logger, std::shared_ptr<WzMap::IOProvider> mapIO = std::shared_ptr<WzMap::IOProvider>(new WzMap::StdIOProvider()))
+{
+	// Load the map exactly once - both the stats and the map format are derived from it
+	auto loadedPackage = loadMapPackageContents(mapPackageContentsPath, mapSeed, logger, mapIO);
+	if (!loadedPackage)
 	{
-		std::cerr << "Failed to calculate map info / stats from: " << mapPackageContentsPath << std::endl;
 		return nullopt;
 	}
 
-	return generateMapInfoJSON_FromPackage(*(wzMapPackage.get()), mapStatsResult.value(), logger);
+	return generateMapInfoJSON_FromLoadedPackage(*loadedPackage, logger);
 }
 
 #if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
 static optional<nlohmann::ordered_json> generateMapInfoJSON_FromArchive(const std::string& mapArchive, uint32_t mapSeed, std::shared_ptr<MapToolDebugLogger> logger)
 {
-	auto zipArchive = WzMapZipIO::openZipArchiveFS(mapArchive.c_str());
+	auto zipArchive = openMapArchive(mapArchive);
 	if (!zipArchive)
 	{
-		std::cerr << "Failed to open map archive file: " << mapArchive << std::endl;
 		return nullopt;
 	}
 
@@ -842,133 +1129,2169 @@ static optional<nlohmann::ordered_json> generateMapInfoJSON_FromArchive(const st
 }
 #endif // !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
 
-// specify string->value mappings
-static const std::map<std::string, WzMap::MapType> maptype_map{{"skirmish", WzMap::MapType::SKIRMISH}, {"campaign", WzMap::MapType::CAMPAIGN}};
-static const std::map<std::string, WzMap::LevelFormat> levelformat_map{{"latest", WzMap::LatestLevelFormat}, {"json", WzMap::LevelFormat::JSON}, {"lev", WzMap::LevelFormat::LEV}};
-static const std::map<std::string, WzMap::OutputFormat> outputformat_map{{"latest", WzMap::LatestOutputFormat}, {"jsonv2", WzMap::OutputFormat::VER3}, {"json", WzMap::OutputFormat::VER2}, {"bjo", WzMap::OutputFormat::VER1_BINARY_OLD}};
-static const std::map<std::string, MapToolsPreviewColorProvider> previewcolors_map{{"simple", MapToolsPreviewColorProvider::Simple}, {"wz", MapToolsPreviewColorProvider::WZPlayerColors}};
+// MARK: - Result cache
 
-static bool strEndsWith(const std::string& str, const std::string& suffix)
+// Only script-generated maps depend on the map seed - all other maps are cached under a seed-independent key
+// (otherwise the default, random, map seed would defeat the cache)
+static bool loadedMapDependsOnSeed(LoadedMapPackage& loadedPackage)
 {
-	return (str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0);
+	auto mapFormat = loadedPackage.map->loadedMapFormat();
+	return !mapFormat.has_value() || mapFormat.value() == WzMap::Map::LoadedFormat::SCRIPT_GENERATED;
 }
 
-/// Check for a specified file extension
-class FileExtensionValidator : public CLI::Validator {
-  public:
-	FileExtensionValidator(std::string fileExtension) {
-		std::stringstream out;
-		out << "FILE(*" << fileExtension << ")";
-		description(out.str());
-
-		if (!fileExtension.empty())
-		{
-			if (fileExtension.front() != '.')
-			{
-				fileExtension = "." + fileExtension;
-			}
-		}
+typedef std::function<bool (LoadedMapPackage& loadedPackage, std::vector<uint8_t>& output)> CachedOutputGenerator;
 
-		func_ = [fileExtension](std::string &filename) {
-			if (!strEndsWith(filename, fileExtension))
-			{
-				return "Filename does not end in extension: " + fileExtension;
-			}
-			return std::string();
-		};
+// Returns the output of an operation on an input package from the cache (skipping loading the map entirely), or loads the package and generates (+ caches) it
+static bool getOrGenerateCachedOutput(MapToolsResultCache& cache, const std::string& inputPath, const std::string& operation, const std::string& options, uint32_t mapSeed, std::shared_ptr<WzMap::LoggingProtocol> logger, const CachedOutputGenerator& generateOutput, std::vector<uint8_t>& output, bool* pCacheHit = nullptr)
+{
+	std::string seededOptions = options + ";seed=" + std::to_string(mapSeed);
+	MapToolsScopedPhase lookupPhase("cache lookup");
+	std::string inputHash;
+	bool cacheable = hashMapPackageContents(inputPath, inputHash);
+	if (cacheable && cache.lookup({MapToolsResultCache::makeKey(inputHash, operation, options), MapToolsResultCache::makeKey(inputHash, operation, seededOptions)}, output))
+	{
+		if (pCacheHit) { *pCacheHit = true; }
+		return true;
 	}
-};
-
-class AsHexColorValue : public CLI::Validator {
-  public:
-	explicit AsHexColorValue() {
-		description("RGB hexadecimal color code");
+	if (pCacheHit) { *pCacheHit = false; }
+	lookupPhase.stop();
 
-		// transform function
-		func_ = [](std::string &input) -> std::string {
-
-			CLI::detail::rtrim(input);
-			if (input.empty()) {
-				throw CLI::ValidationError("Input is empty");
-			}
+	auto loadedPackage = loadMapPackageFromInputPath(inputPath, mapSeed, logger);
+	if (!loadedPackage)
+	{
+		return false;
+	}
+	if (!generateOutput(*loadedPackage, output))
+	{
+		return false;
+	}
+	if (cacheable)
+	{
+		MapToolsScopedPhase storePhase("cache store");
+		cache.store(MapToolsResultCache::makeKey(inputHash, operation, (loadedMapDependsOnSeed(*loadedPackage)) ? seededOptions : options), output);
+	}
+	return true;
+}
 
-			auto convertedValue = convertHexColorToPreviewColor(input);
-			if (!convertedValue.has_value())
-			{
-				throw CLI::ValidationError("Invalid RGB hex color code format");
-			}
+static std::string previewOptionsCacheString(MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const PngSaveOptions& pngOptions)
+{
+	std::stringstream options;
+	options << "playercolors=" << static_cast<int>(playerColorProvider);
+	options << ";scavcolor=" << static_cast<int>(scavsColor.r) << "," << static_cast<int>(scavsColor.g) << "," << static_cast<int>(scavsColor.b) << "," << static_cast<int>(scavsColor.a);
+	options << ";layers=" << drawOptions.drawTerrain << drawOptions.drawStructures << drawOptions.drawOil;
+	options << ";png-profile=" << static_cast<int>(pngOptions.compressionProfile);
+	options << ";png-palette=" << pngOptions.indexedColor;
+	if (pngOptions.numThreads > 1)
+	{
+		// (the parallel encoder's output depends on the number of threads)
+		options << ";png-threads=" << pngOptions.numThreads;
+	}
+	if (pngOptions.deflateBackend != PngDeflateBackend::Zlib)
+	{
+		options << ";png-deflate=" << static_cast<int>(pngOptions.deflateBackend);
+	}
+	options << ";png-filter=" << static_cast<int>(pngOptions.filterMode);
+	if (pngOptions.scale > 1)
+	{
+		options << ";scale=" << pngOptions.scale;
+	}
+	return options.str();
+}
 
-			// Return empty error string (success)
-			return std::string{};
-		};
+static std::string previewSizesCacheString(const MapToolsPreviewSizes& previewSizes)
+{
+	if (previewSizes.sizes.empty())
+	{
+		return std::string();
 	}
-};
+	// (the name template doesn't affect the cached output)
+	return ";sizes=" + previewSizesToString(previewSizes.sizes);
+}
 
-class WzMapToolsAppInstance : public CLI::App
+// Packs the encoded preview sizes into a single cached output: for each size, [width, height, PNG length] (as little-endian uint32) + the PNG data
+static void packMapPreviewSizesPNGData(const std::vector<MapPreviewSizePNGData>& outputs, std::vector<uint8_t>& packed)
 {
-protected:
-	explicit WzMapToolsAppInstance()
-		: CLI::App("WZ2100 Map Tools")
-	{ }
-public:
-	static std::shared_ptr<WzMapToolsAppInstance> makeWzMapToolsAppInstance()
+	packed.clear();
+	auto appendUInt32 = [&packed](uint32_t value) {
+		for (unsigned i = 0; i < 4; ++i)
+		{
+			packed.push_back(static_cast<uint8_t>(value >> (i * 8)));
+		}
+	};
+	for (const auto& output : outputs)
 	{
-		class make_shared_enabler: public WzMapToolsAppInstance {};
-		auto app = std::make_shared<make_shared_enabler>();
+		appendUInt32(output.width);
+		appendUInt32(output.height);
+		appendUInt32(static_cast<uint32_t>(output.pngData.size()));
+		packed.insert(packed.end(), output.pngData.begin(), output.pngData.end());
+	}
+}
 
-	#if defined(MAPTOOLS_CLI_VERSION_MAJOR) && defined(MAPTOOLS_CLI_VERSION_MINOR) && defined(MAPTOOLS_CLI_VERSION_REV)
-		app->set_version_flag("--version", []() -> std::string {
-			return generateMapToolsVersionInfo();
-		});
-	#else
+static bool unpackMapPreviewSizesPNGData(const std::vector<uint8_t>& packed, size_t numSizes, std::vector<MapPreviewSizePNGData>& outputs)
+{
+	outputs.clear();
+	size_t pos = 0;
+	auto readUInt32 = [&packed, &pos](uint32_t& value) -> bool {
+		if (packed.size() - pos < 4)
+		{
+			return false;
+		}
+		value = 0;
+		for (unsigned i = 0; i < 4; ++i)
+		{
+			value |= static_cast<uint32_t>(packed[pos++]) << (i * 8);
+		}
+		return true;
+	};
+	while (pos < packed.size())
+	{
+		MapPreviewSizePNGData output;
+		uint32_t length = 0;
+		if (!readUInt32(output.width) || !readUInt32(output.height) || !readUInt32(length) || packed.size() - pos < length)
+		{
+			return false;
+		}
+		output.pngData.assign(packed.begin() + pos, packed.begin() + pos + length);
+		pos += length;
+		outputs.push_back(std::move(output));
+	}
+	return outputs.size() == numSizes;
+}
+
+static optional<nlohmann::ordered_json> generateMapInfoJSON_Cached(MapToolsResultCache& cache, const std::string& inputPath, uint32_t mapSeed, std::shared_ptr<MapToolDebugLogger> logger)
+{
+	std::vector<uint8_t> output;
+	bool result = getOrGenerateCachedOutput(cache, inputPath, "info", "", mapSeed, logger, [logger](LoadedMapPackage& loadedPackage, std::vector<uint8_t>& output) -> bool {
+		auto mapInfoJSON = generateMapInfoJSON_FromLoadedPackage(loadedPackage, logger);
+		if (!mapInfoJSON.has_value())
+		{
+			return false;
+		}
+		std::string jsonStr = mapInfoJSON.value().dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::ignore);
+		output.assign(jsonStr.begin(), jsonStr.end());
+		return true;
+	}, output);
+	if (!result)
+	{
+		return nullopt;
+	}
+
+	auto mapInfoJSON = nlohmann::ordered_json::parse(output.begin(), output.end(), nullptr, false);
+	if (mapInfoJSON.is_discarded())
+	{
+		std::cerr << "Invalid cached map info for: " << inputPath << std::endl;
+		return nullopt;
+	}
+	return mapInfoJSON;
+}
+
+static bool generateMapPreviewPNG_Cached(MapToolsResultCache& cache, const std::string& inputPath, const std::string& outputPNGPath, MapToolsPreviewColorProvider playerColorProvider, WzMap::MapPreviewColor scavsColor, const WzMap::MapPreviewColorScheme::DrawOptions& drawOptions, const PngSaveOptions& pngOptions, const MapToolsPreviewSizes& previewSizes, uint32_t mapSeed, bool verbose)
+{
+	auto logger = std::make_shared<MapToolDebugLogger>(verbose, isStdoutOutputPath(outputPNGPath)); // keep stdout clean when streaming the PNG
+
+	std::vector<uint8_t> pngData;
+	bool result = getOrGenerateCachedOutput(cache, inputPath, "genpreview", previewOptionsCacheString(playerColorProvider, scavsColor, drawOptions, pngOptions) + previewSizesCacheString(previewSizes), mapSeed, logger, [&](LoadedMapPackage& loadedPackage, std::vector<uint8_t>& output) -> bool {
+		PngSaveOptions previewPngOptions = pngOptions;
+		auto previewResult = generateMapPreview_FromMapObject_Impl(*(loadedPackage.map.get()), playerColorProvider, scavsColor, drawOptions, loadedPackage.package->levelDetails(), previewPngOptions);
+		if (!previewResult)
+		{
+			return false;
+		}
+		if (!previewSizes.sizes.empty())
+		{
+			std::vector<MapPreviewSizePNGData> outputs;
+			if (!encodeMapPreviewSizesPNG(*previewResult, previewSizes, previewPngOptions, outputs))
+			{
+				return false;
+			}
+			packMapPreviewSizesPNGData(outputs, output);
+			return true;
+		}
+		return encodeMapPreviewPNG(*previewResult, previewPngOptions, output);
+	}, pngData);
+	if (!result)
+	{
+		return false;
+	}
+
+	if (!previewSizes.sizes.empty())
+	{
+		std::vector<MapPreviewSizePNGData> outputs;
+		if (!unpackMapPreviewSizesPNGData(pngData, previewSizes.sizes.size(), outputs))
+		{
+			std::cerr << "Invalid cached map previews for: " << inputPath << std::endl;
+			return false;
+		}
+		return outputMapPreviewSizesPNGData(outputs, previewSizes, outputPNGPath);
+	}
+	return outputMapPreviewPNGData(pngData, outputPNGPath);
+}
+
+static std::string convertOptionsCacheString(WzMap::LevelFormat levelFormat, WzMap::OutputFormat outputFormat, bool copyAdditionalFiles, bool fixedLastMod, const optional<std::string>& override_map_name)
+{
+	std::stringstream options;
+	options << "levelformat=" << static_cast<int>(levelFormat);
+	options << ";format=" << static_cast<int>(outputFormat);
+	options << ";preserve-mods=" << copyAdditionalFiles;
+	options << ";fixed-lastmod=" << fixedLastMod;
+	options << ";set-name=" << ((override_map_name.has_value()) ? "1" + override_map_name.value() : "0");
+	return options.str();
+}
+
+static bool convertMapPackage_Cached(MapToolsResultCache& cache, const std::string& inputPath, const std::string& outputPath, WzMap::LevelFormat levelFormat, WzMap::OutputFormat outputFormat, uint32_t mapSeed, bool copyAdditionalFiles, bool verbose, bool fixedLastMod, optional<std::string> override_map_name)
+{
+	auto logger = std::make_shared<MapToolDebugLogger>(verbose);
+
+	// Only .wz archive outputs are cached (the archive file is stored as-is)
+	std::vector<uint8_t> archiveData;
+	bool cacheHit = false;
+	bool result = getOrGenerateCachedOutput(cache, inputPath, "convert", convertOptionsCacheString(levelFormat, outputFormat, copyAdditionalFiles, fixedLastMod, override_map_name), mapSeed, logger, [&](LoadedMapPackage& loadedPackage, std::vector<uint8_t>& output) -> bool {
+		if (!exportLoadedMapPackage(loadedPackage, outputPath, levelFormat, outputFormat, copyAdditionalFiles, false, fixedLastMod, override_map_name, logger))
+		{
+			return false;
+		}
+		printConvertedMapPackageSummary(loadedPackage, outputPath, levelFormat, outputFormat);
+
+		std::vector<char> fileData;
+		if (!WzMap::StdIOProvider().loadFullFile(outputPath, fileData))
+		{
+			std::cerr << "Failed to read back converted map package: " << outputPath << std::endl;
+			return false;
+		}
+		output.assign(fileData.begin(), fileData.end());
+		return true;
+	}, archiveData, &cacheHit);
+	if (!result)
+	{
+		return false;
+	}
+	if (!cacheHit)
+	{
+		return true;
+	}
+
+	MapToolsScopedPhase writePhase("write output");
+	WzMap::StdIOProvider stdOutput;
+	if (!stdOutput.writeFullFile(outputPath, reinterpret_cast<const char*>(archiveData.data()), static_cast<uint32_t>(archiveData.size())))
+	{
+		std::cerr << "Failed to export map package to: " << outputPath << std::endl;
+		return false;
+	}
+	std::cout << "Converted map package (from cache):" << std::endl;
+	std::cout << "\t - to format [" << outputFormat << "]" << std::endl;
+	std::cout << "\t - with: " << levelFormat << std::endl;
+	std::cout << "\t - saved to: " << outputPath << std::endl;
+	return true;
+}
+
+// Generates a single (NDJSON) result line for a map package in a batch
+static nlohmann::ordered_json generateBatchMapInfoResult(const std::string& inputPath, uint32_t mapSeed, std::shared_ptr<MapToolDebugLogger> logger, MapToolsResultCache* pCache)
+{
+	nlohmann::ordered_json result = nlohmann::ordered_json::object();
+	result["input"] = inputPath;
+
+	optional<nlohmann::ordered_json> mapInfoJSON;
+	if (pCache)
+	{
+		mapInfoJSON = generateMapInfoJSON_Cached(*pCache, inputPath, mapSeed, logger);
+	}
+	else if (inputPathIsFile(inputPath))
+	{
+#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
+		mapInfoJSON = generateMapInfoJSON_FromArchive(inputPath, mapSeed, logger);
+#else
+		result["error"] = "maptools was compiled without support for .wz archives";
+		return result;
+#endif
+	}
+	else
+	{
+		mapInfoJSON = generateMapInfoJSON_FromPackageContents(inputPath, mapSeed, logger);
+	}
+
+	if (!mapInfoJSON.has_value())
+	{
+		result["error"] = "Failed to extract map info / stats";
+		return result;
+	}
+	result["info"] = std::move(mapInfoJSON.value());
+	return result;
+}
+
+// The journal entry for a processed batch input
+struct BatchJournalEntry
+{
+	MapToolsBatchJournal* pJournal = nullptr; // (null if there is no journal)
+	std::string inputPath;
+	std::string inputHash;
+	std::vector<std::string> outputPaths;
+	// set by a processor whose output is written later (ex. by the output writer thread) - it then records the entry itself, once it is
+	bool deferred = false;
+
+	void record(bool succeeded) const
+	{
+		if (pJournal)
+		{
+			pJournal->record(inputPath, inputHash, succeeded, outputPaths);
+		}
+	}
+};
+
+// Processes a batch input, setting journalEntry.outputPaths to where its output was written
+// (memoryReservation is held while the input is processed - a processor that then waits to output its result should release it first)
+typedef std::function<bool (const MapToolsBatchInput& input, size_t inputIndex, MapToolsMemoryReservation& memoryReservation, BatchJournalEntry& journalEntry)> BatchInputProcessor;
+
+struct BatchProcessingCounts
+{
+	size_t numInputs = 0;
+	size_t numFailed = 0;
+	// inputs skipped because the journal records them as already completed (--resume)
+	size_t numSkipped = 0;
+};
+
+typedef std::function<void (const MapToolsBatchInput& input, size_t inputIndex)> BatchInputSkippedHandler;
+
+// The reorder buffer for batch NDJSON output holds (at least) this many results, or this many per job
+static const size_t BatchOutputMinPendingResults = 256;
+static const size_t BatchOutputPendingResultsPerJob = 16;
+
+// Returns a budget for the estimated memory usage of the maps processed at once, if jobs is 0 (auto) and there is a
+// (cgroup) memory limit - otherwise null
+static std::unique_ptr<MapToolsMemoryBudget> makeAutoMemoryBudget(unsigned jobs)
+{
+	if (jobs != 0)
+	{
+		return nullptr;
+	}
+	uint64_t memoryBudget = MapToolsResources::mapMemoryBudget();
+	if (memoryBudget == 0)
+	{
+		return nullptr;
+	}
+	return std::make_unique<MapToolsMemoryBudget>(memoryBudget);
+}
+
+// Processes the batch inputs (in the shard) on a pool of worker threads
+// Each input is handed to the pool as soon as it is found (while the rest are still being discovered), and the largest inputs are processed first
+// (unless processInOrder, in which case inputs are found in a fixed order - see enumerateBatchInputs - and started in that order, i.e. in inputIndex order)
+// If pJournal is non-null, each completed input is recorded in it once its output is synced to disk (and inputs it records as completed are skipped)
+// onInputSkipped (if set) is called for each found input that isn't processed (not in the shard, or already completed)
+// If jobs is 0 (auto), the inputs processed at once are also limited by the memory available (see makeAutoMemoryBudget)
+// If uniqueRelativePaths (i.e. each input has its own output, named by its relative path), an input with the same relative
+// path as an earlier one (ex. listed as /a/map.wz and /b/map.wz) fails, rather than replacing the earlier one's output
+// Returns false if any of the inputs could not be enumerated
+static bool processBatchInputs(const MapToolsBatchInputSources& sources, unsigned jobs, MapToolsBatchJournal* pJournal, bool processInOrder, bool uniqueRelativePaths, const BatchInputProcessor& processInput, const BatchInputSkippedHandler& onInputSkipped, BatchProcessingCounts& counts)
+{
+	std::atomic<size_t> numFound(0);
+	std::atomic<size_t> numFailed(0);
+	std::atomic<size_t> numSkipped(0);
+	bool result = false;
+	const MapToolsBatchShard& shard = sources.shard;
+	bool shardByContent = (shard.count > 1 && shard.key == MapToolsBatchShard::Key::ContentHash);
+	std::mutex enqueueMutex;
+	size_t numEnqueued = 0;
+	// relative path -> the input that has it (if uniqueRelativePaths)
+	std::mutex relativePathsMutex;
+	std::unordered_map<std::string, std::string> claimedRelativePaths;
+	// Returns the earlier input with the same relative path (if any)
+	auto claimRelativePath = [&](const MapToolsBatchInput& input) -> std::string {
+		std::lock_guard<std::mutex> lock(relativePathsMutex);
+		auto claimed = claimedRelativePaths.emplace(input.relativePath, input.path);
+		return (claimed.second) ? std::string() : claimed.first->second;
+	};
+	MapToolsLog::startAsyncWriter();
+	MapToolsProgress::start();
+	{
+		MapToolsWorkerPool workerPool(resolveBatchJobCount(jobs));
+		auto memoryBudget = makeAutoMemoryBudget(jobs);
+		MapToolsMemoryBudget* pMemoryBudget = memoryBudget.get();
+		MapToolsScopedPhase collectInputsPhase("collect inputs");
+		result = enumerateBatchInputs(sources, workerPool.numWorkers(), processInOrder, [&](MapToolsBatchInput&& input) {
+			if (!shardByContent)
+			{
+				if (!batchInputIsInShard(shard, input))
+				{
+					return;
+				}
+				++numFound;
+			}
+			MapToolsProgress::inputFound(input.size);
+			uint64_t priority = (processInOrder) ? 0 : input.size;
+			// (indexes are assigned + enqueued together, so tasks of equal priority are started in index order)
+			std::lock_guard<std::mutex> lock(enqueueMutex);
+			size_t inputIndex = numEnqueued++;
+			// (claimed in the order inputs are found - so for a list, the first of the inputs with the same relative path is processed)
+			std::string collidingInput = (uniqueRelativePaths && !shardByContent) ? claimRelativePath(input) : std::string();
+			workerPool.enqueue([&processInput, &onInputSkipped, &claimRelativePath, &numFound, &numFailed, &numSkipped, &shard, shardByContent, uniqueRelativePaths, pJournal, pMemoryBudget, input, inputIndex, collidingInput]() mutable {
+				if (shardByContent)
+				{
+					// (hashing the contents requires reading the input, so is done on the worker threads)
+					if (!batchInputIsInShard(shard, input))
+					{
+						MapToolsProgress::inputDiscarded(input.size);
+						if (onInputSkipped)
+						{
+							onInputSkipped(input, inputIndex);
+						}
+						return;
+					}
+					++numFound;
+					if (uniqueRelativePaths)
+					{
+						collidingInput = claimRelativePath(input);
+					}
+				}
+				std::string inputHash;
+				if (pJournal)
+				{
+					// (an input that can't be hashed is journaled with an empty hash, and never skipped)
+					hashMapPackageContents(input.path, inputHash);
+					if (pJournal->isCompleted(input.path, inputHash))
+					{
+						++numSkipped;
+						MapToolsProgress::inputSkipped(input.size);
+						if (onInputSkipped)
+						{
+							onInputSkipped(input, inputIndex);
+						}
+						return;
+					}
+				}
+				MapToolsTraceSpan mapSpan("map", input.path);
+				MapToolsLogMapContext logContext(input.path);
+				BatchJournalEntry journalEntry;
+				journalEntry.pJournal = pJournal;
+				journalEntry.inputPath = input.path;
+				journalEntry.inputHash = inputHash;
+				auto startTime = std::chrono::steady_clock::now();
+				MapToolsProgress::inputStarted();
+				bool succeeded = false;
+				if (collidingInput.empty())
+				{
+					// (only held while the input is loaded + processed - not while its output is synced or journaled)
+					MapToolsMemoryReservation memoryReservation(pMemoryBudget, input.path);
+					succeeded = processInput(input, inputIndex, memoryReservation, journalEntry);
+				}
+				else
+				{
+					std::cerr << "ERROR: " << input.path << " has the same output path as " << collidingInput << " (" << input.relativePath << ") - skipped, rather than replacing its output" << std::endl;
+				}
+				if (succeeded && pJournal && !journalEntry.deferred)
+				{
+					for (const auto& outputPath : journalEntry.outputPaths)
+					{
+						if (!outputPath.empty() && !syncOutputToDisk(outputPath))
+						{
+							// (otherwise a crash could leave a partial output, which --resume would treat as completed)
+							std::cerr << "ERROR: Failed to sync output to disk: " << outputPath << std::endl;
+							succeeded = false;
+							break;
+						}
+					}
+				}
+				MapToolsProgress::inputFinished(input.size, succeeded);
+				MapToolsStats::recordInput(input.path, input.size, std::chrono::steady_clock::now() - startTime, succeeded);
+				if (!succeeded)
+				{
+					++numFailed;
+				}
+				if (!journalEntry.deferred)
+				{
+					journalEntry.record(succeeded);
+				}
+			}, priority);
+		});
+		collectInputsPhase.stop();
+		MapToolsProgress::enumerationFinished();
+		workerPool.waitForAll();
+	}
+	MapToolsProgress::stop();
+	MapToolsLog::stopAsyncWriter();
+	counts.numInputs = numFound;
+	counts.numFailed = numFailed;
+	counts.numSkipped = numSkipped;
+	return result;
+}
+
+// Returns the output path for a batch input (its relative path, under the output directory) with the extension replaced
+static std::string makeBatchOutputPath(const std::string& outputDirectory, const MapToolsBatchInput& input, const char* outputExtension)
+{
+	std::filesystem::path outputPath = std::filesystem::path(outputDirectory) / std::filesystem::path(input.relativePath);
+	outputPath.replace_extension(outputExtension);
+	return outputPath.string();
+}
+
+// If replaceExisting, an existing output is removed (ex. the partial output of an interrupted run, when resuming)
+static bool prepareBatchOutputPath(const std::string& outputPath, bool replaceExisting)
+{
+	std::error_code ec;
+	if (std::filesystem::exists(outputPath, ec))
+	{
+		if (!replaceExisting)
+		{
+			std::cerr << "Output path already exists: " << outputPath << std::endl;
+			return false;
+		}
+		if (std::filesystem::remove_all(outputPath, ec) == static_cast<std::uintmax_t>(-1) || ec)
+		{
+			std::cerr << "Failed to remove existing output: " << outputPath << " (" << ec.message() << ")" << std::endl;
+			return false;
+		}
+	}
+	std::filesystem::path parentPath = std::filesystem::path(outputPath).parent_path();
+	if (!parentPath.empty() && !std::filesystem::create_directories(parentPath, ec) && ec)
+	{
+		std::cerr << "Failed to create output directory: " << parentPath.string() << " (" << ec.message() << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// specify string->value mappings
+static const std::map<std::string, WzMap::MapType> maptype_map{{"skirmish", WzMap::MapType::SKIRMISH}, {"campaign", WzMap::MapType::CAMPAIGN}};
+static const std::map<std::string, WzMap::LevelFormat> levelformat_map{{"latest", WzMap::LatestLevelFormat}, {"json", WzMap::LevelFormat::JSON}, {"lev", WzMap::LevelFormat::LEV}};
+static const std::map<std::string, WzMap::OutputFormat> outputformat_map{{"latest", WzMap::LatestOutputFormat}, {"jsonv2", WzMap::OutputFormat::VER3}, {"json", WzMap::OutputFormat::VER2}, {"bjo", WzMap::OutputFormat::VER1_BINARY_OLD}};
+static const std::map<std::string, MapToolsPreviewColorProvider> previewcolors_map{{"simple", MapToolsPreviewColorProvider::Simple}, {"wz", MapToolsPreviewColorProvider::WZPlayerColors}};
+static const std::map<std::string, MapToolsBatchShard::Key> shardkey_map{{"path", MapToolsBatchShard::Key::RelativePath}, {"content", MapToolsBatchShard::Key::ContentHash}};
+static const std::map<std::string, MapToolsLog::Format> logformat_map{{"text", MapToolsLog::Format::Text}, {"json", MapToolsLog::Format::JSON}};
+static const std::map<std::string, PngCompressionProfile> pngprofile_map{{"fast", PngCompressionProfile::Fast}, {"default", PngCompressionProfile::Default}, {"max", PngCompressionProfile::Max}};
+static const std::map<std::string, PngFilterMode> pngfilter_map{{"auto", PngFilterMode::Auto}, {"none", PngFilterMode::None}, {"sub", PngFilterMode::Sub}, {"up", PngFilterMode::Up}, {"paeth", PngFilterMode::Paeth}, {"adaptive", PngFilterMode::Adaptive}};
+static const std::map<std::string, std::string> jobs_auto_map{{"auto", "0"}};
+static const unsigned MaxPngThreads = 256;
+// (libdeflate is only listed if it was compiled in)
+static std::map<std::string, PngDeflateBackend> pngDeflateBackendMap()
+{
+	std::map<std::string, PngDeflateBackend> backends{{"zlib", PngDeflateBackend::Zlib}};
+	if (pngDeflateBackendIsAvailable(PngDeflateBackend::Libdeflate))
+	{
+		backends["libdeflate"] = PngDeflateBackend::Libdeflate;
+	}
+	return backends;
+}
+static const std::map<std::string, PngDeflateBackend> pngdeflate_map = pngDeflateBackendMap();
+static const std::string pngprofile_description = "value in {\n\t\tfast -> fastest encoding (zlib level 1, Z_RLE),\n\t\tdefault -> zlib default settings,\n\t\tmax -> smallest files (zlib level 9)\n\t}";
+static const std::string pngdeflate_description = "value in {\n\t\tzlib -> libpng + zlib,\n\t\tlibdeflate -> libdeflate (faster at the same level, if compiled in)\n\t}";
+static const std::string pngfilter_description = "value in {\n\t\tauto -> picked per image, by test-compressing a sample of rows,\n\t\tnone / sub / up / paeth -> that filter for every row,\n\t\tadaptive -> the lowest-cost filter per row (libpng's default)\n\t}";
+
+// Resolves --png-threads auto to the number of available CPUs
+static std::string resolvePngThreadsValue(std::string value)
+{
+	if (CLI::detail::to_lower(value) == "auto")
+	{
+		return std::to_string(MapToolsResources::availableCPUs());
+	}
+	return value;
+}
+
+static bool strEndsWith(const std::string& str, const std::string& suffix)
+{
+	return (str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+/// Check for a specified file extension
+class FileExtensionValidator : public CLI::Validator {
+  public:
+	FileExtensionValidator(std::string fileExtension, bool allowStdout = false) {
+		std::stringstream out;
+		out << "FILE(*" << fileExtension << ")";
+		if (allowStdout)
+		{
+			out << " or - (stdout)";
+		}
+		description(out.str());
+
+		if (!fileExtension.empty())
+		{
+			if (fileExtension.front() != '.')
+			{
+				fileExtension = "." + fileExtension;
+			}
+		}
+
+		func_ = [fileExtension, allowStdout](std::string &filename) {
+			if (allowStdout && isStdoutOutputPath(filename))
+			{
+				return std::string();
+			}
+			if (!strEndsWith(filename, fileExtension))
+			{
+				return "Filename does not end in extension: " + fileExtension;
+			}
+			return std::string();
+		};
+	}
+};
+
+/// Check for a glob pattern (ex. "maps/**/*.wz")
+class GlobPatternValidator : public CLI::Validator {
+  public:
+	GlobPatternValidator() {
+		description("GLOB");
+
+		func_ = [](std::string &input) {
+			if (input.find_first_of("*?") == std::string::npos)
+			{
+				return std::string("Not a glob pattern: ") + input;
+			}
+			return std::string();
+		};
+	}
+};
+
+/// Check for a comma-separated list of preview sizes
+class PreviewSizesValidator : public CLI::Validator {
+  public:
+	PreviewSizesValidator() {
+		description("SIZE[,SIZE...]");
+
+		func_ = [](std::string &input) {
+			std::vector<MapToolsPreviewSize> sizes;
+			std::string error;
+			if (!parsePreviewSizes(input, sizes, error))
+			{
+				return error;
+			}
+			return std::string();
+		};
+	}
+};
+
+/// Check for an output name template containing {size}
+class PreviewSizeNameTemplateValidator : public CLI::Validator {
+  public:
+	PreviewSizeNameTemplateValidator() {
+		description("TEMPLATE");
+
+		func_ = [](std::string &input) {
+			return validatePreviewSizeNameTemplate(input);
+		};
+	}
+};
+
+/// Check for a "i/N" shard specification
+class BatchShardValidator : public CLI::Validator {
+  public:
+	BatchShardValidator() {
+		description("i/N");
+
+		func_ = [](std::string &input) {
+			MapToolsBatchShard shard;
+			if (!parseBatchShard(input, shard))
+			{
+				return std::string("Invalid shard (expected i/N, where 1 <= i <= N): ") + input;
+			}
+			return std::string();
+		};
+	}
+};
+
+class AsHexColorValue : public CLI::Validator {
+  public:
+	explicit AsHexColorValue() {
+		description("RGB hexadecimal color code");
+
+		// transform function
+		func_ = [](std::string &input) -> std::string {
+
+			CLI::detail::rtrim(input);
+			if (input.empty()) {
+				throw CLI::ValidationError("Input is empty");
+			}
+
+			auto convertedValue = convertHexColorToPreviewColor(input);
+			if (!convertedValue.has_value())
+			{
+				throw CLI::ValidationError("Invalid RGB hex color code format");
+			}
+
+			// Return empty error string (success)
+			return std::string{};
+		};
+	}
+};
+
+// [SERVE MODE]
+// Requests and responses are single-line JSON objects (NDJSON).
+// Request options use the same names and values as the equivalent CLI options.
+
+class ServeRequestError : public std::runtime_error
+{
+public:
+	explicit ServeRequestError(const std::string& what)
+	: std::runtime_error(what)
+	{ }
+};
+
+static std::string base64Encode(const std::vector<uint8_t>& data)
+{
+	static const char encodingTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string output;
+	output.reserve(((data.size() + 2) / 3) * 4);
+	size_t i = 0;
+	for (; i + 2 < data.size(); i += 3)
+	{
+		uint32_t triple = (static_cast<uint32_t>(data[i]) << 16) | (static_cast<uint32_t>(data[i + 1]) << 8) | static_cast<uint32_t>(data[i + 2]);
+		output.push_back(encodingTable[(triple >> 18) & 0x3F]);
+		output.push_back(encodingTable[(triple >> 12) & 0x3F]);
+		output.push_back(encodingTable[(triple >> 6) & 0x3F]);
+		output.push_back(encodingTable[triple & 0x3F]);
+	}
+	if (i < data.size())
+	{
+		uint32_t triple = static_cast<uint32_t>(data[i]) << 16;
+		if (i + 1 < data.size())
+		{
+			triple |= static_cast<uint32_t>(data[i + 1]) << 8;
+		}
+		output.push_back(encodingTable[(triple >> 18) & 0x3F]);
+		output.push_back(encodingTable[(triple >> 12) & 0x3F]);
+		output.push_back((i + 1 < data.size()) ? encodingTable[(triple >> 6) & 0x3F] : '=');
+		output.push_back('=');
+	}
+	return output;
+}
+
+static bool base64Decode(const std::string& input, std::vector<uint8_t>& output)
+{
+	if (input.size() % 4 != 0)
+	{
+		return false;
+	}
+	auto decodeChar = [](char c) -> int {
+		if (c >= 'A' && c <= 'Z') { return c - 'A'; }
+		if (c >= 'a' && c <= 'z') { return c - 'a' + 26; }
+		if (c >= '0' && c <= '9') { return c - '0' + 52; }
+		if (c == '+') { return 62; }
+		if (c == '/') { return 63; }
+		return -1;
+	};
+	output.clear();
+	output.reserve((input.size() / 4) * 3);
+	for (size_t i = 0; i < input.size(); i += 4)
+	{
+		size_t padding = (input[i + 3] == '=') ? ((input[i + 2] == '=') ? 2 : 1) : 0;
+		if (padding > 0 && i + 4 != input.size())
+		{
+			return false;
+		}
+		uint32_t quad = 0;
+		for (size_t j = 0; j < 4 - padding; ++j)
+		{
+			int value = decodeChar(input[i + j]);
+			if (value < 0)
+			{
+				return false;
+			}
+			quad |= static_cast<uint32_t>(value) << (18 - (6 * j));
+		}
+		output.push_back(static_cast<uint8_t>((quad >> 16) & 0xFF));
+		if (padding < 2)
+		{
+			output.push_back(static_cast<uint8_t>((quad >> 8) & 0xFF));
+		}
+		if (padding < 1)
+		{
+			output.push_back(static_cast<uint8_t>(quad & 0xFF));
+		}
+	}
+	return true;
+}
+
+static optional<std::string> getServeRequestString(const nlohmann::ordered_json& request, const char* key, bool required = false)
+{
+	auto it = request.find(key);
+	if (it == request.end() || it->is_null())
+	{
+		if (required)
+		{
+			throw ServeRequestError(std::string("Missing required option: ") + key);
+		}
+		return nullopt;
+	}
+	if (!it->is_string())
+	{
+		throw ServeRequestError(std::string("Option must be a string: ") + key);
+	}
+	return it->get<std::string>();
+}
+
+static bool getServeRequestFlag(const nlohmann::ordered_json& request, const char* key)
+{
+	auto it = request.find(key);
+	if (it == request.end() || it->is_null())
+	{
+		return false;
+	}
+	if (!it->is_boolean())
+	{
+		throw ServeRequestError(std::string("Option must be a boolean: ") + key);
+	}
+	return it->get<bool>();
+}
+
+static uint32_t getServeRequestUInt(const nlohmann::ordered_json& request, const char* key, uint32_t defaultValue, uint32_t minValue, uint32_t maxValue)
+{
+	auto it = request.find(key);
+	if (it == request.end() || it->is_null())
+	{
+		return defaultValue;
+	}
+	if (!it->is_number_unsigned() || it->get<uint64_t>() < minValue || it->get<uint64_t>() > maxValue)
+	{
+		throw ServeRequestError(std::string("Option must be an integer in [") + std::to_string(minValue) + ", " + std::to_string(maxValue) + "]: " + key);
+	}
+	return it->get<uint32_t>();
+}
+
+// Gets a string option, checked by the same validator as the equivalent CLI option
+static optional<std::string> getServeRequestValidatedString(const nlohmann::ordered_json& request, const char* key, const CLI::Validator& validator)
+{
+	auto value = getServeRequestString(request, key);
+	if (value.has_value())
+	{
+		std::string error;
+		try
+		{
+			error = validator(value.value());
+		}
+		catch (const CLI::ValidationError& e)
+		{
+			error = e.what();
+		}
+		if (!error.empty())
+		{
+			throw ServeRequestError("Invalid value for option " + std::string(key) + ": " + error);
+		}
+	}
+	return value;
+}
+
+template<typename T>
+static T getServeRequestEnum(const nlohmann::ordered_json& request, const char* key, const std::map<std::string, T>& valueMap, const std::string& defaultValue, bool required = false)
+{
+	std::string value = getServeRequestString(request, key, required).value_or(defaultValue);
+	auto it = valueMap.find(CLI::detail::to_lower(value));
+	if (it == valueMap.end())
+	{
+		throw ServeRequestError("Invalid value for option " + std::string(key) + ": " + value);
+	}
+	return it->second;
+}
+
+static nlohmann::ordered_json handleServeRequest_Info(LoadedMapPackage& loadedPackage, std::shared_ptr<MapToolDebugLogger> logger)
+{
+	auto mapInfoJSON = generateMapInfoJSON_FromLoadedPackage(loadedPackage, logger);
+	if (!mapInfoJSON.has_value())
+	{
+		throw ServeRequestError("Failed to extract map info / stats");
+	}
+	return std::move(mapInfoJSON.value());
+}
+
+// The options of a genpreview request (parsed + validated before the map is loaded)
+struct ServeGenPreviewOptions
+{
+	MapToolsPreviewColorProvider playerColorProvider = MapToolsPreviewColorProvider::Simple;
+	WzMap::MapPreviewColor scavsColor = ScavsColorDefault;
+	WzMap::MapPreviewColorScheme::DrawOptions drawOptions;
+	PngSaveOptions pngOptions;
+	MapToolsPreviewSizes previewSizes;
+	optional<std::string> outputPath;
+	bool hasOutputFile = false;
+};
+
+static ServeGenPreviewOptions parseServeRequest_GenPreview(const nlohmann::ordered_json& request)
+{
+	ServeGenPreviewOptions options;
+	options.playerColorProvider = getServeRequestEnum(request, "playercolors", previewcolors_map, "simple");
+	auto scavsColorStr = getServeRequestValidatedString(request, "scavcolor", AsHexColorValue());
+	if (scavsColorStr.has_value())
+	{
+		options.scavsColor = convertHexColorToPreviewColor(scavsColorStr.value()).value();
+	}
+	options.drawOptions.set(true);
+	if (!WzMap::lexical_cast(getServeRequestString(request, "layers").value_or("all"), options.drawOptions))
+	{
+		throw ServeRequestError("Invalid value for option: layers");
+	}
+	PngSaveOptions& pngOptions = options.pngOptions;
+	pngOptions.compressionProfile = getServeRequestEnum(request, "png-profile", pngprofile_map, "max");
+	pngOptions.indexedColor = getServeRequestFlag(request, "png-palette");
+	pngOptions.numThreads = getServeRequestUInt(request, "png-threads", 1, 1, MaxPngThreads);
+	pngOptions.deflateBackend = getServeRequestEnum(request, "png-deflate", pngdeflate_map, "zlib");
+	pngOptions.filterMode = getServeRequestEnum(request, "png-filter", pngfilter_map, "auto");
+	pngOptions.scale = getServeRequestUInt(request, "scale", 1, 1, MaxPreviewScale);
+	MapToolsPreviewSizes& previewSizes = options.previewSizes;
+	auto sizesStr = getServeRequestValidatedString(request, "sizes", PreviewSizesValidator());
+	if (sizesStr.has_value() && !sizesStr.value().empty())
+	{
+		std::string error;
+		parsePreviewSizes(sizesStr.value(), previewSizes.sizes, error);
+		previewSizes.nameTemplate = getServeRequestValidatedString(request, "sizes-template", PreviewSizeNameTemplateValidator()).value_or(DefaultPreviewSizeNameTemplate);
+		if (pngOptions.scale > 1)
+		{
+			throw ServeRequestError("Options sizes and scale can't be combined (use Nx sizes)");
+		}
+	}
+	options.outputPath = getServeRequestValidatedString(request, "output", FileExtensionValidator(".png", true));
+	options.hasOutputFile = options.outputPath.has_value() && !isStdoutOutputPath(options.outputPath.value());
+	if (!previewSizes.sizes.empty() && !options.hasOutputFile)
+	{
+		throw ServeRequestError("Option sizes requires an output file");
+	}
+	return options;
+}
+
+static nlohmann::ordered_json handleServeRequest_GenPreview(LoadedMapPackage& loadedPackage, const ServeGenPreviewOptions& options)
+{
+	PngSaveOptions pngOptions = options.pngOptions;
+	const MapToolsPreviewSizes& previewSizes = options.previewSizes;
+	const optional<std::string>& outputPath = options.outputPath;
+	auto previewResult = generateMapPreview_FromMapObject_Impl(*(loadedPackage.map.get()), options.playerColorProvider, options.scavsColor, options.drawOptions, loadedPackage.package->levelDetails(), pngOptions);
+	if (!previewResult)
+	{
+		throw ServeRequestError("Failed to generate map preview");
+	}
+
+	nlohmann::ordered_json result = nlohmann::ordered_json::object();
+	if (!previewSizes.sizes.empty())
+	{
+		std::vector<MapPreviewSizePNGData> outputs;
+		if (!encodeMapPreviewSizesPNG(*previewResult, previewSizes, pngOptions, outputs))
+		{
+			throw ServeRequestError("Failed to encode preview PNG");
+		}
+		MapToolsScopedPhase writePhase("write output");
+		WzMap::StdIOProvider stdOutput;
+		nlohmann::ordered_json outputsJSON = nlohmann::ordered_json::array();
+		for (size_t idx = 0; idx < outputs.size(); ++idx)
+		{
+			std::string sizeOutputPath = makePreviewSizeOutputPath(outputPath.value(), previewSizes.nameTemplate, previewSizes.sizes[idx]);
+			if (!stdOutput.writeFullFile(sizeOutputPath, reinterpret_cast<const char*>(outputs[idx].pngData.data()), static_cast<uint32_t>(outputs[idx].pngData.size())))
+			{
+				throw ServeRequestError("Failed to save preview PNG: " + sizeOutputPath);
+			}
+			nlohmann::ordered_json outputJSON = nlohmann::ordered_json::object();
+			outputJSON["size"] = previewSizes.sizes[idx].spec;
+			outputJSON["output"] = sizeOutputPath;
+			outputJSON["width"] = outputs[idx].width;
+			outputJSON["height"] = outputs[idx].height;
+			outputsJSON.push_back(std::move(outputJSON));
+		}
+		result["outputs"] = std::move(outputsJSON);
+		return result;
+	}
+
+	std::vector<uint8_t> pngData;
+	if (!encodeMapPreviewPNG(*previewResult, pngOptions, pngData))
+	{
+		throw ServeRequestError("Failed to encode preview PNG");
+	}
+
+	if (options.hasOutputFile)
+	{
+		MapToolsScopedPhase writePhase("write output");
+		WzMap::StdIOProvider stdOutput;
+		if (!stdOutput.writeFullFile(outputPath.value(), reinterpret_cast<const char*>(pngData.data()), static_cast<uint32_t>(pngData.size())))
+		{
+			throw ServeRequestError("Failed to save preview PNG: " + outputPath.value());
+		}
+		result["output"] = outputPath.value();
+	}
+	else
+	{
+		// No output file - return the PNG inline
+		result["png"] = base64Encode(pngData);
+	}
+	result["width"] = previewResult->width * pngOptions.scale;
+	result["height"] = previewResult->height * pngOptions.scale;
+	return result;
+}
+
+// The options of a convert request (parsed + validated before the map is loaded)
+struct ServeConvertOptions
+{
+	std::string outputPath;
+	WzMap::LevelFormat levelFormat = WzMap::LatestLevelFormat;
+	WzMap::OutputFormat outputFormat = WzMap::LatestOutputFormat;
+	optional<std::string> override_map_name;
+	bool preserveMods = false;
+	bool outputUncompressed = false;
+	bool fixedLastMod = false;
+};
+
+static ServeConvertOptions parseServeRequest_Convert(const nlohmann::ordered_json& request)
+{
+	ServeConvertOptions options;
+	options.outputPath = getServeRequestString(request, "output", true).value();
+	std::string outputPathError = CLI::NonexistentPath(options.outputPath);
+	if (!outputPathError.empty())
+	{
+		throw ServeRequestError(outputPathError);
+	}
+	options.levelFormat = getServeRequestEnum(request, "levelformat", levelformat_map, "latest");
+	options.outputFormat = getServeRequestEnum(request, "format", outputformat_map, "", true);
+	options.override_map_name = getServeRequestString(request, "set-name");
+	if (options.override_map_name.has_value() && options.override_map_name.value().empty())
+	{
+		options.override_map_name = nullopt;
+	}
+	options.preserveMods = getServeRequestFlag(request, "preserve-mods");
+	options.outputUncompressed = getServeRequestFlag(request, "output-uncompressed");
+	options.fixedLastMod = getServeRequestFlag(request, "fixed-lastmod");
+	return options;
+}
+
+static nlohmann::ordered_json handleServeRequest_Convert(LoadedMapPackage& loadedPackage, const ServeConvertOptions& options, std::shared_ptr<MapToolDebugLogger> logger)
+{
+	if (!exportLoadedMapPackage(loadedPackage, options.outputPath, options.levelFormat, options.outputFormat, options.preserveMods, options.outputUncompressed, options.fixedLastMod, options.override_map_name, logger))
+	{
+		throw ServeRequestError("Failed to export map package to: " + options.outputPath);
+	}
+
+	nlohmann::ordered_json result = nlohmann::ordered_json::object();
+	result["output"] = options.outputPath;
+	result["mapFormat"] = loadedFormatToString(loadedPackage.map->loadedMapFormat());
+	return result;
+}
+
+static nlohmann::ordered_json handleServeRequest(const nlohmann::ordered_json& request, uint32_t defaultMapSeed, bool verbose)
+{
+	nlohmann::ordered_json response = nlohmann::ordered_json::object();
+	auto idIt = request.find("id");
+	response["id"] = (idIt != request.end()) ? *idIt : nlohmann::ordered_json(nullptr);
+
+	try
+	{
+		std::string op = getServeRequestString(request, "op", true).value();
+		if (op != "info" && op != "genpreview" && op != "convert")
+		{
+			throw ServeRequestError("Unknown op: " + op);
+		}
+		std::string inputPath = getServeRequestString(request, "input", true).value();
+		MapToolsTraceSpan requestSpan("request", inputPath);
+		MapToolsLogMapContext logContext(inputPath);
+		uint32_t mapSeed = defaultMapSeed;
+		auto mapSeedIt = request.find("map-seed");
+		if (mapSeedIt != request.end() && !mapSeedIt->is_null())
+		{
+			if (!mapSeedIt->is_number_unsigned() || mapSeedIt->get<uint64_t>() > std::numeric_limits<uint32_t>::max())
+			{
+				throw ServeRequestError("Option must be a uint32: map-seed");
+			}
+			mapSeed = mapSeedIt->get<uint32_t>();
+		}
+
+		// (the op's options are checked first, so a bad request is rejected without loading the map)
+		optional<ServeGenPreviewOptions> genPreviewOptions;
+		optional<ServeConvertOptions> convertOptions;
+		if (op == "genpreview")
+		{
+			genPreviewOptions = parseServeRequest_GenPreview(request);
+		}
+		else if (op == "convert")
+		{
+			convertOptions = parseServeRequest_Convert(request);
+		}
+
+		// stdout is reserved for responses
+		auto logger = std::make_shared<MapToolDebugLogger>(verbose, true);
+		auto loadedPackage = loadMapPackageFromInputPath(inputPath, mapSeed, logger);
+		if (!loadedPackage)
+		{
+			throw ServeRequestError("Failed to load map package: " + inputPath);
+		}
+
+		nlohmann::ordered_json result;
+		if (genPreviewOptions.has_value())
+		{
+			result = handleServeRequest_GenPreview(*loadedPackage, genPreviewOptions.value());
+		}
+		else if (convertOptions.has_value())
+		{
+			result = handleServeRequest_Convert(*loadedPackage, convertOptions.value(), logger);
+		}
+		else
+		{
+			result = handleServeRequest_Info(*loadedPackage, logger);
+		}
+		response["status"] = "ok";
+		response["result"] = std::move(result);
+	}
+	catch (const ServeRequestError& e)
+	{
+		response["status"] = "error";
+		response["error"] = e.what();
+	}
+	catch (const std::exception& e)
+	{
+		response["status"] = "error";
+		response["error"] = std::string("Unexpected error: ") + e.what();
+	}
+
+	return response;
+}
+
+// Sends a request to a child process, returning its response (or an error response, if the child timed out / crashed)
+static nlohmann::ordered_json handleServeRequest_InSubprocess(const nlohmann::ordered_json& request, MapToolsSubprocessPool& subprocessPool, std::chrono::milliseconds timeout)
+{
+	auto idIt = request.find("id");
+	nlohmann::ordered_json requestId = (idIt != request.end()) ? *idIt : nlohmann::ordered_json(nullptr);
+	std::string inputPath;
+	auto inputIt = request.find("input");
+	if (inputIt != request.end() && inputIt->is_string())
+	{
+		inputPath = inputIt->get<std::string>();
+	}
+	MapToolsScopedPhase requestPhase("child process");
+
+	std::string responseLine;
+	std::string exitReason;
+	auto result = subprocessPool.request(inputPath, request.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::replace), timeout, responseLine, &exitReason);
+	nlohmann::ordered_json response;
+	if (result == MapToolsSubprocessWorker::Result::OK)
+	{
+		response = nlohmann::ordered_json::parse(responseLine, nullptr, false);
+		if (!response.is_discarded() && response.is_object())
+		{
+			return response;
+		}
+	}
+
+	response = nlohmann::ordered_json::object();
+	response["id"] = requestId;
+	response["status"] = "error";
+	switch (result)
+	{
+		case MapToolsSubprocessWorker::Result::TimedOut:
+			response["error"] = "Timed out (after " + std::to_string(timeout.count()) + " ms)";
+			response["timed_out"] = true;
+			break;
+		case MapToolsSubprocessWorker::Result::Exited:
+			response["error"] = "Child process crashed (" + exitReason + ")";
+			response["crashed"] = true;
+			break;
+		case MapToolsSubprocessWorker::Result::StartFailed:
+			response["error"] = "Failed to start child process";
+			break;
+		case MapToolsSubprocessWorker::Result::OK:
+			response["error"] = "Invalid response from child process";
+			break;
+	}
+	if (result == MapToolsSubprocessWorker::Result::TimedOut)
+	{
+		std::cerr << "Timed out (after " << timeout.count() << " ms): " << inputPath << std::endl;
+	}
+	else if (result == MapToolsSubprocessWorker::Result::Exited)
+	{
+		std::cerr << "Child process crashed (" << exitReason << ") while processing: " << inputPath << std::endl;
+	}
+	return response;
+}
+
+static void recordServeRequestStats(const nlohmann::ordered_json& request, const nlohmann::ordered_json& response, std::chrono::steady_clock::duration duration)
+{
+	std::string inputPath;
+	auto inputIt = request.find("input");
+	if (inputIt != request.end() && inputIt->is_string())
+	{
+		inputPath = inputIt->get<std::string>();
+	}
+	std::error_code ec;
+	uintmax_t inputSize = std::filesystem::is_regular_file(inputPath, ec) ? std::filesystem::file_size(inputPath, ec) : 0;
+	MapToolsStats::recordInput(inputPath, (ec) ? 0 : static_cast<uint64_t>(inputSize), duration, response.value("status", "") == "ok");
+}
+
+// The most requests that may be pending (queued or in progress) per worker - further requests are rejected until some complete
+static const size_t ServeMaxPendingRequestsPerWorker = 64;
+
+// Reads requests from stdin until EOF, processing them concurrently (responses are output as they complete)
+// If pSubprocessPool is non-null, each request is processed by a child process (so it can be abandoned if it takes longer than mapTimeout, and a crash only takes down that child)
+// If jobs is 0 (auto), the requests processed at once are also limited by the memory available
+static void runServeMode(unsigned jobs, uint32_t defaultMapSeed, bool verbose, MapToolsSubprocessPool* pSubprocessPool, std::chrono::milliseconds mapTimeout)
+{
+	std::mutex outputMutex;
+	auto writeResponse = [&outputMutex](const nlohmann::ordered_json& response) {
+		std::string line = response.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::ignore);
+		line.push_back('\n');
+		std::lock_guard<std::mutex> lock(outputMutex);
+		// (started once the lock is held, so waiting for other responses to be written isn't counted as write time)
+		MapToolsScopedPhase writePhase("write output");
+		std::cout.write(line.data(), static_cast<std::streamsize>(line.size()));
+		std::cout.flush();
+	};
+
+	MapToolsLog::startAsyncWriter();
+	MapToolsWorkerPool workerPool(resolveBatchJobCount(jobs));
+	auto memoryBudget = makeAutoMemoryBudget(jobs);
+	MapToolsMemoryBudget* pMemoryBudget = memoryBudget.get();
+	const size_t maxPendingRequests = ServeMaxPendingRequestsPerWorker * workerPool.numWorkers();
+	std::string line;
+	while (std::getline(std::cin, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+		auto request = nlohmann::ordered_json::parse(line, nullptr, false);
+		if (request.is_discarded() || !request.is_object())
+		{
+			nlohmann::ordered_json response = nlohmann::ordered_json::object();
+			response["id"] = nullptr;
+			response["status"] = "error";
+			response["error"] = "Invalid request (expected a single-line JSON object)";
+			writeResponse(response);
+			continue;
+		}
+		if (workerPool.numPending() >= maxPendingRequests)
+		{
+			auto idIt = request.find("id");
+			nlohmann::ordered_json response = nlohmann::ordered_json::object();
+			response["id"] = (idIt != request.end()) ? *idIt : nlohmann::ordered_json(nullptr);
+			response["status"] = "error";
+			response["error"] = "Too many pending requests (" + std::to_string(maxPendingRequests) + ") - retry later";
+			response["queue_full"] = true;
+			writeResponse(response);
+			continue;
+		}
+		workerPool.enqueue([request, defaultMapSeed, verbose, pSubprocessPool, mapTimeout, pMemoryBudget, &writeResponse]() {
+			auto inputIt = request.find("input");
+			MapToolsMemoryReservation memoryReservation(pMemoryBudget, (inputIt != request.end() && inputIt->is_string()) ? inputIt->get<std::string>() : std::string());
+			auto startTime = std::chrono::steady_clock::now();
+			nlohmann::ordered_json response = (pSubprocessPool) ? handleServeRequest_InSubprocess(request, *pSubprocessPool, mapTimeout) : handleServeRequest(request, defaultMapSeed, verbose);
+			if (MapToolsStats::isEnabled())
+			{
+				recordServeRequestStats(request, response, std::chrono::steady_clock::now() - startTime);
+			}
+			// (not held while waiting to write the response)
+			memoryReservation.release();
+			writeResponse(response);
+		});
+	}
+	workerPool.waitForAll();
+	MapToolsLog::stopAsyncWriter();
+}
+
+// Returns the option value that maps to value (for passing options on to a child process)
+template<typename T>
+static std::string optionValueName(const std::map<std::string, T>& valueMap, T value)
+{
+	for (const auto& it : valueMap)
+	{
+		if (it.second == value)
+		{
+			return it.first;
+		}
+	}
+	return std::string();
+}
+
+class WzMapToolsAppInstance : public CLI::App
+{
+protected:
+	explicit WzMapToolsAppInstance()
+		: CLI::App("WZ2100 Map Tools")
+	{ }
+public:
+	static std::shared_ptr<WzMapToolsAppInstance> makeWzMapToolsAppInstance()
+	{
+		class make_shared_enabler: public WzMapToolsAppInstance {};
+		auto app = std::make_shared<make_shared_enabler>();
+
+	#if defined(MAPTOOLS_CLI_VERSION_MAJOR) && defined(MAPTOOLS_CLI_VERSION_MINOR) && defined(MAPTOOLS_CLI_VERSION_REV)
+		app->set_version_flag("--version", []() -> std::string {
+			return generateMapToolsVersionInfo();
+		});
+	#else
 		#error Missing maptools version defines
 	#endif
 
-		// Initialize rand()
-		srand((unsigned int)time(NULL));
-		(void)rand();
-		app->mapSeed = rand();
+		// Initialize rand()
+		srand((unsigned int)time(NULL));
+		(void)rand();
+		app->mapSeed = rand();
+
+		std::stringstream footerInfo;
+		footerInfo << "License: GPL-2.0-or-later" << std::endl;
+		footerInfo << "Source: https://github.com/Warzone2100/maptools-cli" << std::endl;
+		app->footer(footerInfo.str());
+
+		app->add_flag("-v,--verbose", app->verbose, "Verbose output");
+		app->add_flag("--timings{table}", app->timingsFormat, "Output a per-phase timing breakdown to stderr (--timings=json for JSON)")
+			->check(CLI::IsMember({"table", "json"}))
+			->trigger_on_parse()
+			->each([](const std::string&) { MapToolsTimings::enable(); });
+		app->add_option("--log-format", app->logFormat, "Log output format")
+			->check(CLI::IsMember(logformat_map, CLI::ignore_case).description("value in {\n\t\ttext -> LEVEL: [function:line] message,\n\t\tjson -> one JSON object per line (tagged with the map being processed)\n\t}"))
+			->trigger_on_parse()
+			->each([](const std::string& value) { MapToolsLog::setFormat(logformat_map.at(CLI::detail::to_lower(value))); });
+		app->add_option("--trace", app->traceOutputPath, "Output Chrome / Perfetto trace events (JSON) to this file")
+			->trigger_on_parse()
+			->each([](const std::string&) { MapToolsTrace::enable(); });
+		app->add_flag("--stats", app->statsSummary, "Output a throughput + latency summary (per map and per phase, and the slowest inputs) to stderr")
+			->trigger_on_parse()
+			->each([](const std::string&) { MapToolsStats::enable(); });
+		app->add_option("--stats-json", app->statsOutputPath, "Output the throughput + latency summary (JSON) to this file")
+			->trigger_on_parse()
+			->each([](const std::string&) { MapToolsStats::enable(); });
+
+		WzMapToolsAppInstance::addSubCommand_Package(app);
+		WzMapToolsAppInstance::addSubCommand_Map(app);
+		WzMapToolsAppInstance::addSubCommand_Serve(app);
+
+		return app;
+	}
+	int getRetVal() const { return retVal; }
+	void outputTimings() const
+	{
+		if (timingsFormat.empty())
+		{
+			// (timings may also be enabled by --stats)
+			return;
+		}
+		if (timingsFormat == "json")
+		{
+			MapToolsTimings::printJSON(std::cerr);
+		}
+		else
+		{
+			MapToolsTimings::printTable(std::cerr);
+		}
+	}
+	void outputStats()
+	{
+		if (!MapToolsStats::isEnabled())
+		{
+			return;
+		}
+		if (statsSummary)
+		{
+			MapToolsStats::printSummary(std::cerr);
+		}
+		if (!statsOutputPath.empty() && !MapToolsStats::writeJSON(statsOutputPath))
+		{
+			retVal = 1;
+		}
+	}
+	void outputTrace()
+	{
+		if (!MapToolsTrace::isEnabled())
+		{
+			return;
+		}
+		if (!MapToolsTrace::writeTraceFile(traceOutputPath))
+		{
+			retVal = 1;
+			return;
+		}
+		if (verbose)
+		{
+			std::cerr << "Wrote trace to: " << traceOutputPath << std::endl;
+		}
+	}
+private:
+	static void addSubCommand_Package(const std::shared_ptr<WzMapToolsAppInstance>& app);
+	static void addSubCommand_Map(const std::shared_ptr<WzMapToolsAppInstance>& app);
+	static void addSubCommand_Serve(const std::shared_ptr<WzMapToolsAppInstance>& app);
+	static void addResultCacheOptions(CLI::App* subcommand, const std::shared_ptr<WzMapToolsAppInstance>& app);
+	static void addBatchInputOptions(CLI::App* subcommand, const std::shared_ptr<WzMapToolsAppInstance>& app);
+	static void addBatchRunOptions(CLI::App* subcommand, const std::shared_ptr<WzMapToolsAppInstance>& app);
+	static void addPreviewSizesOptions(CLI::App* subcommand, CLI::Option* scaleOption, const std::shared_ptr<WzMapToolsAppInstance>& app);
+	bool openResultCache();
+	void printResultCacheStats();
+	bool isBatchInvocation() const;
+	MapToolsBatchShard resolveBatchShard() const;
+	bool validatePackageInputOptions(bool outputRequired);
+	bool validatePreviewSizesOptions();
+	std::string batchOptionsHash(const char* operation) const;
+	std::vector<std::string> packageOutputPaths(const char* operation, const std::string& outputPath) const;
+	bool openBatchJournal(const char* operation, std::unique_ptr<MapToolsBatchJournal>& journal);
+	bool closeBatchJournal(std::unique_ptr<MapToolsBatchJournal>& journal, const BatchProcessingCounts& counts);
+	bool enableBatchProgress();
+	bool openSubprocessPool(unsigned numWorkers);
+	void closeSubprocessPool();
+	nlohmann::ordered_json makeSubprocessRequest(const char* op, const std::string& packageInputPath, const std::string& packageOutputPath) const;
+	optional<nlohmann::ordered_json> runInSubprocess(const char* op, const std::string& packageInputPath, const std::string& packageOutputPath, std::string& error) const;
+	void runPackageBatch(const char* operation, const char* outputExtension, const char* actionDescription, const std::function<bool (const std::string& inputPath, const std::string& outputPath)>& processInput);
+	void outputBatchMapInfo(const MapToolsBatchInputSources& sources, const std::string& outputNDJSONPath);
+	bool runPackageConvert(const std::string& inputPath, const std::string& outputPath) const;
+	bool runPackageGenPreview(const std::string& inputPath, const std::string& outputPath) const;
+	bool runPackageInfo(const std::string& inputPath, const std::string& outputPath) const;
+private:
+	int retVal = 0;
+	bool verbose = false;
+	std::string timingsFormat;
+	std::string traceOutputPath;
+	bool statsSummary = false;
+	std::string statsOutputPath;
+	std::string logFormat = "text";
+
+	std::string inputPath;
+	std::string outputPath;
+	uint32_t mapSeed;
+	WzMap::OutputFormat outputMapFormat = WzMap::LatestOutputFormat;
+
+	// package variables
+	WzMap::LevelFormat outputLevelFormat = WzMap::LevelFormat::JSON;
+	bool sub_convert_copyadditionalfiles = false;
+	bool sub_convert_fixed_last_mod = false;
+	bool sub_convert_uncompressed = false;
+	std::string override_map_name;
+
+	// process variables
+	std::string process_infoOutputPath;
+	std::string process_previewOutputPath;
+	std::string process_convertOutputPath;
+
+	// batch variables
+	std::vector<std::string> batchInputPaths;
+	std::string batchInputListPath;
+	bool batchRecursive = false;
+	std::string batchOutputDirectory;
+	unsigned batchJobs = 0;
+	std::string batchShardSpec;
+	std::string batchJournalPath;
+	bool batchResume = false;
+	bool mapSeedSpecified = false;
+	MapToolsBatchShard::Key batchShardKey = MapToolsBatchShard::Key::RelativePath;
+	bool batchUnordered = false;
+	uint32_t mapTimeoutMs = 0;
+	bool isolateInputs = false;
+	bool batchProgress = false;
+	int batchProgressFd = -1;
+	std::shared_ptr<MapToolsSubprocessPool> subprocessPool;
+
+	// result cache variables
+	std::string cacheDirectory;
+	uint64_t cacheMaxSizeMiB = 1024;
+	std::shared_ptr<MapToolsResultCache> resultCache;
+
+	MapToolsPreviewColorProvider preview_PlayerColorProvider = MapToolsPreviewColorProvider::Simple;
+	WzMap::MapPreviewColor preview_scavsColor = ScavsColorDefault;
+	WzMap::MapPreviewColorScheme::DrawOptions preview_drawOptions;
+	PngSaveOptions preview_pngOptions;
+	std::string preview_sizesList;
+	MapToolsPreviewSizes preview_sizes;
+
+	// map commands variables
+	WzMap::MapType mapType = WzMap::MapType::SKIRMISH;
+	uint32_t mapMaxPlayers = 0;
+};
 
-		std::stringstream footerInfo;
-		footerInfo << "License: GPL-2.0-or-later" << std::endl;
-		footerInfo << "Source: https://github.com/Warzone2100/maptools-cli" << std::endl;
-		app->footer(footerInfo.str());
+void WzMapToolsAppInstance::addResultCacheOptions(CLI::App* subcommand, const std::shared_ptr<WzMapToolsAppInstance>& app)
+{
+	subcommand->add_option("--cache-dir", app->cacheDirectory, "Cache outputs in (and reuse cached outputs from) this directory, keyed on the input package contents + options");
+	subcommand->add_option("--cache-max-size", app->cacheMaxSizeMiB, "Maximum size of the cache directory (in MiB) - least-recently-used outputs are evicted")
+		->default_val(1024);
+}
 
-		app->add_flag("-v,--verbose", app->verbose, "Verbose output");
+void WzMapToolsAppInstance::addPreviewSizesOptions(CLI::App* subcommand, CLI::Option* scaleOption, const std::shared_ptr<WzMapToolsAppInstance>& app)
+{
+	std::weak_ptr<WzMapToolsAppInstance> weakAppInstance = std::weak_ptr<WzMapToolsAppInstance>(app);
+	subcommand->add_option("--sizes", app->preview_sizesList, "Output several sizes of the preview (rendered once), alongside the output path\n\t\ta comma-separated list of any of:\n\t\tNx -> upscaled by N, N -> fitted within N x N pixels (ex. \"32,1x,2x,4x\")")
+		->check(PreviewSizesValidator())
+		->excludes(scaleOption)
+		->each([weakAppInstance](const std::string& value) {
+			if (auto app = weakAppInstance.lock())
+			{
+				std::string error;
+				parsePreviewSizes(value, app->preview_sizes.sizes, error);
+			}
+		});
+	subcommand->add_option("--sizes-template", app->preview_sizes.nameTemplate, "Output filename of each size (in the directory of the output path): {stem} -> the output filename (without extension), {size} -> the size ({stem} is required when processing multiple inputs)")
+		->check(PreviewSizeNameTemplateValidator())
+		->default_val(DefaultPreviewSizeNameTemplate);
+}
+
+// Opens the result cache (if --cache-dir was specified)
+bool WzMapToolsAppInstance::openResultCache()
+{
+	if (cacheDirectory.empty())
+	{
+		return true;
+	}
+	resultCache = std::make_shared<MapToolsResultCache>(cacheDirectory, cacheMaxSizeMiB * 1024 * 1024);
+	if (!resultCache->initialize())
+	{
+		resultCache.reset();
+		return false;
+	}
+	return true;
+}
+
+void WzMapToolsAppInstance::printResultCacheStats()
+{
+	if (verbose && resultCache)
+	{
+		resultCache->printStats(std::cerr);
+	}
+}
+
+void WzMapToolsAppInstance::addBatchInputOptions(CLI::App* subcommand, const std::shared_ptr<WzMapToolsAppInstance>& app)
+{
+	subcommand->add_flag("-r,--recursive", app->batchRecursive, "Search the input directory (recursively) for .wz packages, and process each of them");
+	subcommand->add_option("--from-list", app->batchInputListPath, "Process each of the newline / NUL-delimited input paths read from a file (or - for stdin)");
+	subcommand->add_option("--output-dir", app->batchOutputDirectory, "Output directory (when processing multiple inputs)");
+	subcommand->add_option("-j,--jobs", app->batchJobs, "Number of worker threads, when processing multiple inputs (0 or auto = one per available CPU, limited by the cgroup CPU quota + memory limit)")
+		->transform(CLI::Transformer(jobs_auto_map, CLI::ignore_case).description(""))
+		->type_name("UINT|auto")
+		->default_val(0);
+	addBatchRunOptions(subcommand, app);
+}
+
+// Options for runs over multiple inputs (sharding, journaling)
+void WzMapToolsAppInstance::addBatchRunOptions(CLI::App* subcommand, const std::shared_ptr<WzMapToolsAppInstance>& app)
+{
+	subcommand->add_option("--shard", app->batchShardSpec, "Only process the inputs in shard i of N (1 <= i <= N), assigned by a stable hash - so N invocations (ex. on different machines) process every input exactly once")
+		->type_name("i/N")
+		->check(BatchShardValidator());
+	subcommand->add_option("--shard-by", app->batchShardKey, "What inputs are assigned to shards by")
+		->transform(CLI::CheckedTransformer(shardkey_map, CLI::ignore_case).description("value in {\n\t\tpath -> the input's relative path,\n\t\tcontent -> the input's contents (so renamed / moved inputs stay in the same shard)\n\t}"))
+		->default_val("path");
+	subcommand->add_option("--journal", app->batchJournalPath, "Append a journal entry (input, input hash, options hash, status, output) to this file as each input is completed");
+	subcommand->add_flag("--resume", app->batchResume, "Skip the inputs that the --journal records as completed (with unchanged contents + options)");
+	subcommand->add_option("--map-timeout", app->mapTimeoutMs, "Give up on any input that takes longer than this (in milliseconds) - each input is then processed in a child process, which is killed on timeout")
+		->type_name("MS");
+	subcommand->add_flag("--isolate", app->isolateInputs, "Process each input in a pool of long-lived child processes (one per job), so an input that crashes maptools only takes down (and restarts) one child");
+	subcommand->add_flag("--progress", app->batchProgress, "Output a live progress line (counts, throughput, ETA) to stderr");
+	subcommand->add_option("--progress-fd", app->batchProgressFd, "Output progress as JSON lines to this (already open) file descriptor")
+		->type_name("FD")
+		->check(CLI::NonNegativeNumber);
+}
+
+// Whether a package subcommand was passed multiple inputs (a glob pattern, --recursive, or --from-list)
+bool WzMapToolsAppInstance::isBatchInvocation() const
+{
+	if (batchRecursive || !batchInputListPath.empty())
+	{
+		return true;
+	}
+	std::error_code ec;
+	return (inputPath.find_first_of("*?") != std::string::npos) && !std::filesystem::exists(inputPath, ec);
+}
+
+MapToolsBatchShard WzMapToolsAppInstance::resolveBatchShard() const
+{
+	MapToolsBatchShard shard;
+	if (!batchShardSpec.empty())
+	{
+		parseBatchShard(batchShardSpec, shard); // (already validated by BatchShardValidator)
+	}
+	shard.key = batchShardKey;
+	return shard;
+}
+
+bool WzMapToolsAppInstance::validatePackageInputOptions(bool outputRequired)
+{
+	if (inputPath.empty() && batchInputListPath.empty())
+	{
+		std::cerr << "ERROR: No input specified (pass --input and / or --from-list)" << std::endl;
+		retVal = 1;
+		return false;
+	}
+	if (isBatchInvocation())
+	{
+		if (!outputPath.empty())
+		{
+			std::cerr << "ERROR: --output cannot be used with multiple inputs (use --output-dir)" << std::endl;
+			retVal = 1;
+			return false;
+		}
+	}
+	else
+	{
+		if (!batchOutputDirectory.empty())
+		{
+			std::cerr << "ERROR: --output-dir is only used with multiple inputs (--recursive, --from-list, or a glob pattern)" << std::endl;
+			retVal = 1;
+			return false;
+		}
+		if (outputRequired && outputPath.empty())
+		{
+			std::cerr << "ERROR: --output is required" << std::endl;
+			retVal = 1;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool WzMapToolsAppInstance::validatePreviewSizesOptions()
+{
+	if (!preview_sizes.sizes.empty() && !isBatchInvocation() && isStdoutOutputPath(outputPath))
+	{
+		std::cerr << "ERROR: --sizes cannot be used with --output - (stdout)" << std::endl;
+		retVal = 1;
+		return false;
+	}
+	if (!preview_sizes.sizes.empty() && isBatchInvocation() && preview_sizes.nameTemplate.find("{stem}") == std::string::npos)
+	{
+		// (otherwise every input in a directory would write the same files)
+		std::cerr << "ERROR: --sizes-template must contain {stem} when processing multiple inputs: " << preview_sizes.nameTemplate << std::endl;
+		retVal = 1;
+		return false;
+	}
+	return true;
+}
+
+// Returns a hash of the operation + all of the options that affect its output (for the journal)
+std::string WzMapToolsAppInstance::batchOptionsHash(const char* operation) const
+{
+	std::stringstream options;
+	options << generateMapToolsVersionInfo() << "\n" << operation << "\n";
+	if (strcmp(operation, "convert") == 0)
+	{
+		optional<std::string> override_map_name_opt = nullopt;
+		if (!override_map_name.empty())
+		{
+			override_map_name_opt = override_map_name;
+		}
+		options << convertOptionsCacheString(outputLevelFormat, outputMapFormat, sub_convert_copyadditionalfiles, sub_convert_fixed_last_mod, override_map_name_opt);
+		options << ";uncompressed=" << sub_convert_uncompressed;
+	}
+	else if (strcmp(operation, "genpreview") == 0)
+	{
+		options << previewOptionsCacheString(preview_PlayerColorProvider, preview_scavsColor, preview_drawOptions, preview_pngOptions);
+		options << previewSizesCacheString(preview_sizes);
+		if (!preview_sizes.sizes.empty())
+		{
+			options << ";sizes-template=" << preview_sizes.nameTemplate;
+		}
+	}
+	if (mapSeedSpecified)
+	{
+		// (otherwise the map seed is random, so any seed a previous run used is as good as this one)
+		options << ";seed=" << mapSeed;
+	}
+	return sha256Hex(options.str());
+}
+
+// Returns the paths a package subcommand writes for outputPath (genpreview --sizes writes one file per size, instead of outputPath)
+std::vector<std::string> WzMapToolsAppInstance::packageOutputPaths(const char* operation, const std::string& outputPath) const
+{
+	if (strcmp(operation, "genpreview") != 0 || preview_sizes.sizes.empty())
+	{
+		return {outputPath};
+	}
+	std::vector<std::string> outputPaths;
+	for (const auto& size : preview_sizes.sizes)
+	{
+		outputPaths.push_back(makePreviewSizeOutputPath(outputPath, preview_sizes.nameTemplate, size));
+	}
+	return outputPaths;
+}
+
+// Opens the journal (if --journal was specified)
+bool WzMapToolsAppInstance::openBatchJournal(const char* operation, std::unique_ptr<MapToolsBatchJournal>& journal)
+{
+	if (batchJournalPath.empty())
+	{
+		if (batchResume)
+		{
+			std::cerr << "ERROR: --resume requires --journal" << std::endl;
+			retVal = 1;
+			return false;
+		}
+		return true;
+	}
+	journal = std::make_unique<MapToolsBatchJournal>(batchJournalPath, batchOptionsHash(operation));
+	if (!journal->open(batchResume))
+	{
+		journal.reset();
+		retVal = 1;
+		return false;
+	}
+	return true;
+}
+
+bool WzMapToolsAppInstance::closeBatchJournal(std::unique_ptr<MapToolsBatchJournal>& journal, const BatchProcessingCounts& counts)
+{
+	if (!journal)
+	{
+		return true;
+	}
+	if (counts.numSkipped > 0)
+	{
+		std::cerr << "Skipped " << counts.numSkipped << " map packages already completed (according to the journal)" << std::endl;
+	}
+	bool result = journal->close();
+	journal.reset();
+	if (!result)
+	{
+		retVal = 1;
+	}
+	return result;
+}
+
+// Enables progress reporting for a batch run (if --progress or --progress-fd was specified)
+bool WzMapToolsAppInstance::enableBatchProgress()
+{
+	if (!batchProgress && batchProgressFd < 0)
+	{
+		return true;
+	}
+	if (!MapToolsProgress::enable(batchProgress, batchProgressFd))
+	{
+		std::cerr << "ERROR: --progress-fd is not an open file descriptor: " << batchProgressFd << std::endl;
+		retVal = 1;
+		return false;
+	}
+	return true;
+}
+
+// Starts the child processes that inputs are processed in (if --isolate or --map-timeout was specified)
+bool WzMapToolsAppInstance::openSubprocessPool(unsigned numWorkers)
+{
+	if (!isolateInputs && mapTimeoutMs == 0)
+	{
+		return true;
+	}
+	if (!MapToolsSubprocess::isSupported())
+	{
+		std::cerr << "ERROR: --isolate / --map-timeout are not supported on this platform" << std::endl;
+		retVal = 1;
+		return false;
+	}
+	if (resultCache)
+	{
+		std::cerr << "ERROR: --cache-dir cannot be used with --isolate / --map-timeout" << std::endl;
+		retVal = 1;
+		return false;
+	}
+	// Each child is a "maptools serve" process, which handles one request at a time
+	std::vector<std::string> childArguments = {"--log-format", logFormat};
+	if (verbose)
+	{
+		childArguments.push_back("--verbose");
+	}
+	childArguments.insert(childArguments.end(), {"serve", "--jobs", "1", "--map-seed", std::to_string(mapSeed)});
+	subprocessPool = std::make_shared<MapToolsSubprocessPool>(childArguments, numWorkers);
+	if (!subprocessPool->prestart())
+	{
+		std::cerr << "ERROR: Failed to start child processes" << std::endl;
+		subprocessPool.reset();
+		retVal = 1;
+		return false;
+	}
+	return true;
+}
+
+// Stops the child processes, outputting any crashes (or timeouts)
+void WzMapToolsAppInstance::closeSubprocessPool()
+{
+	if (!subprocessPool)
+	{
+		return;
+	}
+	if (subprocessPool->numCrashes() > 0 || subprocessPool->numTimeouts() > 0)
+	{
+		subprocessPool->printCrashReport(std::cerr);
+	}
+	subprocessPool.reset();
+}
+
+// Builds a serve request for op, with the options of this invocation
+nlohmann::ordered_json WzMapToolsAppInstance::makeSubprocessRequest(const char* op, const std::string& packageInputPath, const std::string& packageOutputPath) const
+{
+	nlohmann::ordered_json request = nlohmann::ordered_json::object();
+	request["op"] = op;
+	request["input"] = packageInputPath;
+	request["map-seed"] = mapSeed;
+	if (strcmp(op, "convert") == 0)
+	{
+		request["output"] = packageOutputPath;
+		request["format"] = optionValueName(outputformat_map, outputMapFormat);
+		request["levelformat"] = optionValueName(levelformat_map, outputLevelFormat);
+		request["preserve-mods"] = sub_convert_copyadditionalfiles;
+		request["output-uncompressed"] = sub_convert_uncompressed;
+		request["fixed-lastmod"] = sub_convert_fixed_last_mod;
+		if (!override_map_name.empty())
+		{
+			request["set-name"] = override_map_name;
+		}
+	}
+	else if (strcmp(op, "genpreview") == 0)
+	{
+		if (!packageOutputPath.empty())
+		{
+			request["output"] = packageOutputPath;
+		}
+		request["playercolors"] = optionValueName(previewcolors_map, preview_PlayerColorProvider);
+		char scavsColorStr[10];
+		snprintf(scavsColorStr, sizeof(scavsColorStr), "#%02x%02x%02x%02x", preview_scavsColor.r, preview_scavsColor.g, preview_scavsColor.b, preview_scavsColor.a);
+		request["scavcolor"] = scavsColorStr;
+		std::vector<std::string> layers;
+		if (preview_drawOptions.drawTerrain) { layers.push_back("terrain"); }
+		if (preview_drawOptions.drawStructures) { layers.push_back("structures"); }
+		if (preview_drawOptions.drawOil) { layers.push_back("oil"); }
+		request["layers"] = CLI::detail::join(layers, ",");
+		request["png-profile"] = optionValueName(pngprofile_map, preview_pngOptions.compressionProfile);
+		request["png-palette"] = preview_pngOptions.indexedColor;
+		request["png-threads"] = preview_pngOptions.numThreads;
+		request["png-deflate"] = optionValueName(pngdeflate_map, preview_pngOptions.deflateBackend);
+		request["png-filter"] = optionValueName(pngfilter_map, preview_pngOptions.filterMode);
+		request["scale"] = preview_pngOptions.scale;
+		if (!preview_sizes.sizes.empty())
+		{
+			request["sizes"] = previewSizesToString(preview_sizes.sizes);
+			request["sizes-template"] = preview_sizes.nameTemplate;
+		}
+	}
+	return request;
+}
+
+// Processes an input in a child process (killed if it takes longer than --map-timeout), returning the result of the request
+optional<nlohmann::ordered_json> WzMapToolsAppInstance::runInSubprocess(const char* op, const std::string& packageInputPath, const std::string& packageOutputPath, std::string& error) const
+{
+	MapToolsScopedPhase requestPhase("child process");
+	std::string request = makeSubprocessRequest(op, packageInputPath, packageOutputPath).dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::replace);
+	std::string responseLine;
+	std::string exitReason;
+	switch (subprocessPool->request(packageInputPath, request, std::chrono::milliseconds(mapTimeoutMs), responseLine, &exitReason))
+	{
+		case MapToolsSubprocessWorker::Result::OK:
+			break;
+		case MapToolsSubprocessWorker::Result::TimedOut:
+			error = "Timed out (after " + std::to_string(mapTimeoutMs) + " ms)";
+			std::cerr << error << ": " << packageInputPath << std::endl;
+			return nullopt;
+		case MapToolsSubprocessWorker::Result::Exited:
+			error = "Child process crashed (" + exitReason + ")";
+			std::cerr << error << " while processing: " << packageInputPath << std::endl;
+			return nullopt;
+		case MapToolsSubprocessWorker::Result::StartFailed:
+			error = "Failed to start child process";
+			return nullopt;
+	}
+
+	auto response = nlohmann::ordered_json::parse(responseLine, nullptr, false);
+	if (response.is_discarded() || !response.is_object())
+	{
+		error = "Invalid response from child process";
+		std::cerr << error << " while processing: " << packageInputPath << std::endl;
+		return nullopt;
+	}
+	if (response.value("status", "") != "ok" || !response.contains("result"))
+	{
+		error = response.value("error", "Unknown error");
+		std::cerr << error << std::endl;
+		return nullopt;
+	}
+	return std::move(response["result"]);
+}
+
+// Runs a package subcommand over each of the batch inputs, outputting to (the same relative path in) the output directory
+void WzMapToolsAppInstance::runPackageBatch(const char* operation, const char* outputExtension, const char* actionDescription, const std::function<bool (const std::string& inputPath, const std::string& outputPath)>& processInput)
+{
+	if (batchOutputDirectory.empty())
+	{
+		std::cerr << "ERROR: --output-dir is required when processing multiple inputs" << std::endl;
+		retVal = 1;
+		return;
+	}
+	if (!enableBatchProgress())
+	{
+		return;
+	}
+	std::unique_ptr<MapToolsBatchJournal> journal;
+	if (!openBatchJournal(operation, journal))
+	{
+		return;
+	}
+
+	MapToolsBatchInputSources sources;
+	if (!inputPath.empty())
+	{
+		sources.inputs.push_back(inputPath);
+	}
+	sources.searchDirectories = batchRecursive;
+	sources.listPath = batchInputListPath;
+	sources.shard = resolveBatchShard();
+
+	BatchProcessingCounts counts;
+	bool replaceExistingOutputs = batchResume;
+	bool enumerated = processBatchInputs(sources, batchJobs, journal.get(), false, true, [this, operation, outputExtension, replaceExistingOutputs, &processInput](const MapToolsBatchInput& input, size_t, MapToolsMemoryReservation&, BatchJournalEntry& journalEntry) -> bool {
+		std::string inputOutputPath = makeBatchOutputPath(batchOutputDirectory, input, outputExtension);
+		journalEntry.outputPaths = packageOutputPaths(operation, inputOutputPath);
+		for (const auto& outputPath : journalEntry.outputPaths)
+		{
+			if (!prepareBatchOutputPath(outputPath, replaceExistingOutputs))
+			{
+				return false;
+			}
+		}
+		return processInput(input.path, inputOutputPath);
+	}, nullptr, counts);
+	printResultCacheStats();
+	closeBatchJournal(journal, counts);
+	closeSubprocessPool();
+
+	if (!enumerated)
+	{
+		retVal = 1;
+	}
+	if (counts.numInputs == 0)
+	{
+		std::cerr << "No input map packages found" << std::endl;
+	}
+	if (counts.numFailed > 0)
+	{
+		std::cerr << "Failed to " << actionDescription << " " << counts.numFailed << " of " << counts.numInputs << " map packages" << std::endl;
+		retVal = 1;
+	}
+}
+
+// Outputs the info for each of the batch inputs as NDJSON (to a file, or stdout)
+void WzMapToolsAppInstance::outputBatchMapInfo(const MapToolsBatchInputSources& sources, const std::string& outputNDJSONPath)
+{
+	if (!enableBatchProgress())
+	{
+		return;
+	}
+	std::unique_ptr<MapToolsBatchJournal> journal;
+	if (!openBatchJournal("batch-info", journal))
+	{
+		return;
+	}
+
+	std::ofstream outputFile;
+	std::ostream* pOutputStream = &(std::cout);
+	std::shared_ptr<MapToolDebugLogger> logger;
+	if (!outputNDJSONPath.empty())
+	{
+		// (when resuming, the results of the inputs that are skipped are already in the output file)
+		outputFile.open(outputNDJSONPath, std::ios::out | std::ios::binary | ((batchResume) ? std::ios::app : std::ios::trunc));
+		if (!outputFile.is_open())
+		{
+			std::cerr << "Failed to open output file: " << outputNDJSONPath << std::endl;
+			retVal = 1;
+			return;
+		}
+		pOutputStream = &outputFile;
+		logger = std::make_shared<MapToolDebugLogger>(verbose);
+	}
+
+	// (results that finish out of order wait in a reorder buffer of up to this many results, before workers are held up)
+	size_t maxPendingResults = std::max<size_t>(BatchOutputMinPendingResults, BatchOutputPendingResultsPerJob * resolveBatchJobCount(batchJobs));
+	MapToolsBatchOutputWriter::SyncFunction syncOutput;
+	if (journal && !outputNDJSONPath.empty())
+	{
+		syncOutput = [&outputNDJSONPath]() { return syncOutputToDisk(outputNDJSONPath); };
+	}
+	MapToolsBatchOutputWriter outputWriter(*pOutputStream, !batchUnordered, maxPendingResults, syncOutput);
+	uint32_t seed = mapSeed;
+	MapToolsResultCache* pCache = resultCache.get();
+	std::string journalOutputPath = (outputNDJSONPath.empty()) ? "-" : outputNDJSONPath;
+	BatchProcessingCounts counts;
+	bool enumerated = processBatchInputs(sources, batchJobs, journal.get(), !batchUnordered, false, [this, seed, logger, pCache, &outputWriter, &journalOutputPath](const MapToolsBatchInput& input, size_t inputIndex, MapToolsMemoryReservation& memoryReservation, BatchJournalEntry& journalEntry) -> bool {
+		nlohmann::ordered_json result;
+		if (subprocessPool)
+		{
+			result["input"] = input.path;
+			std::string error;
+			auto mapInfoJSON = runInSubprocess("info", input.path, std::string(), error);
+			if (mapInfoJSON.has_value())
+			{
+				result["info"] = std::move(mapInfoJSON.value());
+			}
+			else
+			{
+				result["error"] = error;
+			}
+		}
+		else
+		{
+			result = generateBatchMapInfoResult(input.path, seed, logger, pCache);
+		}
+		std::string line = result.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::ignore);
+		line.push_back('\n');
+		bool succeeded = !result.contains("error");
+		// (write() can block until the results before this one are written - which may be waiting for this memory)
+		memoryReservation.release();
+		MapToolsBatchOutputWriter::WrittenHandler onWritten;
+		if (journalEntry.pJournal)
+		{
+			// (journaled by the writer, once the line has been written out - so --resume never skips an input whose line was lost)
+			journalEntry.outputPaths = {journalOutputPath};
+			journalEntry.deferred = true;
+			onWritten = [journalEntry, succeeded]() { journalEntry.record(succeeded); };
+		}
+		outputWriter.write(inputIndex, std::move(line), std::move(onWritten));
+		return succeeded;
+	}, [&outputWriter](const MapToolsBatchInput&, size_t inputIndex) {
+		outputWriter.skip(inputIndex);
+	}, counts);
+	// (before the journal is closed - the writer records the inputs in it)
+	bool outputWritten = outputWriter.finish();
+	printResultCacheStats();
+	closeBatchJournal(journal, counts);
+	closeSubprocessPool();
+
+	if (!enumerated)
+	{
+		retVal = 1;
+	}
+	if (counts.numFailed > 0)
+	{
+		std::cerr << "Failed to extract info from " << counts.numFailed << " of " << counts.numInputs << " map packages" << std::endl;
+		retVal = 1;
+	}
+	if (!outputWritten || (!outputNDJSONPath.empty() && !outputFile.good()))
+	{
+		std::cerr << "Failed to output NDJSON to: " << ((outputNDJSONPath.empty()) ? "stdout" : outputNDJSONPath) << std::endl;
+		retVal = 1;
+		return;
+	}
+	if (!outputNDJSONPath.empty())
+	{
+		std::cout << "Wrote info for " << (counts.numInputs - counts.numSkipped) << " map packages to: " << outputNDJSONPath << std::endl;
+	}
+}
 
-		WzMapToolsAppInstance::addSubCommand_Package(app);
-		WzMapToolsAppInstance::addSubCommand_Map(app);
+bool WzMapToolsAppInstance::runPackageConvert(const std::string& packageInputPath, const std::string& packageOutputPath) const
+{
+	if (subprocessPool)
+	{
+		std::string error;
+		auto result = runInSubprocess("convert", packageInputPath, packageOutputPath, error);
+		if (!result.has_value())
+		{
+			return false;
+		}
+		std::cout << "Converted map package:" << std::endl
+				<< "\t - from format [" << result->value("mapFormat", "unknown") << "] -> [" << outputMapFormat << "]" << std::endl;
+		std::cout << "\t - with: " << outputLevelFormat << std::endl;
+		std::cout << "\t - saved to: " << packageOutputPath << std::endl;
+		return true;
+	}
+	optional<std::string> override_map_name_opt = nullopt;
+	if (!override_map_name.empty())
+	{
+		override_map_name_opt = override_map_name;
+	}
+	if (resultCache && !sub_convert_uncompressed)
+	{
+		return convertMapPackage_Cached(*resultCache, packageInputPath, packageOutputPath, outputLevelFormat, outputMapFormat, mapSeed, sub_convert_copyadditionalfiles, verbose, sub_convert_fixed_last_mod, override_map_name_opt);
+	}
+	if (inputPathIsFile(packageInputPath))
+	{
+#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
+		return convertMapPackage_FromArchive(packageInputPath, packageOutputPath, outputLevelFormat, outputMapFormat, mapSeed, sub_convert_copyadditionalfiles, verbose, sub_convert_uncompressed, sub_convert_fixed_last_mod, override_map_name_opt);
+#else
+		std::cerr << "ERROR: maptools was compiled without support for .wz archives, and cannot open: " << packageInputPath << std::endl;
+		return false;
+#endif
+	}
+	return convertMapPackage(packageInputPath, packageOutputPath, outputLevelFormat, outputMapFormat, mapSeed, sub_convert_copyadditionalfiles, verbose, sub_convert_uncompressed, sub_convert_fixed_last_mod, override_map_name_opt);
+}
 
-		return app;
+bool WzMapToolsAppInstance::runPackageGenPreview(const std::string& packageInputPath, const std::string& outputPNGPath) const
+{
+	if (subprocessPool)
+	{
+		// (when outputting to stdout, the child returns the PNG inline)
+		bool outputToStdout = isStdoutOutputPath(outputPNGPath);
+		std::string error;
+		auto result = runInSubprocess("genpreview", packageInputPath, (outputToStdout) ? std::string() : outputPNGPath, error);
+		if (!result.has_value())
+		{
+			return false;
+		}
+		if (outputToStdout)
+		{
+			std::vector<uint8_t> pngData;
+			if (!base64Decode(result->value("png", ""), pngData) || !writeBinaryToStdout(pngData))
+			{
+				std::cerr << "Failed to write preview PNG to stdout" << std::endl;
+				return false;
+			}
+			return true;
+		}
+		if (result->contains("outputs"))
+		{
+			std::cout << "Generated map previews:" << std::endl;
+			for (const auto& output : (*result)["outputs"])
+			{
+				std::cout << "\t - saved to: " << output.value("output", "") << std::endl;
+			}
+			return true;
+		}
+		std::cout << "Generated map preview:\n"
+				<< "\t - saved to: " << outputPNGPath << std::endl;
+		return true;
 	}
-	int getRetVal() const { return retVal; }
-private:
-	static void addSubCommand_Package(const std::shared_ptr<WzMapToolsAppInstance>& app);
-	static void addSubCommand_Map(const std::shared_ptr<WzMapToolsAppInstance>& app);
-private:
-	int retVal = 0;
-	bool verbose = false;
+	if (resultCache)
+	{
+		return generateMapPreviewPNG_Cached(*resultCache, packageInputPath, outputPNGPath, preview_PlayerColorProvider, preview_scavsColor, preview_drawOptions, preview_pngOptions, preview_sizes, mapSeed, verbose);
+	}
+	if (inputPathIsFile(packageInputPath))
+	{
+#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
+		return generateMapPreviewPNG_FromArchive(packageInputPath, outputPNGPath, preview_PlayerColorProvider, preview_scavsColor, preview_drawOptions, preview_pngOptions, preview_sizes, mapSeed, verbose);
+#else
+		std::cerr << "ERROR: maptools was compiled without support for .wz archives, and cannot open: " << packageInputPath << std::endl;
+		return false;
+#endif
+	}
+	return generateMapPreviewPNG_FromPackageContents(packageInputPath, outputPNGPath, preview_PlayerColorProvider, preview_scavsColor, preview_drawOptions, preview_pngOptions, preview_sizes, mapSeed, verbose);
+}
 
-	std::string inputPath;
-	std::string outputPath;
-	uint32_t mapSeed;
-	WzMap::OutputFormat outputMapFormat = WzMap::LatestOutputFormat;
+// Outputs the info JSON to a file (or stdout, if outputJSONPath is empty)
+bool WzMapToolsAppInstance::runPackageInfo(const std::string& packageInputPath, const std::string& outputJSONPath) const
+{
+	optional<nlohmann::ordered_json> mapInfoJSON;
+	std::shared_ptr<MapToolDebugLogger> logger;
+	if (!outputJSONPath.empty())
+	{
+		logger = std::make_shared<MapToolDebugLogger>(verbose);
+	}
+	if (subprocessPool)
+	{
+		std::string error;
+		mapInfoJSON = runInSubprocess("info", packageInputPath, std::string(), error);
+	}
+	else if (resultCache)
+	{
+		mapInfoJSON = generateMapInfoJSON_Cached(*resultCache, packageInputPath, mapSeed, logger);
+	}
+	else if (inputPathIsFile(packageInputPath))
+	{
+#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
+		mapInfoJSON = generateMapInfoJSON_FromArchive(packageInputPath, mapSeed, logger);
+#else
+		std::cerr << "ERROR: maptools was compiled without support for .wz archives, and cannot open: " << packageInputPath << std::endl;
+		return false;
+#endif
+	}
+	else
+	{
+		mapInfoJSON = generateMapInfoJSON_FromPackageContents(packageInputPath, mapSeed, logger);
+	}
 
-	// package variables
-	WzMap::LevelFormat outputLevelFormat = WzMap::LevelFormat::JSON;
-	bool sub_convert_copyadditionalfiles = false;
-	bool sub_convert_fixed_last_mod = false;
-	bool sub_convert_uncompressed = false;
-	std::string override_map_name;
+	if (!mapInfoJSON.has_value())
+	{
+		return false;
+	}
 
-	MapToolsPreviewColorProvider preview_PlayerColorProvider = MapToolsPreviewColorProvider::Simple;
-	WzMap::MapPreviewColor preview_scavsColor = ScavsColorDefault;
-	WzMap::MapPreviewColorScheme::DrawOptions preview_drawOptions;
+	std::string jsonStr = mapInfoJSON.value().dump(4, ' ', false, nlohmann::ordered_json::error_handler_t::ignore);
 
-	// map commands variables
-	WzMap::MapType mapType = WzMap::MapType::SKIRMISH;
-	uint32_t mapMaxPlayers = 0;
-};
+	MapToolsScopedPhase writePhase("write output");
+	if (!outputJSONPath.empty())
+	{
+		WzMap::StdIOProvider stdOutput;
+		if (!stdOutput.writeFullFile(outputJSONPath, jsonStr.c_str(), static_cast<uint32_t>(jsonStr.size())))
+		{
+			std::cerr << "Failed to output JSON to: " << outputJSONPath << std::endl;
+			return false;
+		}
+		std::cout << "Wrote output JSON to: " << outputJSONPath << std::endl;
+	}
+	else
+	{
+		std::cout << jsonStr << std::endl;
+	}
+	return true;
+}
 
 void WzMapToolsAppInstance::addSubCommand_Package(const std::shared_ptr<WzMapToolsAppInstance>& app)
 {
@@ -984,14 +3307,6 @@ void WzMapToolsAppInstance::addSubCommand_Package(const std::shared_ptr<WzMapToo
 	inputOptionDescription = "Input map package (extracted package folder)";
 #endif
 
-	auto inputPathIsFile = [](const std::string& path) -> bool {
-		if (path.empty())
-		{
-			return false;
-		}
-		return CLI::ExistingFile(path).empty();
-	};
-
 	// [CONVERTING MAP PACKAGE]
 	CLI::App* sub_convert = sub_package->add_subcommand("convert", "Convert a map from one format to another");
 	sub_convert->fallthrough();
@@ -1002,58 +3317,59 @@ void WzMapToolsAppInstance::addSubCommand_Package(const std::shared_ptr<WzMapToo
 		->required()
 		->transform(CLI::CheckedTransformer(outputformat_map, CLI::ignore_case).description("value in {\n\t\tbjo -> Binary .BJO (flaME-compatible / old),\n\t\tjson -> JSONv1 (WZ 3.4+),\n\t\tjsonv2 -> JSONv2 (WZ 4.1+),\n\t\tlatest -> " + CLI::detail::to_string(WzMap::LatestOutputFormat) + "}"));
 	sub_convert->add_option("-i,--input,input", app->inputPath, inputOptionDescription)
-		->required()
-		->check(CLI::ExistingPath);
+		->check(CLI::ExistingPath | GlobPatternValidator());
 	sub_convert->add_option("-o,--output,output", app->outputPath, "Output path")
-		->required()
 		->check(CLI::NonexistentPath);
 	sub_convert->add_flag("--preserve-mods", app->sub_convert_copyadditionalfiles, "Copy other files from the original map package (i.e. the extra files / modifications in a map-mod)");
 	sub_convert->add_flag("--fixed-lastmod", app->sub_convert_fixed_last_mod, "Fixed last modification date (if outputting to a .wz archive)");
 	sub_convert->add_flag("--output-uncompressed", app->sub_convert_uncompressed, "Output uncompressed to a folder (not in a .wz file)");
 	sub_convert->add_option("--set-name", app->override_map_name, "Set / override the map name when converting");
-	sub_convert->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed");
-	sub_convert->callback([weakAppInstance, inputPathIsFile]() {
+	sub_convert->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed")
+		->each([weakAppInstance](const std::string&) { if (auto app = weakAppInstance.lock()) { app->mapSeedSpecified = true; } });
+	addBatchInputOptions(sub_convert, app);
+	addResultCacheOptions(sub_convert, app);
+	sub_convert->callback([weakAppInstance]() {
 		auto app = weakAppInstance.lock();
 		if (!app)
 		{
 			std::cerr << "ERROR: Invalid instance" << std::endl;
 			return;
 		}
-		optional<std::string> override_map_name_opt = nullopt;
-		if (!app->override_map_name.empty())
+		if (!app->validatePackageInputOptions(true))
 		{
-			override_map_name_opt = app->override_map_name;
+			return;
 		}
-		if (inputPathIsFile(app->inputPath))
+		if (!app->openResultCache())
 		{
-#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
-			if (!convertMapPackage_FromArchive(app->inputPath, app->outputPath, app->outputLevelFormat, app->outputMapFormat, app->mapSeed, app->sub_convert_copyadditionalfiles, app->verbose, app->sub_convert_uncompressed, app->sub_convert_fixed_last_mod, override_map_name_opt))
-			{
-				app->retVal = 1;
-			}
-#else
-			std::cerr << "ERROR: maptools was compiled without support for .wz archives, and cannot open: " << app->inputPath << std::endl;
-			retVal = 1;
-#endif
+			app->retVal = 1;
+			return;
 		}
-		else
+		if (!app->openSubprocessPool((app->isBatchInvocation()) ? resolveBatchJobCount(app->batchJobs) : 1))
 		{
-			if (!convertMapPackage(app->inputPath, app->outputPath, app->outputLevelFormat, app->outputMapFormat, app->mapSeed, app->sub_convert_copyadditionalfiles, app->verbose, app->sub_convert_uncompressed, app->sub_convert_fixed_last_mod, override_map_name_opt))
-			{
-				app->retVal = 1;
-			}
+			return;
+		}
+		if (app->isBatchInvocation())
+		{
+			app->runPackageBatch("convert", (app->sub_convert_uncompressed) ? "" : ".wz", "convert", [&app](const std::string& inputPath, const std::string& outputPath) {
+				return app->runPackageConvert(inputPath, outputPath);
+			});
+			return;
 		}
+		MapToolsLogMapContext logContext(app->inputPath);
+		if (!app->runPackageConvert(app->inputPath, app->outputPath))
+		{
+			app->retVal = 1;
+		}
+		app->printResultCacheStats();
 	});
 
 	// [GENERATING MAP PREVIEW PNG]
 	CLI::App* sub_preview = sub_package->add_subcommand("genpreview", "Generate a map preview PNG");
 	sub_preview->fallthrough();
 	sub_preview->add_option("-i,--input,input", app->inputPath, inputOptionDescription)
-		->required()
-		->check(CLI::ExistingPath);
-	sub_preview->add_option("-o,--output,output", app->outputPath, "Output PNG filename (+ path)")
-		->required()
-		->check(FileExtensionValidator(".png"));
+		->check(CLI::ExistingPath | GlobPatternValidator());
+	sub_preview->add_option("-o,--output,output", app->outputPath, "Output PNG filename (+ path), or - for stdout")
+		->check(FileExtensionValidator(".png", true));
 	sub_preview->add_option("-c,--playercolors", app->preview_PlayerColorProvider, "Player colors")
 		->transform(CLI::CheckedTransformer(previewcolors_map, CLI::ignore_case).description("value in {\n\t\tsimple -> use one color for scavs, one color for players,\n\t\twz -> use WZ colors for players (distinct)\n\t}"))
 		->default_val("simple");
@@ -1061,94 +3377,286 @@ void WzMapToolsAppInstance::addSubCommand_Package(const std::shared_ptr<WzMapToo
 		->check(AsHexColorValue());
 	sub_preview->add_option("--layers", app->preview_drawOptions, "Specify layers to draw\n\t\teither \"all\" or a comma-separated list of any of:\n\t\t\"terrain\",\"structures\",\"oil\"")
 		->default_val("all");
-	sub_preview->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed");
-	sub_preview->callback([weakAppInstance, inputPathIsFile]() {
+	CLI::Option* scaleOption = sub_preview->add_option("--scale", app->preview_pngOptions.scale, "Upscale the preview by this factor (ex. 4 -> 4x4 pixels per map tile)")
+		->check(CLI::Range(1u, MaxPreviewScale))
+		->default_val(1);
+	addPreviewSizesOptions(sub_preview, scaleOption, app);
+	sub_preview->add_option("--png-profile", app->preview_pngOptions.compressionProfile, "PNG encoder speed / size profile")
+		->transform(CLI::CheckedTransformer(pngprofile_map, CLI::ignore_case).description(pngprofile_description))
+		->default_val("max");
+	sub_preview->add_flag("--png-palette", app->preview_pngOptions.indexedColor, "Output an indexed-palette PNG (if the preview has <= 256 colors, otherwise RGB)");
+	sub_preview->add_option("--png-threads", app->preview_pngOptions.numThreads, "Compress large PNGs in parallel strips, on up to this many threads (auto = one per available CPU)")
+		->transform(resolvePngThreadsValue)
+		->check(CLI::Range(1u, MaxPngThreads))
+		->type_name("UINT|auto")
+		->default_val(1);
+	sub_preview->add_option("--png-deflate", app->preview_pngOptions.deflateBackend, "PNG compression library")
+		->transform(CLI::CheckedTransformer(pngdeflate_map, CLI::ignore_case).description(pngdeflate_description))
+		->default_val("zlib");
+	sub_preview->add_option("--png-filter", app->preview_pngOptions.filterMode, "PNG row filter")
+		->transform(CLI::CheckedTransformer(pngfilter_map, CLI::ignore_case).description(pngfilter_description))
+		->default_val("auto");
+	sub_preview->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed")
+		->each([weakAppInstance](const std::string&) { if (auto app = weakAppInstance.lock()) { app->mapSeedSpecified = true; } });
+	addBatchInputOptions(sub_preview, app);
+	addResultCacheOptions(sub_preview, app);
+	sub_preview->callback([weakAppInstance]() {
 		auto app = weakAppInstance.lock();
 		if (!app)
 		{
 			std::cerr << "ERROR: Invalid instance" << std::endl;
 			return;
 		}
-		if (inputPathIsFile(app->inputPath))
+		if (!app->validatePackageInputOptions(true) || !app->validatePreviewSizesOptions())
+		{
+			return;
+		}
+		if (!app->openResultCache())
 		{
-#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
-			if (!generateMapPreviewPNG_FromArchive(app->inputPath, app->outputPath, app->preview_PlayerColorProvider, app->preview_scavsColor, app->preview_drawOptions, app->mapSeed, app->verbose))
-			{
-				app->retVal = 1;
-			}
-#else
-			std::cerr << "ERROR: maptools was compiled without support for .wz archives, and cannot open: " << app->inputPath << std::endl;
 			app->retVal = 1;
-#endif
+			return;
 		}
-		else
+		if (!app->openSubprocessPool((app->isBatchInvocation()) ? resolveBatchJobCount(app->batchJobs) : 1))
 		{
-			if (!generateMapPreviewPNG_FromPackageContents(app->inputPath, app->outputPath, app->preview_PlayerColorProvider, app->preview_scavsColor, app->preview_drawOptions, app->mapSeed, app->verbose))
-			{
-				app->retVal = 1;
-			}
+			return;
 		}
+		if (app->isBatchInvocation())
+		{
+			app->runPackageBatch("genpreview", ".png", "generate a preview for", [&app](const std::string& inputPath, const std::string& outputPath) {
+				return app->runPackageGenPreview(inputPath, outputPath);
+			});
+			return;
+		}
+		MapToolsLogMapContext logContext(app->inputPath);
+		if (!app->runPackageGenPreview(app->inputPath, app->outputPath))
+		{
+			app->retVal = 1;
+		}
+		app->printResultCacheStats();
 	});
 
 	// [EXTRACTING INFORMATION FROM A MAP PACKAGE]
 	CLI::App* sub_info = sub_package->add_subcommand("info", "Extract info / stats from a map package");
 	sub_info->fallthrough();
 	sub_info->add_option("-i,--input,input", app->inputPath, inputOptionDescription)
-		->required()
-		->check(CLI::ExistingPath);
+		->check(CLI::ExistingPath | GlobPatternValidator());
 	sub_info->add_option("-o,--output", app->outputPath, "Output filename (+ path)")
 		->check(FileExtensionValidator(".json"));
-	sub_info->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed");
-	sub_info->callback([weakAppInstance, inputPathIsFile]() {
+	sub_info->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed")
+		->each([weakAppInstance](const std::string&) { if (auto app = weakAppInstance.lock()) { app->mapSeedSpecified = true; } });
+	addBatchInputOptions(sub_info, app);
+	sub_info->add_flag("--unordered", app->batchUnordered, "When outputting NDJSON for multiple inputs, output each result as soon as it is ready (instead of in input order)");
+	addResultCacheOptions(sub_info, app);
+	sub_info->callback([weakAppInstance]() {
 		auto app = weakAppInstance.lock();
 		if (!app)
 		{
 			std::cerr << "ERROR: Invalid instance" << std::endl;
 			return;
 		}
-		optional<nlohmann::ordered_json> mapInfoJSON;
-		std::shared_ptr<MapToolDebugLogger> logger;
-		if (!app->outputPath.empty())
+		if (!app->validatePackageInputOptions(false))
 		{
-			logger = std::make_shared<MapToolDebugLogger>(new MapToolDebugLogger(app->verbose));
+			return;
 		}
-		if (inputPathIsFile(app->inputPath))
+		if (!app->openResultCache())
 		{
-#if !defined(WZ_MAPTOOLS_DISABLE_ARCHIVE_SUPPORT)
-			mapInfoJSON = generateMapInfoJSON_FromArchive(app->inputPath, app->mapSeed, logger);
-#else
-			std::cerr << "ERROR: maptools was compiled without support for .wz archives, and cannot open: " << app->inputPath << std::endl;
 			app->retVal = 1;
-#endif
+			return;
 		}
-		else
+		if (!app->openSubprocessPool((app->isBatchInvocation()) ? resolveBatchJobCount(app->batchJobs) : 1))
+		{
+			return;
+		}
+		if (app->isBatchInvocation())
+		{
+			if (app->batchOutputDirectory.empty())
+			{
+				// output NDJSON to stdout (as batch-info)
+				MapToolsBatchInputSources sources;
+				if (!app->inputPath.empty())
+				{
+					sources.inputs.push_back(app->inputPath);
+				}
+				sources.searchDirectories = app->batchRecursive;
+				sources.listPath = app->batchInputListPath;
+				sources.shard = app->resolveBatchShard();
+				app->outputBatchMapInfo(sources, std::string());
+				return;
+			}
+			app->runPackageBatch("info", ".json", "extract info from", [&app](const std::string& inputPath, const std::string& outputPath) {
+				return app->runPackageInfo(inputPath, outputPath);
+			});
+			return;
+		}
+		MapToolsLogMapContext logContext(app->inputPath);
+		if (!app->runPackageInfo(app->inputPath, app->outputPath))
 		{
-			mapInfoJSON = generateMapInfoJSON_FromPackageContents(app->inputPath, app->mapSeed, logger);
+			app->retVal = 1;
 		}
+		app->printResultCacheStats();
+	});
 
-		if (!mapInfoJSON.has_value())
+	// [PROCESSING A MAP PACKAGE (INFO + PREVIEW + CONVERT) WITH A SINGLE LOAD]
+	CLI::App* sub_process = sub_package->add_subcommand("process", "Extract info, generate a preview PNG, and / or convert a map package (loading it only once)");
+	sub_process->fallthrough();
+	sub_process->add_option("-i,--input,input", app->inputPath, inputOptionDescription)
+		->required()
+		->check(CLI::ExistingPath);
+	sub_process->add_option("--info", app->process_infoOutputPath, "Output info JSON filename (+ path)")
+		->check(FileExtensionValidator(".json"));
+	sub_process->add_option("--preview", app->process_previewOutputPath, "Output preview PNG filename (+ path)")
+		->check(FileExtensionValidator(".png"));
+	sub_process->add_option("--convert", app->process_convertOutputPath, "Output converted map package path")
+		->check(CLI::NonexistentPath);
+	sub_process->add_option("-c,--playercolors", app->preview_PlayerColorProvider, "Player colors (for --preview)")
+		->transform(CLI::CheckedTransformer(previewcolors_map, CLI::ignore_case).description("value in {\n\t\tsimple -> use one color for scavs, one color for players,\n\t\twz -> use WZ colors for players (distinct)\n\t}"))
+		->default_val("simple");
+	sub_process->add_option("--scavcolor", app->preview_scavsColor, "Specify the scavengers hex color (for --preview)")
+		->check(AsHexColorValue());
+	sub_process->add_option("--layers", app->preview_drawOptions, "Specify layers to draw (for --preview)\n\t\teither \"all\" or a comma-separated list of any of:\n\t\t\"terrain\",\"structures\",\"oil\"")
+		->default_val("all");
+	sub_process->add_option("--png-profile", app->preview_pngOptions.compressionProfile, "PNG encoder speed / size profile (for --preview)")
+		->transform(CLI::CheckedTransformer(pngprofile_map, CLI::ignore_case).description(pngprofile_description))
+		->default_val("max");
+	sub_process->add_flag("--png-palette", app->preview_pngOptions.indexedColor, "Output an indexed-palette PNG (for --preview, if the preview has <= 256 colors, otherwise RGB)");
+	sub_process->add_option("--png-threads", app->preview_pngOptions.numThreads, "Compress large PNGs in parallel strips, on up to this many threads (for --preview, auto = one per available CPU)")
+		->transform(resolvePngThreadsValue)
+		->check(CLI::Range(1u, MaxPngThreads))
+		->type_name("UINT|auto")
+		->default_val(1);
+	sub_process->add_option("--png-deflate", app->preview_pngOptions.deflateBackend, "PNG compression library (for --preview)")
+		->transform(CLI::CheckedTransformer(pngdeflate_map, CLI::ignore_case).description(pngdeflate_description))
+		->default_val("zlib");
+	sub_process->add_option("--png-filter", app->preview_pngOptions.filterMode, "PNG row filter (for --preview)")
+		->transform(CLI::CheckedTransformer(pngfilter_map, CLI::ignore_case).description(pngfilter_description))
+		->default_val("auto");
+	sub_process->add_option("-l,--levelformat", app->outputLevelFormat, "Output level info format (for --convert)")
+		->transform(CLI::CheckedTransformer(levelformat_map, CLI::ignore_case).description("value in {\n\t\tlev -> LEV (flaME-compatible / old),\n\t\tjson -> JSON level file (WZ 4.3+),\n\t\tlatest -> " + CLI::detail::to_string(WzMap::LatestLevelFormat) + "}"))
+		->default_val("latest");
+	sub_process->add_option("-f,--format", app->outputMapFormat, "Output map format (for --convert)")
+		->transform(CLI::CheckedTransformer(outputformat_map, CLI::ignore_case).description("value in {\n\t\tbjo -> Binary .BJO (flaME-compatible / old),\n\t\tjson -> JSONv1 (WZ 3.4+),\n\t\tjsonv2 -> JSONv2 (WZ 4.1+),\n\t\tlatest -> " + CLI::detail::to_string(WzMap::LatestOutputFormat) + "}"))
+		->default_val("latest");
+	sub_process->add_flag("--preserve-mods", app->sub_convert_copyadditionalfiles, "Copy other files from the original map package (for --convert)");
+	sub_process->add_flag("--fixed-lastmod", app->sub_convert_fixed_last_mod, "Fixed last modification date (for --convert, if outputting to a .wz archive)");
+	sub_process->add_flag("--output-uncompressed", app->sub_convert_uncompressed, "Output uncompressed to a folder (for --convert)");
+	sub_process->add_option("--set-name", app->override_map_name, "Set / override the map name (for --convert)");
+	sub_process->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed");
+	sub_process->callback([weakAppInstance]() {
+		auto app = weakAppInstance.lock();
+		if (!app)
 		{
+			std::cerr << "ERROR: Invalid instance" << std::endl;
+			return;
+		}
+		MapToolsLogMapContext logContext(app->inputPath);
+		if (app->process_infoOutputPath.empty() && app->process_previewOutputPath.empty() && app->process_convertOutputPath.empty())
+		{
+			std::cerr << "ERROR: Nothing to do (pass at least one of --info, --preview, --convert)" << std::endl;
 			app->retVal = 1;
 			return;
 		}
 
-		std::string jsonStr = mapInfoJSON.value().dump(4, ' ', false, nlohmann::ordered_json::error_handler_t::ignore);
+		auto logger = std::make_shared<MapToolDebugLogger>(app->verbose);
+		auto loadedPackage = loadMapPackageFromInputPath(app->inputPath, app->mapSeed, logger);
+		if (!loadedPackage)
+		{
+			app->retVal = 1;
+			return;
+		}
 
-		if (!app->outputPath.empty())
+		// Info and preview are generated before converting, as --set-name modifies the loaded level details
+		if (!app->process_infoOutputPath.empty())
 		{
-			WzMap::StdIOProvider stdOutput;
-			if (!stdOutput.writeFullFile(app->outputPath, jsonStr.c_str(), static_cast<uint32_t>(jsonStr.size())))
+			auto mapInfoJSON = generateMapInfoJSON_FromLoadedPackage(*loadedPackage, logger);
+			if (!mapInfoJSON.has_value())
 			{
-				std::cerr << "Failed to output JSON to: " << app->outputPath << std::endl;
 				app->retVal = 1;
-				return;
 			}
-			std::cout << "Wrote output JSON to: " << app->outputPath << std::endl;
+			else
+			{
+				std::string jsonStr = mapInfoJSON.value().dump(4, ' ', false, nlohmann::ordered_json::error_handler_t::ignore);
+				MapToolsScopedPhase writePhase("write output");
+				WzMap::StdIOProvider stdOutput;
+				if (!stdOutput.writeFullFile(app->process_infoOutputPath, jsonStr.c_str(), static_cast<uint32_t>(jsonStr.size())))
+				{
+					std::cerr << "Failed to output JSON to: " << app->process_infoOutputPath << std::endl;
+					app->retVal = 1;
+				}
+				else
+				{
+					std::cout << "Wrote output JSON to: " << app->process_infoOutputPath << std::endl;
+				}
+			}
 		}
-		else
+
+		if (!app->process_previewOutputPath.empty())
+		{
+			if (!generateMapPreviewPNG_FromMapObject(*(loadedPackage->map.get()), app->process_previewOutputPath, app->preview_PlayerColorProvider, app->preview_scavsColor, app->preview_drawOptions, app->preview_pngOptions, app->preview_sizes, loadedPackage->package->levelDetails()))
+			{
+				app->retVal = 1;
+			}
+		}
+
+		if (!app->process_convertOutputPath.empty())
+		{
+			optional<std::string> override_map_name_opt = nullopt;
+			if (!app->override_map_name.empty())
+			{
+				override_map_name_opt = app->override_map_name;
+			}
+			if (!exportLoadedMapPackage(*loadedPackage, app->process_convertOutputPath, app->outputLevelFormat, app->outputMapFormat, app->sub_convert_copyadditionalfiles, app->sub_convert_uncompressed, app->sub_convert_fixed_last_mod, override_map_name_opt, logger))
+			{
+				app->retVal = 1;
+			}
+			else
+			{
+				printConvertedMapPackageSummary(*loadedPackage, app->process_convertOutputPath, app->outputLevelFormat, app->outputMapFormat);
+			}
+		}
+	});
+
+	// [EXTRACTING INFORMATION FROM MANY MAP PACKAGES]
+	CLI::App* sub_batchinfo = sub_package->add_subcommand("batch-info", "Extract info / stats from many map packages (one NDJSON line per map)");
+	sub_batchinfo->fallthrough();
+	sub_batchinfo->add_option("-i,--input,input", app->batchInputPaths, "Input map packages, directories (searched for .wz packages), or glob patterns");
+	sub_batchinfo->add_option("--from-list", app->batchInputListPath, "Read newline / NUL-delimited input paths from a file (or - for stdin)");
+	sub_batchinfo->add_option("-o,--output", app->outputPath, "Output NDJSON filename (+ path)");
+	sub_batchinfo->add_option("-j,--jobs", app->batchJobs, "Number of worker threads (0 or auto = one per available CPU, limited by the cgroup CPU quota + memory limit)")
+		->transform(CLI::Transformer(jobs_auto_map, CLI::ignore_case).description(""))
+		->type_name("UINT|auto")
+		->default_val(0);
+	sub_batchinfo->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed")
+		->each([weakAppInstance](const std::string&) { if (auto app = weakAppInstance.lock()) { app->mapSeedSpecified = true; } });
+	sub_batchinfo->add_flag("--unordered", app->batchUnordered, "Output each result as soon as it is ready (instead of in input order)");
+	addBatchRunOptions(sub_batchinfo, app);
+	addResultCacheOptions(sub_batchinfo, app);
+	sub_batchinfo->callback([weakAppInstance]() {
+		auto app = weakAppInstance.lock();
+		if (!app)
 		{
-			std::cout << jsonStr << std::endl;
+			std::cerr << "ERROR: Invalid instance" << std::endl;
+			return;
+		}
+		if (app->batchInputPaths.empty() && app->batchInputListPath.empty())
+		{
+			std::cerr << "ERROR: No inputs specified (pass --input and / or --from-list)" << std::endl;
+			app->retVal = 1;
+			return;
+		}
+		if (!app->openResultCache())
+		{
+			app->retVal = 1;
+			return;
+		}
+		if (!app->openSubprocessPool(resolveBatchJobCount(app->batchJobs)))
+		{
+			return;
 		}
+		MapToolsBatchInputSources sources;
+		sources.inputs = app->batchInputPaths;
+		sources.listPath = app->batchInputListPath;
+		sources.shard = app->resolveBatchShard();
+		app->outputBatchMapInfo(sources, app->outputPath);
 	});
 }
 
@@ -1185,6 +3693,7 @@ void WzMapToolsAppInstance::addSubCommand_Map(const std::shared_ptr<WzMapToolsAp
 			std::cerr << "ERROR: Invalid instance" << std::endl;
 			return;
 		}
+		MapToolsLogMapContext logContext(app->inputPath);
 		if (!convertMap(app->mapType, app->mapMaxPlayers, app->inputPath, app->outputPath, app->outputMapFormat, app->mapSeed, app->verbose))
 		{
 			app->retVal = 1;
@@ -1203,9 +3712,9 @@ void WzMapToolsAppInstance::addSubCommand_Map(const std::shared_ptr<WzMapToolsAp
 	sub_preview->add_option("-i,--input,inputmapdir", app->inputPath, "Input map directory")
 		->required()
 		->check(CLI::ExistingDirectory);
-	sub_preview->add_option("-o,--output,output", app->outputPath, "Output PNG filename (+ path)")
+	sub_preview->add_option("-o,--output,output", app->outputPath, "Output PNG filename (+ path), or - for stdout")
 		->required()
-		->check(FileExtensionValidator(".png"));
+		->check(FileExtensionValidator(".png", true));
 	sub_preview->add_option("-c,--playercolors", app->preview_PlayerColorProvider, "Player colors")
 		->transform(CLI::CheckedTransformer(previewcolors_map, CLI::ignore_case).description("value in {\n\t\tsimple -> use one color for scavs, one color for players,\n\t\twz -> use WZ colors for players (distinct)\n\t}"))
 		->default_val("simple");
@@ -1213,6 +3722,25 @@ void WzMapToolsAppInstance::addSubCommand_Map(const std::shared_ptr<WzMapToolsAp
 		->check(AsHexColorValue());
 	sub_preview->add_option("--layers", app->preview_drawOptions, "Specify layers to draw\n\t\teither \"all\" or a comma-separated list of any of:\n\t\t\"terrain\",\"structures\",\"oil\"")
 		->default_val("all");
+	CLI::Option* scaleOption = sub_preview->add_option("--scale", app->preview_pngOptions.scale, "Upscale the preview by this factor (ex. 4 -> 4x4 pixels per map tile)")
+		->check(CLI::Range(1u, MaxPreviewScale))
+		->default_val(1);
+	addPreviewSizesOptions(sub_preview, scaleOption, app);
+	sub_preview->add_option("--png-profile", app->preview_pngOptions.compressionProfile, "PNG encoder speed / size profile")
+		->transform(CLI::CheckedTransformer(pngprofile_map, CLI::ignore_case).description(pngprofile_description))
+		->default_val("max");
+	sub_preview->add_flag("--png-palette", app->preview_pngOptions.indexedColor, "Output an indexed-palette PNG (if the preview has <= 256 colors, otherwise RGB)");
+	sub_preview->add_option("--png-threads", app->preview_pngOptions.numThreads, "Compress large PNGs in parallel strips, on up to this many threads (auto = one per available CPU)")
+		->transform(resolvePngThreadsValue)
+		->check(CLI::Range(1u, MaxPngThreads))
+		->type_name("UINT|auto")
+		->default_val(1);
+	sub_preview->add_option("--png-deflate", app->preview_pngOptions.deflateBackend, "PNG compression library")
+		->transform(CLI::CheckedTransformer(pngdeflate_map, CLI::ignore_case).description(pngdeflate_description))
+		->default_val("zlib");
+	sub_preview->add_option("--png-filter", app->preview_pngOptions.filterMode, "PNG row filter")
+		->transform(CLI::CheckedTransformer(pngfilter_map, CLI::ignore_case).description(pngfilter_description))
+		->default_val("auto");
 	sub_preview->add_option("--map-seed", app->mapSeed, "Specify the script-generated map seed");
 	sub_preview->callback([weakAppInstance]() {
 		auto app = weakAppInstance.lock();
@@ -1221,16 +3749,55 @@ void WzMapToolsAppInstance::addSubCommand_Map(const std::shared_ptr<WzMapToolsAp
 			std::cerr << "ERROR: Invalid instance" << std::endl;
 			return;
 		}
-		if (!generateMapPreviewPNG_FromMapDirectory(app->mapType, app->mapMaxPlayers, app->inputPath, app->outputPath, app->preview_PlayerColorProvider, app->preview_scavsColor, app->preview_drawOptions, app->mapSeed, app->verbose))
+		if (!app->validatePreviewSizesOptions())
+		{
+			return;
+		}
+		MapToolsLogMapContext logContext(app->inputPath);
+		if (!generateMapPreviewPNG_FromMapDirectory(app->mapType, app->mapMaxPlayers, app->inputPath, app->outputPath, app->preview_PlayerColorProvider, app->preview_scavsColor, app->preview_drawOptions, app->preview_pngOptions, app->preview_sizes, app->mapSeed, app->verbose))
 		{
 			app->retVal = 1;
 		}
 	});
 }
 
+void WzMapToolsAppInstance::addSubCommand_Serve(const std::shared_ptr<WzMapToolsAppInstance>& app)
+{
+	std::weak_ptr<WzMapToolsAppInstance> weakAppInstance = std::weak_ptr<WzMapToolsAppInstance>(app);
+
+	CLI::App* sub_serve = app->add_subcommand("serve", "Long-lived mode: process NDJSON requests from stdin, output NDJSON responses to stdout");
+	sub_serve->fallthrough();
+	sub_serve->add_option("-j,--jobs", app->batchJobs, "Number of worker threads (0 or auto = one per available CPU, limited by the cgroup CPU quota + memory limit)")
+		->transform(CLI::Transformer(jobs_auto_map, CLI::ignore_case).description(""))
+		->type_name("UINT|auto")
+		->default_val(0);
+	sub_serve->add_option("--map-seed", app->mapSeed, "Specify the default script-generated map seed");
+	sub_serve->add_option("--map-timeout", app->mapTimeoutMs, "Give up on any request that takes longer than this (in milliseconds) - each request is then processed in a child process, which is killed on timeout")
+		->type_name("MS");
+	sub_serve->add_flag("--isolate", app->isolateInputs, "Process each request in a pool of long-lived child processes (one per job), so a request that crashes maptools only takes down (and restarts) one child");
+	sub_serve->callback([weakAppInstance]() {
+		auto app = weakAppInstance.lock();
+		if (!app)
+		{
+			std::cerr << "ERROR: Invalid instance" << std::endl;
+			return;
+		}
+		if (!app->openSubprocessPool(resolveBatchJobCount(app->batchJobs)))
+		{
+			return;
+		}
+		runServeMode(app->batchJobs, app->mapSeed, app->verbose, app->subprocessPool.get(), std::chrono::milliseconds(app->mapTimeoutMs));
+		app->closeSubprocessPool();
+	});
+}
+
 int main(int argc, char **argv)
 {
+	MapToolsSubprocess::setExecutablePath(argv[0]);
 	std::shared_ptr<WzMapToolsAppInstance> app = WzMapToolsAppInstance::makeWzMapToolsAppInstance();
 	CLI11_PARSE((*app), argc, argv);
+	app->outputTimings();
+	app->outputStats();
+	app->outputTrace();
 	return app->getRetVal();
 }
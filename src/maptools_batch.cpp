@@ -0,0 +1,631 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_batch.h"
+#include "maptools_trace.h"
+#include "maptools_cache.h"
+#include "maptools_resources.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <memory>
+#include <atomic>
+
+namespace fs = std::filesystem;
+
+static bool pathHasWildcards(const std::string& path)
+{
+	return path.find_first_of("*?") != std::string::npos;
+}
+
+static bool isMapArchiveFilename(const std::string& filename)
+{
+	if (filename.size() < 3)
+	{
+		return false;
+	}
+	std::string extension = filename.substr(filename.size() - 3);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return extension == ".wz";
+}
+
+// Matches a '/'-separated path against a pattern
+// ('*' and '?' never match '/', while '**' matches across directories)
+static bool wildcardMatch(const char* pattern, const char* str)
+{
+	while (*pattern)
+	{
+		if (pattern[0] == '*' && pattern[1] == '*')
+		{
+			pattern += 2;
+			if (*pattern == '/' && wildcardMatch(pattern + 1, str))
+			{
+				// "**/" also matches zero directories
+				return true;
+			}
+			for (const char* s = str; ; ++s)
+			{
+				if (wildcardMatch(pattern, s)) { return true; }
+				if (*s == '\0') { break; }
+			}
+			return false;
+		}
+		if (*pattern == '*')
+		{
+			++pattern;
+			for (const char* s = str; ; ++s)
+			{
+				if (wildcardMatch(pattern, s)) { return true; }
+				if (*s == '\0' || *s == '/') { break; }
+			}
+			return false;
+		}
+		if (*str == '\0')
+		{
+			return false;
+		}
+		if (*pattern == '?')
+		{
+			if (*str == '/') { return false; }
+		}
+		else if (*pattern != *str)
+		{
+			return false;
+		}
+		++pattern;
+		++str;
+	}
+	return *str == '\0';
+}
+
+namespace {
+
+struct DirectoryWalkRoot
+{
+	fs::path basePath;
+	// prefix for the paths of found inputs (the base directory, as specified)
+	std::string pathPrefix;
+	// pattern to match (relative to basePath) - if empty, matches any .wz file
+	std::string pattern;
+	// maximum directory depth to descend to (-1 for unlimited)
+	int maxDepth = -1;
+};
+
+// The matching files + subdirectories of a directory, sorted by name (when walking in order)
+struct DirectoryListing
+{
+	struct Entry
+	{
+		std::string name;
+		MapToolsBatchInput input;
+		// (set if the entry is a subdirectory)
+		std::shared_ptr<DirectoryListing> subdirectory;
+	};
+	std::vector<Entry> entries;
+	bool listed = false;
+};
+
+struct DirectoryWalkItem
+{
+	std::shared_ptr<const DirectoryWalkRoot> root;
+	fs::path directory;
+	int depth;
+	// (null, unless walking in order)
+	std::shared_ptr<DirectoryListing> listing;
+};
+
+// Walks directories with multiple threads, passing on matching files as they are found
+// If inOrder, directories are still listed by multiple threads, but the files are only passed on by emitInOrder (in a fixed order)
+class ConcurrentDirectoryWalker
+{
+public:
+	ConcurrentDirectoryWalker(const MapToolsBatchInputHandler& onInputFound, bool inOrder)
+	: onInputFound(onInputFound)
+	, inOrder(inOrder)
+	{ }
+	~ConcurrentDirectoryWalker()
+	{
+		wait();
+	}
+
+	// Returns the root's listing, to pass to emitInOrder (if inOrder - otherwise null)
+	std::shared_ptr<DirectoryListing> addRoot(DirectoryWalkRoot root)
+	{
+		auto sharedRoot = std::make_shared<const DirectoryWalkRoot>(std::move(root));
+		auto listing = (inOrder) ? std::make_shared<DirectoryListing>() : nullptr;
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		pending.push_back(DirectoryWalkItem{sharedRoot, sharedRoot->basePath, 0, listing});
+		return listing;
+	}
+
+	// Passes on the files under a listing - each directory's entries in name order, descending into each subdirectory
+	// at its place in that order - blocking until the walker threads have listed each directory
+	void emitInOrder(const std::shared_ptr<DirectoryListing>& listing)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pendingMutex);
+			listingCompleted.wait(lock, [&listing]() { return listing->listed; });
+		}
+		for (auto& entry : listing->entries)
+		{
+			if (entry.subdirectory)
+			{
+				emitInOrder(entry.subdirectory);
+			}
+			else
+			{
+				onInputFound(std::move(entry.input));
+			}
+		}
+		// (the listing is no longer needed)
+		listing->entries.clear();
+		listing->entries.shrink_to_fit();
+	}
+
+	void start(unsigned numThreads)
+	{
+		size_t numRoots = 0;
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			numRoots = pending.size();
+		}
+		if (numRoots == 0)
+		{
+			return;
+		}
+		numThreads = std::max(numThreads, 1u);
+		for (unsigned i = 0; i < numThreads; ++i)
+		{
+			threads.emplace_back(&ConcurrentDirectoryWalker::walkerMain, this, i);
+		}
+	}
+
+	// Blocks until the walk has finished - returns false if any directory could not be enumerated
+	bool wait()
+	{
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		threads.clear();
+		return !failed;
+	}
+
+private:
+	void walkerMain(unsigned walkerIndex)
+	{
+		MapToolsTrace::setThreadName("input walker " + std::to_string(walkerIndex));
+		while (true)
+		{
+			DirectoryWalkItem item;
+			{
+				std::unique_lock<std::mutex> lock(pendingMutex);
+				pendingChanged.wait(lock, [this]() { return !pending.empty() || numWalking == 0; });
+				if (pending.empty())
+				{
+					// nothing pending, and no other thread is walking (which could add more) - done
+					pendingChanged.notify_all();
+					return;
+				}
+				item = std::move(pending.front());
+				pending.pop_front();
+				++numWalking;
+			}
+
+			std::vector<DirectoryWalkItem> subdirectories;
+			walkDirectory(item, subdirectories);
+
+			{
+				std::lock_guard<std::mutex> lock(pendingMutex);
+				for (auto& subdirectory : subdirectories)
+				{
+					pending.push_back(std::move(subdirectory));
+				}
+				--numWalking;
+			}
+			pendingChanged.notify_all();
+		}
+	}
+
+	void walkDirectory(const DirectoryWalkItem& item, std::vector<DirectoryWalkItem>& subdirectories)
+	{
+		const DirectoryWalkRoot& root = *item.root;
+		std::vector<DirectoryListing::Entry> entries;
+		std::error_code ec;
+		for (auto it = fs::directory_iterator(item.directory, fs::directory_options::skip_permission_denied, ec); !ec && it != fs::directory_iterator(); it.increment(ec))
+		{
+			std::error_code entryEc;
+			if (it->is_directory(entryEc) && !it->is_symlink(entryEc))
+			{
+				if (root.maxDepth < 0 || item.depth < root.maxDepth)
+				{
+					auto listing = (inOrder) ? std::make_shared<DirectoryListing>() : nullptr;
+					subdirectories.push_back(DirectoryWalkItem{item.root, it->path(), item.depth + 1, listing});
+					if (inOrder)
+					{
+						entries.push_back(DirectoryListing::Entry{it->path().filename().generic_string(), MapToolsBatchInput(), listing});
+					}
+				}
+				continue;
+			}
+			if (!it->is_regular_file(entryEc))
+			{
+				continue;
+			}
+			std::string relativePath = it->path().lexically_relative(root.basePath).generic_string();
+			bool matches = (root.pattern.empty()) ? isMapArchiveFilename(it->path().filename().string()) : wildcardMatch(root.pattern.c_str(), relativePath.c_str());
+			if (!matches)
+			{
+				continue;
+			}
+			MapToolsBatchInput input;
+			input.path = root.pathPrefix + relativePath;
+			input.relativePath = relativePath;
+			input.size = it->file_size(entryEc);
+			if (inOrder)
+			{
+				entries.push_back(DirectoryListing::Entry{it->path().filename().generic_string(), std::move(input), nullptr});
+				continue;
+			}
+			onInputFound(std::move(input));
+		}
+		if (ec)
+		{
+			std::cerr << "Failed to enumerate directory: " << item.directory.string() << " (" << ec.message() << ")" << std::endl;
+			failed = true;
+		}
+		if (inOrder)
+		{
+			// (directory_iterator's order is unspecified - ex. it differs between filesystems)
+			std::sort(entries.begin(), entries.end(), [](const DirectoryListing::Entry& a, const DirectoryListing::Entry& b) { return a.name < b.name; });
+			{
+				std::lock_guard<std::mutex> lock(pendingMutex);
+				item.listing->entries = std::move(entries);
+				item.listing->listed = true;
+			}
+			listingCompleted.notify_all();
+		}
+	}
+
+private:
+	const MapToolsBatchInputHandler& onInputFound;
+	bool inOrder = false;
+	std::vector<std::thread> threads;
+	std::mutex pendingMutex;
+	std::condition_variable pendingChanged;
+	std::condition_variable listingCompleted;
+	std::deque<DirectoryWalkItem> pending;
+	size_t numWalking = 0;
+	std::atomic<bool> failed{false};
+};
+
+} // anonymous namespace
+
+static DirectoryWalkRoot makeDirectoryWalkRoot(const std::string& directory)
+{
+	DirectoryWalkRoot root;
+	root.basePath = fs::path(directory);
+	root.pathPrefix = directory;
+	if (!root.pathPrefix.empty() && root.pathPrefix.back() != '/' && root.pathPrefix.back() != static_cast<char>(fs::path::preferred_separator))
+	{
+		root.pathPrefix.push_back('/');
+	}
+	return root;
+}
+
+static DirectoryWalkRoot makeGlobWalkRoot(const std::string& pattern)
+{
+	std::string genericPattern = fs::path(pattern).generic_string();
+
+	// Split into the leading wildcard-free directory and the remaining pattern
+	DirectoryWalkRoot root;
+	root.pattern = genericPattern;
+	size_t firstWildcard = genericPattern.find_first_of("*?");
+	size_t lastSeparator = genericPattern.rfind('/', firstWildcard);
+	if (lastSeparator != std::string::npos)
+	{
+		root.pathPrefix = genericPattern.substr(0, lastSeparator + 1);
+		root.pattern = genericPattern.substr(lastSeparator + 1);
+	}
+	root.basePath = (root.pathPrefix.empty()) ? fs::path(".") : fs::path(root.pathPrefix);
+	if (root.pattern.find("**") == std::string::npos)
+	{
+		root.maxDepth = static_cast<int>(std::count(root.pattern.begin(), root.pattern.end(), '/'));
+	}
+	return root;
+}
+
+static MapToolsBatchInput makeExplicitBatchInput(const std::string& path)
+{
+	MapToolsBatchInput input;
+	input.path = path;
+	fs::path normalizedPath = fs::path(path).lexically_normal();
+	if (!normalizedPath.has_filename())
+	{
+		// ex. a trailing separator on a folder path
+		normalizedPath = normalizedPath.parent_path();
+	}
+	// keep relative paths (that stay within the current directory) as-is, otherwise just use the filename
+	bool staysWithinCurrentDirectory = normalizedPath.is_relative() && !normalizedPath.empty() && *normalizedPath.begin() != "..";
+	input.relativePath = (staysWithinCurrentDirectory) ? normalizedPath.generic_string() : normalizedPath.filename().string();
+	std::error_code ec;
+	if (fs::is_regular_file(normalizedPath, ec))
+	{
+		input.size = fs::file_size(normalizedPath, ec);
+	}
+	return input;
+}
+
+// Reads newline / NUL delimited paths, passing each one on as soon as it has been read
+static bool readListedPaths(std::istream& input, const MapToolsBatchInputHandler& onInputFound)
+{
+	std::string line;
+	auto flushLine = [&]() {
+		if (!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+		if (!line.empty())
+		{
+			onInputFound(makeExplicitBatchInput(line));
+		}
+		line.clear();
+	};
+	for (std::istreambuf_iterator<char> it(input), end; it != end; ++it)
+	{
+		char c = *it;
+		if (c == '\n' || c == '\0')
+		{
+			flushLine();
+		}
+		else
+		{
+			line.push_back(c);
+		}
+	}
+	flushLine();
+	return !input.bad();
+}
+
+bool parseBatchShard(const std::string& spec, MapToolsBatchShard& shard)
+{
+	size_t separator = spec.find('/');
+	if (separator == std::string::npos || separator == 0 || separator + 1 >= spec.size())
+	{
+		return false;
+	}
+	std::string indexStr = spec.substr(0, separator);
+	std::string countStr = spec.substr(separator + 1);
+	auto isNumber = [](const std::string& str) {
+		return str.size() <= 9 && std::all_of(str.begin(), str.end(), [](unsigned char c) { return std::isdigit(c) != 0; });
+	};
+	if (!isNumber(indexStr) || !isNumber(countStr))
+	{
+		return false;
+	}
+	unsigned long index = std::stoul(indexStr);
+	unsigned long count = std::stoul(countStr);
+	if (count == 0 || index == 0 || index > count)
+	{
+		return false;
+	}
+	shard.index = static_cast<uint32_t>(index - 1);
+	shard.count = static_cast<uint32_t>(count);
+	return true;
+}
+
+static uint32_t shardForHash(const std::string& hexHash, uint32_t shardCount)
+{
+	// (the first 64 bits of a SHA-256 hash, so assignment is the same on every platform)
+	uint64_t value = std::stoull(hexHash.substr(0, 16), nullptr, 16);
+	return static_cast<uint32_t>(value % shardCount);
+}
+
+bool batchInputIsInShard(const MapToolsBatchShard& shard, const MapToolsBatchInput& input)
+{
+	if (shard.count <= 1)
+	{
+		return true;
+	}
+	std::string hash;
+	if (shard.key == MapToolsBatchShard::Key::ContentHash && hashMapPackageContents(input.path, hash))
+	{
+		return shardForHash(hash, shard.count) == shard.index;
+	}
+	// (inputs that can't be read are assigned by path, so their failure is still reported by exactly one shard)
+	return shardForHash(sha256Hex(input.relativePath), shard.count) == shard.index;
+}
+
+bool enumerateBatchInputs(const MapToolsBatchInputSources& sources, unsigned numWalkerThreads, bool inOrder, const MapToolsBatchInputHandler& onInputFound)
+{
+	bool result = true;
+	ConcurrentDirectoryWalker walker(onInputFound, inOrder);
+	std::vector<std::string> explicitPaths;
+	// (if inOrder - each input, in the order specified: either an explicit path, or the listing of a directory / glob root)
+	std::vector<std::pair<std::string, std::shared_ptr<DirectoryListing>>> orderedInputs;
+	for (const auto& input : sources.inputs)
+	{
+		std::error_code ec;
+		if (sources.searchDirectories && fs::is_directory(input, ec))
+		{
+			orderedInputs.emplace_back(std::string(), walker.addRoot(makeDirectoryWalkRoot(input)));
+		}
+		else if (fs::exists(input, ec))
+		{
+			explicitPaths.push_back(input);
+			orderedInputs.emplace_back(input, nullptr);
+		}
+		else if (pathHasWildcards(input))
+		{
+			orderedInputs.emplace_back(std::string(), walker.addRoot(makeGlobWalkRoot(input)));
+		}
+		else
+		{
+			std::cerr << "Input path does not exist: " << input << std::endl;
+			result = false;
+		}
+	}
+	walker.start(numWalkerThreads);
+
+	if (inOrder)
+	{
+		for (const auto& orderedInput : orderedInputs)
+		{
+			if (orderedInput.second)
+			{
+				walker.emitInOrder(orderedInput.second);
+			}
+			else
+			{
+				onInputFound(makeExplicitBatchInput(orderedInput.first));
+			}
+		}
+	}
+	else
+	{
+		for (const auto& path : explicitPaths)
+		{
+			onInputFound(makeExplicitBatchInput(path));
+		}
+	}
+
+	if (!sources.listPath.empty())
+	{
+		bool listResult = false;
+		if (sources.listPath == "-")
+		{
+			listResult = readListedPaths(std::cin, onInputFound);
+		}
+		else
+		{
+			std::ifstream listFile(sources.listPath, std::ios::binary);
+			if (!listFile.is_open())
+			{
+				std::cerr << "Failed to open input list: " << sources.listPath << std::endl;
+			}
+			else
+			{
+				listResult = readListedPaths(listFile, onInputFound);
+				if (!listResult)
+				{
+					std::cerr << "Failed to read input list: " << sources.listPath << std::endl;
+				}
+			}
+		}
+		result = result && listResult;
+	}
+
+	if (!walker.wait())
+	{
+		result = false;
+	}
+	return result;
+}
+
+unsigned resolveBatchJobCount(unsigned requestedJobs)
+{
+	if (requestedJobs > 0)
+	{
+		return requestedJobs;
+	}
+	return MapToolsResources::availableCPUs();
+}
+
+MapToolsWorkerPool::MapToolsWorkerPool(unsigned numWorkers)
+{
+	numWorkers = std::max(numWorkers, 1u);
+	workers.reserve(numWorkers);
+	for (unsigned i = 0; i < numWorkers; ++i)
+	{
+		workers.emplace_back(&MapToolsWorkerPool::workerMain, this, i);
+	}
+}
+
+MapToolsWorkerPool::~MapToolsWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(tasksMutex);
+		stopping = true;
+	}
+	tasksAvailable.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void MapToolsWorkerPool::enqueue(std::function<void ()> task, uint64_t priority)
+{
+	{
+		std::lock_guard<std::mutex> lock(tasksMutex);
+		// (equal keys are inserted after any existing ones, so tasks of equal priority stay in order)
+		tasks.emplace(priority, std::move(task));
+	}
+	tasksAvailable.notify_one();
+}
+
+void MapToolsWorkerPool::waitForAll()
+{
+	std::unique_lock<std::mutex> lock(tasksMutex);
+	tasksFinished.wait(lock, [this]() { return tasks.empty() && tasksInProgress == 0; });
+}
+
+size_t MapToolsWorkerPool::numPending()
+{
+	std::lock_guard<std::mutex> lock(tasksMutex);
+	return tasks.size() + tasksInProgress;
+}
+
+void MapToolsWorkerPool::workerMain(unsigned workerIndex)
+{
+	MapToolsTrace::setThreadName("worker " + std::to_string(workerIndex));
+	while (true)
+	{
+		std::function<void ()> task;
+		{
+			std::unique_lock<std::mutex> lock(tasksMutex);
+			tasksAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (tasks.empty())
+			{
+				// stopping, and nothing left to do
+				return;
+			}
+			auto nextTask = tasks.begin();
+			task = std::move(nextTask->second);
+			tasks.erase(nextTask);
+			++tasksInProgress;
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(tasksMutex);
+			--tasksInProgress;
+			if (tasks.empty() && tasksInProgress == 0)
+			{
+				tasksFinished.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,120 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <cstdint>
+
+struct MapToolsBatchShard
+{
+	enum class Key
+	{
+		RelativePath,
+		ContentHash
+	};
+	// 0-based (--shard is specified as 1-based "i/N")
+	uint32_t index = 0;
+	uint32_t count = 1;
+	Key key = Key::RelativePath;
+};
+
+struct MapToolsBatchInputSources
+{
+	// map packages, directories, or glob patterns (ex. "maps/**/*.wz")
+	std::vector<std::string> inputs;
+	// whether directory inputs are searched (recursively) for .wz packages, or used as-is (as extracted packages)
+	bool searchDirectories = true;
+	// newline (or NUL) delimited list of paths ("-" for stdin)
+	std::string listPath;
+	// only the inputs in this shard are processed
+	MapToolsBatchShard shard;
+};
+
+struct MapToolsBatchInput
+{
+	std::string path;
+	// the path relative to the directory (or glob base directory) it was found in - used to name batch outputs
+	std::string relativePath;
+	// the file size (0 for extracted package folders)
+	uint64_t size = 0;
+};
+
+typedef std::function<void (MapToolsBatchInput&& input)> MapToolsBatchInputHandler;
+
+// Parses a shard specification of the form "i/N" (where 1 <= i <= N)
+bool parseBatchShard(const std::string& spec, MapToolsBatchShard& shard);
+
+// Whether an input is in the shard - assigned by a stable hash of its relative path, or its contents
+// (for Key::ContentHash, this reads the input - so it should be called from a worker thread)
+bool batchInputIsInShard(const MapToolsBatchShard& shard, const MapToolsBatchInput& input);
+
+/*
+ * Enumerates the batch inputs, calling onInputFound for each map package as soon as it is found:
+ * - directories (and glob base directories) are walked concurrently, by up to numWalkerThreads threads
+ * - listed paths are read (streamed) on the calling thread, while the directory walk is in progress
+ * - any other path is used as-is
+ * onInputFound may be called from multiple threads at once. Blocks until enumeration has finished.
+ * If inOrder, the inputs are instead passed on (from the calling thread) in the same order on every run: the inputs in the
+ * order specified - each directory's files sorted by name, with subdirectories walked depth-first - then the listed paths.
+ * (The directories are still listed concurrently.)
+ * Returns false if any of the inputs could not be enumerated (the inputs that could be are still passed on).
+ */
+bool enumerateBatchInputs(const MapToolsBatchInputSources& sources, unsigned numWalkerThreads, bool inOrder, const MapToolsBatchInputHandler& onInputFound);
+
+// Returns the number of workers to use for a requested job count (0 = auto: one per available CPU, see MapToolsResources::availableCPUs)
+unsigned resolveBatchJobCount(unsigned requestedJobs);
+
+class MapToolsWorkerPool
+{
+public:
+	explicit MapToolsWorkerPool(unsigned numWorkers);
+	~MapToolsWorkerPool();
+
+	MapToolsWorkerPool(const MapToolsWorkerPool&) = delete;
+	MapToolsWorkerPool& operator=(const MapToolsWorkerPool&) = delete;
+
+public:
+	// Tasks with a higher priority are started first (tasks of equal priority are started in the order they were enqueued)
+	void enqueue(std::function<void ()> task, uint64_t priority = 0);
+	// Blocks until all enqueued tasks have finished
+	void waitForAll();
+	// The number of tasks that are queued or in progress
+	size_t numPending();
+	unsigned numWorkers() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+	void workerMain(unsigned workerIndex);
+
+private:
+	std::vector<std::thread> workers;
+	std::multimap<uint64_t, std::function<void ()>, std::greater<uint64_t>> tasks;
+	std::mutex tasksMutex;
+	std::condition_variable tasksAvailable;
+	std::condition_variable tasksFinished;
+	size_t tasksInProgress = 0;
+	bool stopping = false;
+};
@@ -0,0 +1,453 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_cache.h"
+#include "maptools_version.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// MARK: - SHA-256
+
+namespace {
+
+class Sha256
+{
+public:
+	void update(const uint8_t* data, size_t len)
+	{
+		totalLength += len;
+		while (len > 0)
+		{
+			size_t toCopy = std::min(len, sizeof(block) - blockLength);
+			memcpy(block + blockLength, data, toCopy);
+			blockLength += toCopy;
+			data += toCopy;
+			len -= toCopy;
+			if (blockLength == sizeof(block))
+			{
+				processBlock(block);
+				blockLength = 0;
+			}
+		}
+	}
+
+	void update(const std::string& str)
+	{
+		update(reinterpret_cast<const uint8_t*>(str.data()), str.size());
+	}
+
+	void updateUint64(uint64_t value)
+	{
+		uint8_t bytes[8];
+		for (int i = 0; i < 8; ++i)
+		{
+			bytes[i] = static_cast<uint8_t>(value >> (56 - (i * 8)));
+		}
+		update(bytes, sizeof(bytes));
+	}
+
+	std::string finishHex()
+	{
+		uint64_t totalBits = totalLength * 8;
+		uint8_t padding = 0x80;
+		update(&padding, 1);
+		padding = 0;
+		while (blockLength != 56)
+		{
+			update(&padding, 1);
+		}
+		updateUint64(totalBits);
+
+		static const char hexDigits[] = "0123456789abcdef";
+		std::string result;
+		result.reserve(64);
+		for (uint32_t word : state)
+		{
+			for (int shift = 28; shift >= 0; shift -= 4)
+			{
+				result.push_back(hexDigits[(word >> shift) & 0xF]);
+			}
+		}
+		return result;
+	}
+
+private:
+	static inline uint32_t rotr(uint32_t x, uint32_t n)
+	{
+		return (x >> n) | (x << (32 - n));
+	}
+
+	void processBlock(const uint8_t* data)
+	{
+		static const uint32_t k[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+		};
+
+		uint32_t w[64];
+		for (int i = 0; i < 16; ++i)
+		{
+			w[i] = (static_cast<uint32_t>(data[i * 4]) << 24) | (static_cast<uint32_t>(data[i * 4 + 1]) << 16) | (static_cast<uint32_t>(data[i * 4 + 2]) << 8) | static_cast<uint32_t>(data[i * 4 + 3]);
+		}
+		for (int i = 16; i < 64; ++i)
+		{
+			uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; ++i)
+		{
+			uint32_t S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+			uint32_t ch = (e & f) ^ (~e & g);
+			uint32_t temp1 = h + S1 + ch + k[i] + w[i];
+			uint32_t S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+			uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t temp2 = S0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + temp1;
+			d = c;
+			c = b;
+			b = a;
+			a = temp1 + temp2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+
+private:
+	uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	uint8_t block[64];
+	size_t blockLength = 0;
+	uint64_t totalLength = 0;
+};
+
+} // anonymous namespace
+
+std::string sha256Hex(const std::string& data)
+{
+	Sha256 hasher;
+	hasher.update(data);
+	return hasher.finishHex();
+}
+
+static bool hashFileContents(const fs::path& path, Sha256& hasher)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	std::vector<char> buffer(64 * 1024);
+	while (file)
+	{
+		file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		std::streamsize numRead = file.gcount();
+		if (numRead > 0)
+		{
+			hasher.update(reinterpret_cast<const uint8_t*>(buffer.data()), static_cast<size_t>(numRead));
+		}
+	}
+	return !file.bad();
+}
+
+bool hashMapPackageContents(const std::string& inputPath, std::string& outputHash)
+{
+	std::error_code ec;
+	Sha256 hasher;
+	if (!fs::is_directory(inputPath, ec))
+	{
+		if (!hashFileContents(inputPath, hasher))
+		{
+			std::cerr << "Failed to read input for hashing: " << inputPath << std::endl;
+			return false;
+		}
+		outputHash = hasher.finishHex();
+		return true;
+	}
+
+	// Extracted package folder - hash the (sorted) relative paths and contents of all files
+	std::vector<std::string> relativePaths;
+	fs::path basePath(inputPath);
+	for (auto it = fs::recursive_directory_iterator(basePath, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+	{
+		if (it->is_regular_file(ec))
+		{
+			relativePaths.push_back(it->path().lexically_relative(basePath).generic_string());
+		}
+	}
+	if (ec)
+	{
+		std::cerr << "Failed to enumerate input for hashing: " << inputPath << " (" << ec.message() << ")" << std::endl;
+		return false;
+	}
+	std::sort(relativePaths.begin(), relativePaths.end());
+	for (const auto& relativePath : relativePaths)
+	{
+		hasher.update(relativePath);
+		hasher.updateUint64(static_cast<uint64_t>(fs::file_size(basePath / relativePath, ec)));
+		if (ec || !hashFileContents(basePath / relativePath, hasher))
+		{
+			std::cerr << "Failed to read input for hashing: " << (basePath / relativePath).string() << std::endl;
+			return false;
+		}
+	}
+	outputHash = hasher.finishHex();
+	return true;
+}
+
+// MARK: - MapToolsResultCache
+
+MapToolsResultCache::MapToolsResultCache(const std::string& cacheDirectory, uint64_t maxCacheSizeBytes)
+: cacheDirectory(cacheDirectory)
+, maxCacheSizeBytes(maxCacheSizeBytes)
+{ }
+
+static bool isCacheEntryFilename(const std::string& filename)
+{
+	return filename.size() == 64 && std::all_of(filename.begin(), filename.end(), [](char c) {
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+	});
+}
+
+bool MapToolsResultCache::initialize()
+{
+	std::error_code ec;
+	fs::create_directories(cacheDirectory, ec);
+	if (ec || !fs::is_directory(cacheDirectory, ec))
+	{
+		std::cerr << "Failed to create / verify cache directory: " << cacheDirectory << std::endl;
+		return false;
+	}
+
+	struct ExistingEntry
+	{
+		std::string key;
+		uint64_t size;
+		fs::file_time_type lastUsed;
+	};
+	std::vector<ExistingEntry> existingEntries;
+	for (auto it = fs::recursive_directory_iterator(cacheDirectory, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+	{
+		std::error_code entryEc;
+		if (!it->is_regular_file(entryEc))
+		{
+			continue;
+		}
+		std::string filename = it->path().filename().string();
+		if (!isCacheEntryFilename(filename))
+		{
+			continue;
+		}
+		ExistingEntry entry{filename, static_cast<uint64_t>(it->file_size(entryEc)), it->last_write_time(entryEc)};
+		if (!entryEc)
+		{
+			existingEntries.push_back(std::move(entry));
+		}
+	}
+	if (ec)
+	{
+		std::cerr << "Failed to enumerate cache directory: " << cacheDirectory << " (" << ec.message() << ")" << std::endl;
+		return false;
+	}
+
+	// Oldest entries go to the back of the LRU list
+	std::sort(existingEntries.begin(), existingEntries.end(), [](const ExistingEntry& a, const ExistingEntry& b) {
+		return a.lastUsed > b.lastUsed;
+	});
+
+	std::lock_guard<std::mutex> lock(indexMutex);
+	for (const auto& entry : existingEntries)
+	{
+		lruOrder.push_back(entry.key);
+		entries[entry.key] = EntryInfo{entry.size, std::prev(lruOrder.end())};
+		totalSizeBytes += entry.size;
+	}
+	evictEntries_locked();
+	return true;
+}
+
+std::string MapToolsResultCache::makeKey(const std::string& inputHash, const std::string& operation, const std::string& options)
+{
+	static const std::string versionInfo = generateMapToolsVersionInfo();
+	std::string keyData;
+	keyData.reserve(inputHash.size() + operation.size() + options.size() + versionInfo.size() + 4);
+	keyData.append(inputHash).push_back('\n');
+	keyData.append(operation).push_back('\n');
+	keyData.append(options).push_back('\n');
+	keyData.append(versionInfo);
+	return sha256Hex(keyData);
+}
+
+std::string MapToolsResultCache::entryPath(const std::string& key) const
+{
+	// Fan out into subdirectories (by the first byte of the key) to keep directory sizes reasonable
+	return (fs::path(cacheDirectory) / key.substr(0, 2) / key).string();
+}
+
+void MapToolsResultCache::touchEntry_locked(const std::string& key, uint64_t size)
+{
+	auto it = entries.find(key);
+	if (it != entries.end())
+	{
+		totalSizeBytes -= it->second.size;
+		lruOrder.erase(it->second.lruPosition);
+		entries.erase(it);
+	}
+	lruOrder.push_front(key);
+	entries[key] = EntryInfo{size, lruOrder.begin()};
+	totalSizeBytes += size;
+}
+
+void MapToolsResultCache::evictEntries_locked()
+{
+	// Always keep at least the most-recently-used entry
+	while (totalSizeBytes > maxCacheSizeBytes && lruOrder.size() > 1)
+	{
+		const std::string& key = lruOrder.back();
+		auto it = entries.find(key);
+		std::error_code ec;
+		fs::remove(entryPath(key), ec); // another process may have already removed it
+		totalSizeBytes -= it->second.size;
+		entries.erase(it);
+		lruOrder.pop_back();
+		++evictions;
+	}
+}
+
+static bool readCacheEntry(const std::string& path, std::vector<uint8_t>& outputData)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	std::streamoff size = file.tellg();
+	if (size < 0)
+	{
+		return false;
+	}
+	file.seekg(0, std::ios::beg);
+	outputData.resize(static_cast<size_t>(size));
+	return size == 0 || static_cast<bool>(file.read(reinterpret_cast<char*>(outputData.data()), size));
+}
+
+bool MapToolsResultCache::lookup(const std::vector<std::string>& candidateKeys, std::vector<uint8_t>& outputData)
+{
+	for (const auto& key : candidateKeys)
+	{
+		std::string path = entryPath(key);
+		if (!readCacheEntry(path, outputData))
+		{
+			continue;
+		}
+
+		// Bump the modification time, so the LRU order persists across runs
+		std::error_code ec;
+		fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+		std::lock_guard<std::mutex> lock(indexMutex);
+		touchEntry_locked(key, static_cast<uint64_t>(outputData.size()));
+		++hits;
+		return true;
+	}
+	outputData.clear();
+	++misses;
+	return false;
+}
+
+static long getCurrentProcessId()
+{
+#if defined(_WIN32)
+	return static_cast<long>(_getpid());
+#else
+	return static_cast<long>(getpid());
+#endif
+}
+
+bool MapToolsResultCache::store(const std::string& key, const std::vector<uint8_t>& data)
+{
+	fs::path path(entryPath(key));
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+
+	// Write to a temporary file + rename, so concurrent readers (or other processes) never see a partial entry
+	// (the temporary file is unique to this process + store call, so concurrent writers of the same key - in this
+	// process, or others sharing the cache directory - never write the same file)
+	static std::atomic<uint64_t> nextTempFileNumber(0);
+	fs::path tempPath = path;
+	tempPath += ".tmp" + std::to_string(getCurrentProcessId()) + "-" + std::to_string(nextTempFileNumber++);
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open() || !file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size())))
+		{
+			std::cerr << "Failed to write cache entry: " << tempPath.string() << std::endl;
+			file.close();
+			fs::remove(tempPath, ec);
+			return false;
+		}
+	}
+	fs::rename(tempPath, path, ec);
+	if (ec)
+	{
+		std::cerr << "Failed to write cache entry: " << path.string() << " (" << ec.message() << ")" << std::endl;
+		fs::remove(tempPath, ec);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(indexMutex);
+	touchEntry_locked(key, static_cast<uint64_t>(data.size()));
+	++stores;
+	evictEntries_locked();
+	return true;
+}
+
+void MapToolsResultCache::printStats(std::ostream& os) const
+{
+	uint64_t currentSize = 0;
+	size_t currentEntries = 0;
+	{
+		std::lock_guard<std::mutex> lock(indexMutex);
+		currentSize = totalSizeBytes;
+		currentEntries = entries.size();
+	}
+	os << "Cache: " << hits.load() << " hits, " << misses.load() << " misses, " << stores.load() << " stores, " << evictions.load() << " evictions"
+		<< " (" << currentEntries << " entries, " << currentSize << " bytes in: " << cacheDirectory << ")" << std::endl;
+}
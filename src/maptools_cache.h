@@ -0,0 +1,93 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+#include <cstdint>
+
+// Returns the (lowercase hex) SHA-256 of a string
+std::string sha256Hex(const std::string& data);
+
+// Computes a SHA-256 content hash of a map package: the bytes of a .wz archive, or (for an extracted package folder) the relative paths + bytes of every file it contains
+bool hashMapPackageContents(const std::string& inputPath, std::string& outputHash);
+
+/*
+ * An on-disk, content-addressed cache of generated outputs (info JSON, preview PNGs, converted archives).
+ *
+ * Entries are keyed on the input package content hash, the operation, the (serialized) options that affect
+ * the output, and the maptools version info - so a hit can skip loading the map entirely.
+ * The cache is size-capped, and evicts the least-recently-used entries (tracked via the entry file modification times,
+ * so the LRU order persists across runs).
+ */
+class MapToolsResultCache
+{
+public:
+	MapToolsResultCache(const std::string& cacheDirectory, uint64_t maxCacheSizeBytes);
+
+	MapToolsResultCache(const MapToolsResultCache&) = delete;
+	MapToolsResultCache& operator=(const MapToolsResultCache&) = delete;
+
+public:
+	// Creates the cache directory (if needed) and indexes the existing entries
+	bool initialize();
+
+	// Returns the cache key for an operation on an input package (with inputHash from hashMapPackageContents)
+	static std::string makeKey(const std::string& inputHash, const std::string& operation, const std::string& options);
+
+	// Looks up the first of the candidate keys that exists in the cache (counted as a single hit / miss)
+	bool lookup(const std::vector<std::string>& candidateKeys, std::vector<uint8_t>& outputData);
+	bool store(const std::string& key, const std::vector<uint8_t>& data);
+
+	void printStats(std::ostream& os) const;
+	uint64_t numHits() const { return hits.load(); }
+	uint64_t numMisses() const { return misses.load(); }
+
+private:
+	std::string entryPath(const std::string& key) const;
+	void touchEntry_locked(const std::string& key, uint64_t size);
+	void evictEntries_locked();
+
+private:
+	struct EntryInfo
+	{
+		uint64_t size = 0;
+		std::list<std::string>::iterator lruPosition;
+	};
+
+	std::string cacheDirectory;
+	uint64_t maxCacheSizeBytes = 0;
+
+	mutable std::mutex indexMutex;
+	std::list<std::string> lruOrder; // front = most recently used
+	std::unordered_map<std::string, EntryInfo> entries;
+	uint64_t totalSizeBytes = 0;
+
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+	std::atomic<uint64_t> stores{0};
+	std::atomic<uint64_t> evictions{0};
+};
@@ -0,0 +1,295 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_journal.h"
+#include <nlohmann/json.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Pending entries are written + synced at least this often, or as soon as this many are pending
+static const std::chrono::milliseconds JournalSyncInterval(1000);
+static const size_t JournalSyncBatchEntries = 256;
+
+static bool syncFileToDisk(FILE* file)
+{
+	if (fflush(file) != 0)
+	{
+		return false;
+	}
+#if defined(_WIN32)
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool syncPathToDisk(const std::string& path)
+{
+#if defined(_WIN32)
+	int fd = _open(path.c_str(), _O_RDWR | _O_BINARY); // (flushing requires write access)
+	if (fd < 0)
+	{
+		return false;
+	}
+	bool result = (_commit(fd) == 0);
+	_close(fd);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	bool result = (fsync(fd) == 0);
+	::close(fd);
+#endif
+	return result;
+}
+
+bool syncOutputToDisk(const std::string& outputPath)
+{
+	std::error_code ec;
+	if (!fs::is_directory(outputPath, ec))
+	{
+		return syncPathToDisk(outputPath);
+	}
+	for (auto it = fs::recursive_directory_iterator(outputPath, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+	{
+		if (it->is_regular_file(ec) && !syncPathToDisk(it->path().string()))
+		{
+			return false;
+		}
+	}
+	return !ec;
+}
+
+MapToolsBatchJournal::MapToolsBatchJournal(const std::string& journalPath, const std::string& optionsHash)
+: journalPath(journalPath)
+, optionsHash(optionsHash)
+{ }
+
+MapToolsBatchJournal::~MapToolsBatchJournal()
+{
+	close();
+}
+
+bool MapToolsBatchJournal::loadCompletedEntries()
+{
+	std::ifstream journalFile(journalPath, std::ios::binary);
+	if (!journalFile.is_open())
+	{
+		// nothing to resume
+		return true;
+	}
+	std::string line;
+	while (std::getline(journalFile, line))
+	{
+		auto entry = nlohmann::json::parse(line, nullptr, false);
+		if (entry.is_discarded() || !entry.is_object() || !entry.contains("input") || !entry["input"].is_string())
+		{
+			// (ex. a partially-written last line, if the previous run crashed)
+			continue;
+		}
+		std::string inputPath = entry["input"].get<std::string>();
+		bool succeeded = entry.value("status", "") == "ok";
+		if (!succeeded || entry.value("options_hash", "") != optionsHash)
+		{
+			// the latest entry for an input wins
+			completedInputs.erase(inputPath);
+			continue;
+		}
+		CompletedInput completed{entry.value("input_hash", ""), {}};
+		auto output = entry.find("output");
+		if (output != entry.end() && output->is_string())
+		{
+			completed.outputPaths.push_back(output->get<std::string>());
+		}
+		else if (output != entry.end() && output->is_array())
+		{
+			for (const auto& outputPath : *output)
+			{
+				if (outputPath.is_string())
+				{
+					completed.outputPaths.push_back(outputPath.get<std::string>());
+				}
+			}
+		}
+		completedInputs[inputPath] = std::move(completed);
+	}
+	if (journalFile.bad())
+	{
+		std::cerr << "Failed to read journal: " << journalPath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool MapToolsBatchJournal::open(bool loadCompleted)
+{
+	if (loadCompleted && !loadCompletedEntries())
+	{
+		return false;
+	}
+
+	std::error_code ec;
+	uintmax_t existingSize = fs::file_size(journalPath, ec);
+	file = fopen(journalPath.c_str(), "ab");
+	if (!file)
+	{
+		std::cerr << "Failed to open journal: " << journalPath << std::endl;
+		return false;
+	}
+	if (!ec && existingSize > 0)
+	{
+		// make sure new entries start on a new line (if the previous run crashed mid-line)
+		std::ifstream existingFile(journalPath, std::ios::binary);
+		existingFile.seekg(-1, std::ios::end);
+		char lastChar = '\n';
+		if (existingFile.get(lastChar) && lastChar != '\n')
+		{
+			fputc('\n', file);
+		}
+	}
+
+	stopping = false;
+	writerThread = std::thread(&MapToolsBatchJournal::writerMain, this);
+	return true;
+}
+
+bool MapToolsBatchJournal::close()
+{
+	if (!file)
+	{
+		return true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		stopping = true;
+	}
+	pendingChanged.notify_all();
+	writerThread.join();
+
+	if (fclose(file) != 0)
+	{
+		writeFailed = true;
+	}
+	file = nullptr;
+	if (writeFailed)
+	{
+		std::cerr << "Failed to write journal: " << journalPath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool MapToolsBatchJournal::isCompleted(const std::string& inputPath, const std::string& inputHash) const
+{
+	auto it = completedInputs.find(inputPath);
+	if (it == completedInputs.end() || inputHash.empty() || it->second.inputHash != inputHash)
+	{
+		return false;
+	}
+	for (const auto& outputPath : it->second.outputPaths)
+	{
+		std::error_code ec;
+		if (!outputPath.empty() && outputPath != "-" && !fs::exists(outputPath, ec))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void MapToolsBatchJournal::record(const std::string& inputPath, const std::string& inputHash, bool succeeded, const std::vector<std::string>& outputPaths)
+{
+	nlohmann::ordered_json entry = nlohmann::ordered_json::object();
+	entry["input"] = inputPath;
+	entry["input_hash"] = inputHash;
+	entry["options_hash"] = optionsHash;
+	entry["status"] = (succeeded) ? "ok" : "failed";
+	if (outputPaths.size() == 1)
+	{
+		entry["output"] = outputPaths.front();
+	}
+	else
+	{
+		entry["output"] = outputPaths;
+	}
+	std::string line = entry.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::replace);
+	line.push_back('\n');
+
+	bool notifyWriter = false;
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		pendingData.append(line);
+		++numPendingEntries;
+		notifyWriter = (numPendingEntries >= JournalSyncBatchEntries);
+	}
+	if (notifyWriter)
+	{
+		pendingChanged.notify_one();
+	}
+}
+
+bool MapToolsBatchJournal::writeAndSync(const std::string& data)
+{
+	if (fwrite(data.data(), 1, data.size(), file) != data.size())
+	{
+		return false;
+	}
+	return syncFileToDisk(file);
+}
+
+void MapToolsBatchJournal::writerMain()
+{
+	std::string data;
+	while (true)
+	{
+		bool exitAfterWrite = false;
+		{
+			std::unique_lock<std::mutex> lock(pendingMutex);
+			pendingChanged.wait_for(lock, JournalSyncInterval, [this]() { return stopping || numPendingEntries >= JournalSyncBatchEntries; });
+			data.swap(pendingData);
+			numPendingEntries = 0;
+			exitAfterWrite = stopping;
+		}
+		if (!data.empty())
+		{
+			if (!writeAndSync(data))
+			{
+				writeFailed = true;
+			}
+			data.clear();
+		}
+		if (exitAfterWrite)
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,90 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+
+/*
+ * An append-only journal of the items completed by a batch run (--journal), used to --resume an interrupted run.
+ *
+ * Each entry is a single JSON line: {"input","input_hash","options_hash","status","output"}
+ * ("output" is a path - or, for an input with several outputs (ex. genpreview --sizes), an array of paths)
+ * Entries are appended by a background thread, which writes + fsyncs them in batches (at most once a second,
+ * or once enough entries are pending) - so a crash loses at most the last batch, which is re-processed on resume.
+ */
+class MapToolsBatchJournal
+{
+public:
+	// optionsHash identifies the operation + options of this run (entries from runs with other options are never "completed")
+	MapToolsBatchJournal(const std::string& journalPath, const std::string& optionsHash);
+	~MapToolsBatchJournal();
+
+	MapToolsBatchJournal(const MapToolsBatchJournal&) = delete;
+	MapToolsBatchJournal& operator=(const MapToolsBatchJournal&) = delete;
+
+public:
+	// Opens the journal for appending - if loadCompleted, the existing entries are read first (for isCompleted)
+	bool open(bool loadCompleted);
+	// Writes (+ syncs) any pending entries, and closes the journal
+	bool close();
+
+	// Whether the journal records a successful run of an input with the same contents (and options), whose outputs all still exist
+	bool isCompleted(const std::string& inputPath, const std::string& inputHash) const;
+	size_t numCompletedLoaded() const { return completedInputs.size(); }
+
+	// Appends an entry (thread-safe)
+	void record(const std::string& inputPath, const std::string& inputHash, bool succeeded, const std::vector<std::string>& outputPaths);
+
+private:
+	bool loadCompletedEntries();
+	void writerMain();
+	bool writeAndSync(const std::string& data);
+
+private:
+	struct CompletedInput
+	{
+		std::string inputHash;
+		std::vector<std::string> outputPaths;
+	};
+
+	std::string journalPath;
+	std::string optionsHash;
+	std::unordered_map<std::string, CompletedInput> completedInputs;
+
+	FILE* file = nullptr;
+	std::thread writerThread;
+	std::mutex pendingMutex;
+	std::condition_variable pendingChanged;
+	std::string pendingData;
+	size_t numPendingEntries = 0;
+	bool stopping = false;
+	std::atomic<bool> writeFailed{false};
+};
+
+// Syncs an output file (or each of the files in an output directory) to disk - so it can be journaled as completed
+bool syncOutputToDisk(const std::string& outputPath);
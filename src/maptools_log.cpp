@@ -0,0 +1,276 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_log.h"
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <cstdio>
+
+namespace {
+
+const size_t ThreadBufferHandoffSize = 16 * 1024;
+
+struct LogChunk
+{
+	bool outputToStdErr;
+	std::string data;
+};
+
+std::atomic<MapToolsLog::Format> logFormat(MapToolsLog::Format::Text);
+
+void writeChunkToStdio(const LogChunk& chunk)
+{
+	FILE* output = (chunk.outputToStdErr) ? stderr : stdout;
+	fwrite(chunk.data.data(), 1, chunk.data.size(), output);
+}
+
+class AsyncLogWriter
+{
+public:
+	~AsyncLogWriter()
+	{
+		stop();
+	}
+
+	void start()
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if (running)
+		{
+			return;
+		}
+		running = true;
+		stopping = false;
+		writerThread = std::thread(&AsyncLogWriter::writerMain, this);
+		accepting.store(true);
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			if (!running)
+			{
+				return;
+			}
+			stopping = true;
+			accepting.store(false);
+		}
+		queueCondition.notify_one();
+		writerThread.join();
+		std::lock_guard<std::mutex> lock(queueMutex);
+		running = false;
+	}
+
+	// Returns false if the writer isn't running (in which case the caller should write the chunk itself)
+	bool enqueue(LogChunk& chunk)
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			if (!running || stopping)
+			{
+				return false;
+			}
+			queue.push_back(std::move(chunk));
+		}
+		queueCondition.notify_one();
+		return true;
+	}
+
+	// (lock-free check, for the per-line fast path)
+	bool isRunning() const
+	{
+		return accepting.load(std::memory_order_relaxed);
+	}
+
+private:
+	void writerMain()
+	{
+		std::deque<LogChunk> pending;
+		while (true)
+		{
+			bool exitAfterWrite = false;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [this]() { return stopping || !queue.empty(); });
+				pending.swap(queue);
+				exitAfterWrite = stopping && pending.empty();
+			}
+			if (exitAfterWrite)
+			{
+				break;
+			}
+			for (const auto& chunk : pending)
+			{
+				writeChunkToStdio(chunk);
+			}
+			pending.clear();
+			fflush(stdout);
+			fflush(stderr);
+		}
+	}
+
+private:
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<LogChunk> queue;
+	std::thread writerThread;
+	bool running = false;
+	bool stopping = false;
+	std::atomic<bool> accepting{false};
+};
+
+AsyncLogWriter& asyncLogWriter()
+{
+	static AsyncLogWriter writer;
+	return writer;
+}
+
+struct ThreadLogBuffer
+{
+	std::string stdoutBuffer;
+	std::string stderrBuffer;
+	std::string currentMapPath;
+
+	~ThreadLogBuffer()
+	{
+		flush();
+	}
+
+	void flush()
+	{
+		handOff(false, stdoutBuffer);
+		handOff(true, stderrBuffer);
+	}
+
+private:
+	static void handOff(bool outputToStdErr, std::string& buffer)
+	{
+		if (buffer.empty())
+		{
+			return;
+		}
+		LogChunk chunk{outputToStdErr, std::string()};
+		chunk.data.swap(buffer);
+		if (!asyncLogWriter().enqueue(chunk))
+		{
+			writeChunkToStdio(chunk);
+		}
+	}
+};
+
+ThreadLogBuffer& currentThreadLogBuffer()
+{
+	thread_local ThreadLogBuffer buffer;
+	return buffer;
+}
+
+const char* levelToString(MapToolsLog::Level level)
+{
+	switch (level)
+	{
+		case MapToolsLog::Level::Error:
+			return "ERROR";
+		case MapToolsLog::Level::Warning:
+			return "WARNING";
+		case MapToolsLog::Level::Info:
+			return "INFO";
+	}
+	return ""; // silence warning
+}
+
+} // anonymous namespace
+
+void MapToolsLog::setFormat(Format format)
+{
+	logFormat.store(format);
+}
+
+void MapToolsLog::write(Level level, bool outputToStdErr, const char *function, int line, const char *message)
+{
+	ThreadLogBuffer& threadBuffer = currentThreadLogBuffer();
+	std::string& buffer = (outputToStdErr) ? threadBuffer.stderrBuffer : threadBuffer.stdoutBuffer;
+
+	if (logFormat.load(std::memory_order_relaxed) == Format::JSON)
+	{
+		nlohmann::ordered_json logLine = nlohmann::ordered_json::object();
+		logLine["level"] = levelToString(level);
+		if (!threadBuffer.currentMapPath.empty())
+		{
+			logLine["map"] = threadBuffer.currentMapPath;
+		}
+		logLine["function"] = (function) ? function : "";
+		logLine["line"] = line;
+		logLine["message"] = (message) ? message : "";
+		buffer.append(logLine.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::replace));
+	}
+	else
+	{
+		buffer.append(levelToString(level));
+		buffer.append(": [");
+		buffer.append((function) ? function : "");
+		buffer.append(":");
+		buffer.append(std::to_string(line));
+		buffer.append("] ");
+		buffer.append((message) ? message : "");
+	}
+	buffer.push_back('\n');
+
+	if (!asyncLogWriter().isRunning() || level == Level::Error || buffer.size() >= ThreadBufferHandoffSize)
+	{
+		threadBuffer.flush();
+	}
+}
+
+void MapToolsLog::flushThread()
+{
+	currentThreadLogBuffer().flush();
+}
+
+void MapToolsLog::startAsyncWriter()
+{
+	asyncLogWriter().start();
+}
+
+void MapToolsLog::stopAsyncWriter()
+{
+	flushThread();
+	asyncLogWriter().stop();
+	fflush(stdout);
+	fflush(stderr);
+}
+
+MapToolsLogMapContext::MapToolsLogMapContext(const std::string& mapPath)
+{
+	ThreadLogBuffer& threadBuffer = currentThreadLogBuffer();
+	previousMapPath = threadBuffer.currentMapPath;
+	threadBuffer.currentMapPath = mapPath;
+}
+
+MapToolsLogMapContext::~MapToolsLogMapContext()
+{
+	ThreadLogBuffer& threadBuffer = currentThreadLogBuffer();
+	threadBuffer.flush();
+	threadBuffer.currentMapPath = previousMapPath;
+}
@@ -0,0 +1,73 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+
+/*
+ * Log output backend
+ *
+ * Log lines are formatted into a per-thread buffer (no locking, no per-line flushing).
+ * - By default, each line is written straight to stdio (preserving ordering with other stdout / stderr output)
+ * - While the async writer is running (batch / serve modes), a thread's buffer is only handed off to the
+ *   writer thread when it fills up, when an error is logged, or when the current map context ends
+ */
+namespace MapToolsLog {
+
+enum class Level
+{
+	Error,
+	Warning,
+	Info
+};
+
+enum class Format
+{
+	Text,
+	JSON // one JSON object per line, tagged with the map being processed (if any)
+};
+
+void setFormat(Format format);
+
+void write(Level level, bool outputToStdErr, const char *function, int line, const char *message);
+
+// Hands off the calling thread's buffered output
+void flushThread();
+
+void startAsyncWriter();
+// Flushes the calling thread's buffer, then blocks until the async writer has written everything and exited
+void stopAsyncWriter();
+
+} // namespace MapToolsLog
+
+// Tags all log lines from the calling thread with a map (input path) for the lifetime of the object
+class MapToolsLogMapContext
+{
+public:
+	explicit MapToolsLogMapContext(const std::string& mapPath);
+	~MapToolsLogMapContext();
+
+	MapToolsLogMapContext(const MapToolsLogMapContext&) = delete;
+	MapToolsLogMapContext& operator=(const MapToolsLogMapContext&) = delete;
+
+private:
+	std::string previousMapPath;
+};
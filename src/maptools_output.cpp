@@ -0,0 +1,197 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_output.h"
+#include "maptools_timings.h"
+#include "maptools_trace.h"
+
+// Ready results are gathered into blocks of (up to about) this size before being written
+static const size_t OutputBlockSize = 1024 * 1024;
+// The output is synced (for the results with an onWritten handler) at most this often
+static const std::chrono::milliseconds OutputSyncInterval(1000);
+
+MapToolsBatchOutputWriter::MapToolsBatchOutputWriter(std::ostream& output, bool preserveOrder, size_t maxPending, const SyncFunction& syncOutput)
+: output(output)
+, preserveOrder(preserveOrder)
+, maxPending((maxPending > 0) ? maxPending : 1)
+, syncOutput(syncOutput)
+, lastSyncTime(std::chrono::steady_clock::now())
+{
+	writerThread = std::thread(&MapToolsBatchOutputWriter::writerMain, this);
+}
+
+MapToolsBatchOutputWriter::~MapToolsBatchOutputWriter()
+{
+	finish();
+}
+
+void MapToolsBatchOutputWriter::write(size_t index, std::string&& data, WrittenHandler&& onWritten)
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	if (preserveOrder)
+	{
+		if (index >= nextIndex + maxPending)
+		{
+			// too far ahead of the next result to be written - wait for the writer to catch up
+			MapToolsScopedPhase waitPhase("output wait");
+			spaceAvailable.wait(lock, [this, index]() { return index < nextIndex + maxPending; });
+		}
+		reorderBuffer.emplace(index, Result{std::move(data), std::move(onWritten)});
+		if (index != nextIndex)
+		{
+			return;
+		}
+	}
+	else
+	{
+		if (completionQueue.size() >= maxPending)
+		{
+			MapToolsScopedPhase waitPhase("output wait");
+			spaceAvailable.wait(lock, [this]() { return completionQueue.size() < maxPending; });
+		}
+		completionQueue.push_back(Result{std::move(data), std::move(onWritten)});
+	}
+	lock.unlock();
+	resultsAvailable.notify_one();
+}
+
+void MapToolsBatchOutputWriter::skip(size_t index)
+{
+	if (!preserveOrder)
+	{
+		return;
+	}
+	write(index, std::string());
+}
+
+bool MapToolsBatchOutputWriter::hasReadyResults() const
+{
+	if (preserveOrder)
+	{
+		return !reorderBuffer.empty() && reorderBuffer.begin()->first == nextIndex;
+	}
+	return !completionQueue.empty();
+}
+
+bool MapToolsBatchOutputWriter::finish()
+{
+	if (writerThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		resultsAvailable.notify_one();
+		writerThread.join();
+	}
+	return !writeFailed;
+}
+
+// Calls the handlers of the results written (and flushed) so far - once the output is synced, if there's a syncOutput function
+// Returns false if syncing failed
+bool MapToolsBatchOutputWriter::syncWrittenResults(std::vector<WrittenHandler>& writtenHandlers, bool force)
+{
+	if (syncOutput)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (!force && (now - lastSyncTime) < OutputSyncInterval)
+		{
+			// (left for a later sync)
+			return true;
+		}
+		if (!syncOutput())
+		{
+			return false;
+		}
+		lastSyncTime = now;
+	}
+	for (auto& onWritten : writtenHandlers)
+	{
+		onWritten();
+	}
+	writtenHandlers.clear();
+	return true;
+}
+
+void MapToolsBatchOutputWriter::writerMain()
+{
+	MapToolsTrace::setThreadName("output writer");
+	std::string block;
+	std::vector<WrittenHandler> writtenHandlers; // (of the results written since the last sync)
+	while (true)
+	{
+		bool moreReady = false;
+		bool exitAfterWrite = false;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			resultsAvailable.wait(lock, [this]() { return stopping || hasReadyResults(); });
+			if (stopping && preserveOrder && !hasReadyResults() && !reorderBuffer.empty())
+			{
+				// (only if an index was never written or skipped - output the rest in order, rather than dropping them)
+				nextIndex = reorderBuffer.begin()->first;
+			}
+			while (hasReadyResults() && block.size() < OutputBlockSize)
+			{
+				Result& result = (preserveOrder) ? reorderBuffer.begin()->second : completionQueue.front();
+				block.append(result.data);
+				if (result.onWritten)
+				{
+					writtenHandlers.push_back(std::move(result.onWritten));
+				}
+				if (preserveOrder)
+				{
+					reorderBuffer.erase(reorderBuffer.begin());
+					++nextIndex;
+				}
+				else
+				{
+					completionQueue.pop_front();
+				}
+			}
+			moreReady = hasReadyResults();
+			exitAfterWrite = stopping && !moreReady && reorderBuffer.empty();
+		}
+		spaceAvailable.notify_all();
+
+		if (!block.empty())
+		{
+			MapToolsScopedPhase writePhase("write output");
+			output.write(block.data(), static_cast<std::streamsize>(block.size()));
+			block.clear();
+		}
+		if (!moreReady)
+		{
+			// (flushed whenever the writer catches up - so output is never held back waiting for a full block)
+			output.flush();
+		}
+		if (!output.good())
+		{
+			writeFailed = true;
+		}
+		if (!moreReady && !writeFailed && !writtenHandlers.empty() && !syncWrittenResults(writtenHandlers, exitAfterWrite))
+		{
+			writeFailed = true;
+		}
+		if (exitAfterWrite)
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,94 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <ostream>
+
+/*
+ * The output stage of a batch run: worker threads hand their (NDJSON) results to a dedicated writer thread,
+ * which writes them out in large blocks.
+ *
+ * If preserveOrder, results are written in input order (by index, starting from 0 - every index must be either
+ * written or skipped), using a bounded reorder buffer: a worker whose result is too far ahead of the next result
+ * to be written blocks until the writer catches up. Otherwise, results are written in the order they complete.
+ * Either way, workers block (backpressure) while the writer has maxPending results waiting for a slow sink.
+ *
+ * A result can have an onWritten callback, which the writer thread calls once the result has been written and flushed
+ * (and synced by syncOutput, if set - at most once a second) - ex. to journal it. It is never called if writing failed.
+ */
+class MapToolsBatchOutputWriter
+{
+public:
+	typedef std::function<void ()> WrittenHandler;
+	typedef std::function<bool ()> SyncFunction;
+
+	MapToolsBatchOutputWriter(std::ostream& output, bool preserveOrder, size_t maxPending, const SyncFunction& syncOutput = nullptr);
+	~MapToolsBatchOutputWriter();
+
+	MapToolsBatchOutputWriter(const MapToolsBatchOutputWriter&) = delete;
+	MapToolsBatchOutputWriter& operator=(const MapToolsBatchOutputWriter&) = delete;
+
+public:
+	// Queues the result for input index (thread-safe)
+	void write(size_t index, std::string&& data, WrittenHandler&& onWritten = nullptr);
+	// Marks input index as having no result (thread-safe)
+	void skip(size_t index);
+
+	// Writes out all of the queued results, and flushes the output - returns false if writing failed
+	bool finish();
+
+private:
+	struct Result
+	{
+		std::string data;
+		WrittenHandler onWritten;
+	};
+
+	bool hasReadyResults() const;
+	void writerMain();
+	bool syncWrittenResults(std::vector<WrittenHandler>& writtenHandlers, bool force);
+
+private:
+	std::ostream& output;
+	bool preserveOrder;
+	size_t maxPending;
+	SyncFunction syncOutput;
+	std::chrono::steady_clock::time_point lastSyncTime;
+
+	std::mutex queueMutex;
+	std::condition_variable resultsAvailable;
+	std::condition_variable spaceAvailable;
+	std::map<size_t, Result> reorderBuffer;  // (if preserveOrder) index -> result (empty, if skipped)
+	std::deque<Result> completionQueue;      // (if !preserveOrder)
+	size_t nextIndex = 0;
+	bool stopping = false;
+	bool writeFailed = false;
+	std::thread writerThread;
+};
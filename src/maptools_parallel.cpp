@@ -0,0 +1,48 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+void parallelFor(size_t count, unsigned numThreads, const std::function<void (size_t)>& func)
+{
+	std::atomic<size_t> nextIndex(0);
+	auto worker = [&]() {
+		for (size_t i = nextIndex++; i < count; i = nextIndex++)
+		{
+			func(i);
+		}
+	};
+	std::vector<std::thread> threads;
+	size_t numExtraThreads = std::min<size_t>(std::max(numThreads, 1u), count) - 1;
+	threads.reserve(numExtraThreads);
+	for (size_t i = 0; i < numExtraThreads; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
@@ -0,0 +1,267 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_previewsizes.h"
+#include <filesystem>
+#include <algorithm>
+#include <set>
+#include <cctype>
+
+static bool parseSizeNumber(const std::string& str, unsigned long maxValue, unsigned& value)
+{
+	if (str.empty() || str.size() > 9 || !std::all_of(str.begin(), str.end(), [](unsigned char c) { return std::isdigit(c) != 0; }))
+	{
+		return false;
+	}
+	unsigned long parsed = std::stoul(str);
+	if (parsed == 0 || parsed > maxValue)
+	{
+		return false;
+	}
+	value = static_cast<unsigned>(parsed);
+	return true;
+}
+
+bool parsePreviewSizes(const std::string& specs, std::vector<MapToolsPreviewSize>& sizes, std::string& error)
+{
+	sizes.clear();
+	std::set<std::string> seenSpecs;
+	size_t start = 0;
+	while (start <= specs.size())
+	{
+		size_t end = specs.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = specs.size();
+		}
+		MapToolsPreviewSize size;
+		size.spec = specs.substr(start, end - start);
+		std::transform(size.spec.begin(), size.spec.end(), size.spec.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		bool valid = false;
+		if (!size.spec.empty() && size.spec.back() == 'x')
+		{
+			valid = parseSizeNumber(size.spec.substr(0, size.spec.size() - 1), MaxPreviewScale, size.scale);
+		}
+		else
+		{
+			valid = parseSizeNumber(size.spec, MaxPreviewSizeDimension, size.maxDimension);
+		}
+		if (!valid)
+		{
+			error = "Invalid size: \"" + size.spec + "\" (expecting Nx, for an upscale by N <= " + std::to_string(MaxPreviewScale) + ", or N, to fit within N x N pixels, for N <= " + std::to_string(MaxPreviewSizeDimension) + ")";
+			return false;
+		}
+		if (!seenSpecs.insert(size.spec).second)
+		{
+			error = "Duplicate size: " + size.spec;
+			return false;
+		}
+		sizes.push_back(size);
+		start = end + 1;
+	}
+	return true;
+}
+
+std::string previewSizesToString(const std::vector<MapToolsPreviewSize>& sizes)
+{
+	std::string result;
+	for (const auto& size : sizes)
+	{
+		if (!result.empty())
+		{
+			result.push_back(',');
+		}
+		result.append(size.spec);
+	}
+	return result;
+}
+
+std::string validatePreviewSizeNameTemplate(const std::string& nameTemplate)
+{
+	if (nameTemplate.find("{size}") == std::string::npos)
+	{
+		return "The output name template must contain {size}: " + nameTemplate;
+	}
+	std::filesystem::path templatePath(nameTemplate);
+	if (templatePath.is_absolute() || templatePath.has_root_path())
+	{
+		return "The output name template must be a relative path: " + nameTemplate;
+	}
+	for (const auto& component : templatePath)
+	{
+		if (component == "..")
+		{
+			// (each size is written in - or below - the directory of the output path)
+			return "The output name template must not contain .. components: " + nameTemplate;
+		}
+	}
+	return std::string();
+}
+
+MapToolsPreviewSizePlan planPreviewSize(const MapToolsPreviewSize& size, unsigned w, unsigned h)
+{
+	MapToolsPreviewSizePlan plan;
+	plan.width = w;
+	plan.height = h;
+	if (size.scale > 0)
+	{
+		plan.scale = size.scale;
+		return plan;
+	}
+	unsigned longestSide = std::max(std::max(w, h), 1u);
+	if (size.maxDimension >= longestSide)
+	{
+		plan.scale = size.maxDimension / longestSide;
+		return plan;
+	}
+	// (rounded to the nearest pixel, keeping the aspect ratio)
+	plan.downscaled = true;
+	plan.width = std::max(static_cast<unsigned>((static_cast<uint64_t>(w) * size.maxDimension + (longestSide / 2)) / longestSide), 1u);
+	plan.height = std::max(static_cast<unsigned>((static_cast<uint64_t>(h) * size.maxDimension + (longestSide / 2)) / longestSide), 1u);
+	return plan;
+}
+
+static void replaceAll(std::string& str, const std::string& from, const std::string& to)
+{
+	size_t pos = 0;
+	while ((pos = str.find(from, pos)) != std::string::npos)
+	{
+		str.replace(pos, from.size(), to);
+		pos += to.size();
+	}
+}
+
+std::string makePreviewSizeOutputPath(const std::string& outputPath, const std::string& nameTemplate, const MapToolsPreviewSize& size)
+{
+	std::filesystem::path path(outputPath);
+	std::string filename = nameTemplate;
+	replaceAll(filename, "{stem}", path.stem().string());
+	replaceAll(filename, "{size}", size.spec);
+	return (path.parent_path() / filename).string();
+}
+
+/**************************************************************************
+  Box-filter downscaling
+
+  Done in two separable passes (horizontal, then vertical), each with
+  precomputed fixed-point weights: every output pixel covers src / dst
+  source pixels, and each source pixel is weighted by how much of it is
+  covered. The weights of each output pixel sum to exactly 1 << 16, so a
+  flat-color area averages to exactly its color.
+
+  Each result is within 1 of the exact area average. The vertical pass is
+  plain loops over whole rows, which the compiler vectorizes (at -O3): ex.
+  250x250 -> 32x32 takes ~0.2 ms, 1000x1000 -> 256x256 ~4 ms.
+**************************************************************************/
+
+static const unsigned BoxFilterWeightBits = 16;
+
+struct BoxFilterTaps
+{
+	unsigned firstSource = 0;
+	std::vector<uint32_t> weights; // (for firstSource, firstSource + 1, ...)
+};
+
+static std::vector<BoxFilterTaps> computeBoxFilterTaps(unsigned srcSize, unsigned dstSize)
+{
+	std::vector<BoxFilterTaps> taps(dstSize);
+	const uint64_t totalWeight = uint64_t(1) << BoxFilterWeightBits;
+	for (unsigned d = 0; d < dstSize; ++d)
+	{
+		// in units of 1 / dstSize of a source pixel, output pixel d covers [d * srcSize, (d + 1) * srcSize)
+		uint64_t start = static_cast<uint64_t>(d) * srcSize;
+		uint64_t end = start + srcSize;
+		unsigned firstSource = static_cast<unsigned>(start / dstSize);
+		unsigned endSource = static_cast<unsigned>((end + dstSize - 1) / dstSize);
+		BoxFilterTaps& outputTaps = taps[d];
+		outputTaps.firstSource = firstSource;
+		uint64_t weightSum = 0;
+		size_t largestTap = 0;
+		for (unsigned s = firstSource; s < endSource; ++s)
+		{
+			uint64_t coverage = std::min<uint64_t>(end, static_cast<uint64_t>(s + 1) * dstSize) - std::max<uint64_t>(start, static_cast<uint64_t>(s) * dstSize);
+			uint32_t weight = static_cast<uint32_t>((coverage * totalWeight) / srcSize);
+			if (!outputTaps.weights.empty() && weight > outputTaps.weights[largestTap])
+			{
+				largestTap = outputTaps.weights.size();
+			}
+			outputTaps.weights.push_back(weight);
+			weightSum += weight;
+		}
+		// (the rounding remainder goes to the source pixel with the most coverage)
+		outputTaps.weights[largestTap] += static_cast<uint32_t>(totalWeight - weightSum);
+	}
+	return taps;
+}
+
+void downscaleRGBBoxFilter(const uint8_t* src, unsigned srcWidth, unsigned srcHeight, uint8_t* dst, unsigned dstWidth, unsigned dstHeight)
+{
+	const unsigned channels = 3;
+	const std::vector<BoxFilterTaps> xTaps = computeBoxFilterTaps(srcWidth, dstWidth);
+	const std::vector<BoxFilterTaps> yTaps = computeBoxFilterTaps(srcHeight, dstHeight);
+	const size_t dstRowValues = static_cast<size_t>(dstWidth) * channels;
+
+	// 1. horizontal: each source row -> dstWidth pixels, as 8.8 fixed-point values
+	std::vector<uint16_t> columns(dstRowValues * srcHeight);
+	for (unsigned y = 0; y < srcHeight; ++y)
+	{
+		const uint8_t* srcRow = src + (static_cast<size_t>(y) * srcWidth * channels);
+		uint16_t* outRow = columns.data() + (dstRowValues * y);
+		for (unsigned x = 0; x < dstWidth; ++x)
+		{
+			const BoxFilterTaps& taps = xTaps[x];
+			const uint8_t* srcPixel = srcRow + (static_cast<size_t>(taps.firstSource) * channels);
+			uint32_t sums[channels] = {0, 0, 0};
+			for (size_t i = 0; i < taps.weights.size(); ++i, srcPixel += channels)
+			{
+				for (unsigned c = 0; c < channels; ++c)
+				{
+					sums[c] += taps.weights[i] * srcPixel[c];
+				}
+			}
+			for (unsigned c = 0; c < channels; ++c)
+			{
+				outRow[(x * channels) + c] = static_cast<uint16_t>((sums[c] + (1u << 7)) >> 8);
+			}
+		}
+	}
+
+	// 2. vertical: whole rows at a time
+	std::vector<uint32_t> sums(dstRowValues);
+	for (unsigned y = 0; y < dstHeight; ++y)
+	{
+		const BoxFilterTaps& taps = yTaps[y];
+		std::fill(sums.begin(), sums.end(), 0);
+		for (size_t i = 0; i < taps.weights.size(); ++i)
+		{
+			const uint32_t weight = taps.weights[i];
+			const uint16_t* columnRow = columns.data() + (dstRowValues * (taps.firstSource + i));
+			for (size_t v = 0; v < dstRowValues; ++v)
+			{
+				sums[v] += weight * columnRow[v];
+			}
+		}
+		uint8_t* dstRow = dst + (dstRowValues * y);
+		for (size_t v = 0; v < dstRowValues; ++v)
+		{
+			dstRow[v] = static_cast<uint8_t>((sums[v] + (1u << 23)) >> 24);
+		}
+	}
+}
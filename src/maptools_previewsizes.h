@@ -0,0 +1,91 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * Preview sizes (--sizes): several outputs derived from a single rendered preview (1 pixel per map tile)
+ *
+ * Each size is one of:
+ * - "Nx": the preview upscaled by N (ex. "2x" - "1x" is the preview as rendered)
+ * - "N": the preview fitted within N x N pixels (ex. "32" for an icon) - box-filter downscaled if the preview is
+ *   larger, otherwise upscaled by the largest integer factor that fits
+ * Upscales are always by an integer factor, and are done while encoding (see PngSaveOptions::scale).
+ */
+
+// The maximum upscale factor (of --scale, and "Nx" sizes)
+const unsigned MaxPreviewScale = 32;
+// The maximum "N" size
+const unsigned MaxPreviewSizeDimension = 16384;
+
+// The default output name template: output.png -> output-32.png, output-2x.png, ...
+const char* const DefaultPreviewSizeNameTemplate = "{stem}-{size}.png";
+
+struct MapToolsPreviewSize
+{
+	// as specified (used for {size} in output names)
+	std::string spec;
+	// for "Nx" sizes (otherwise 0)
+	unsigned scale = 0;
+	// for "N" sizes (otherwise 0)
+	unsigned maxDimension = 0;
+};
+
+struct MapToolsPreviewSizes
+{
+	// if empty, a single preview is output (as-is)
+	std::vector<MapToolsPreviewSize> sizes;
+	// the output filename of each size (placed in the directory of the output path): {stem} is replaced with the
+	// output path's filename (without extension), and {size} with the size (as specified)
+	std::string nameTemplate = DefaultPreviewSizeNameTemplate;
+};
+
+// How one size is derived from a w x h preview: a box-filter downscale to width x height (if downscaled), then an
+// upscale by scale
+struct MapToolsPreviewSizePlan
+{
+	bool downscaled = false;
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned scale = 1;
+
+	unsigned outputWidth() const { return width * scale; }
+	unsigned outputHeight() const { return height * scale; }
+};
+
+// Parses a comma-separated list of sizes (ex. "32,1x,2x,4x") - on failure, returns false and sets error
+bool parsePreviewSizes(const std::string& specs, std::vector<MapToolsPreviewSize>& sizes, std::string& error);
+// The (comma-separated) list of sizes, as specified
+std::string previewSizesToString(const std::vector<MapToolsPreviewSize>& sizes);
+// Returns an error if the output name template can't give each size a distinct filename (or isn't within the output directory)
+std::string validatePreviewSizeNameTemplate(const std::string& nameTemplate);
+
+MapToolsPreviewSizePlan planPreviewSize(const MapToolsPreviewSize& size, unsigned w, unsigned h);
+
+// The output path for one size, given the output path of the preview (ex. "out/map.png" -> "out/map-2x.png")
+std::string makePreviewSizeOutputPath(const std::string& outputPath, const std::string& nameTemplate, const MapToolsPreviewSize& size);
+
+// Downscales an RGB888 image with a box filter (each output pixel is the area-weighted average of the source pixels
+// it covers - so areas of flat color keep their exact color)
+void downscaleRGBBoxFilter(const uint8_t* src, unsigned srcWidth, unsigned srcHeight, uint8_t* dst, unsigned dstWidth, unsigned dstHeight);
@@ -0,0 +1,386 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_progress.h"
+#include "maptools_trace.h"
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <cstdio>
+#include <cerrno>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+namespace {
+
+// The counters are sampled this often (and the status line is updated this often, when stderr is a terminal)
+const std::chrono::milliseconds SampleInterval(250);
+const std::chrono::milliseconds StatusLineInterval_NotTerminal(5000);
+const std::chrono::milliseconds JSONInterval(1000);
+// Weight of the latest sample in the (exponentially-smoothed) throughput
+const double ThroughputSmoothing = 0.3;
+
+std::atomic<bool> progressEnabled(false);
+bool outputStatusLine = false;
+bool statusLineIsTerminal = false;
+int progressJsonFd = -1;
+
+std::atomic<uint64_t> numFound(0);
+std::atomic<uint64_t> bytesFound(0);
+std::atomic<bool> enumerationComplete(false);
+std::atomic<uint64_t> numStarted(0);
+std::atomic<uint64_t> numSucceeded(0);
+std::atomic<uint64_t> numFailed(0);
+std::atomic<uint64_t> numSkipped(0);
+std::atomic<uint64_t> bytesProcessed(0); // (of finished inputs)
+std::atomic<uint64_t> bytesSkipped(0);
+
+std::thread reporterThread;
+std::mutex reporterMutex;
+std::condition_variable reporterWake;
+bool reporterStopping = false;
+
+struct ProgressSample
+{
+	uint64_t found = 0;
+	uint64_t bytesTotal = 0;
+	bool enumerationComplete = false;
+	uint64_t succeeded = 0;
+	uint64_t failed = 0;
+	uint64_t skipped = 0;
+	uint64_t inFlight = 0;
+	uint64_t bytesDone = 0;
+	double elapsedSeconds = 0;
+	double mapsPerSecond = 0;
+	double bytesPerSecond = 0;
+	double etaSeconds = -1; // (unknown)
+};
+
+bool isTerminal(FILE* file)
+{
+#if defined(_WIN32)
+	return _isatty(_fileno(file)) != 0;
+#else
+	return isatty(fileno(file)) != 0;
+#endif
+}
+
+bool isValidFd(int fd)
+{
+#if defined(_WIN32)
+	return _get_osfhandle(fd) != -1;
+#else
+	return fcntl(fd, F_GETFD) != -1;
+#endif
+}
+
+void writeToFd(int fd, const std::string& data)
+{
+	size_t written = 0;
+	while (written < data.size())
+	{
+#if defined(_WIN32)
+		int result = _write(fd, data.data() + written, static_cast<unsigned int>(data.size() - written));
+#else
+		ssize_t result = write(fd, data.data() + written, data.size() - written);
+#endif
+		if (result < 0)
+		{
+			if (errno == EINTR) { continue; }
+			return;
+		}
+		written += static_cast<size_t>(result);
+	}
+}
+
+std::string formatDuration(double seconds)
+{
+	uint64_t totalSeconds = static_cast<uint64_t>(seconds + 0.5);
+	char buffer[32];
+	if (totalSeconds >= 3600)
+	{
+		snprintf(buffer, sizeof(buffer), "%lluh%02llum", static_cast<unsigned long long>(totalSeconds / 3600), static_cast<unsigned long long>((totalSeconds / 60) % 60));
+	}
+	else if (totalSeconds >= 60)
+	{
+		snprintf(buffer, sizeof(buffer), "%llum%02llus", static_cast<unsigned long long>(totalSeconds / 60), static_cast<unsigned long long>(totalSeconds % 60));
+	}
+	else
+	{
+		snprintf(buffer, sizeof(buffer), "%llus", static_cast<unsigned long long>(totalSeconds));
+	}
+	return buffer;
+}
+
+void outputStatusLineSample(const ProgressSample& sample, bool final)
+{
+	uint64_t done = sample.succeeded + sample.failed + sample.skipped;
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "%llu/%llu%s done (%llu failed), %llu in flight, %.1f maps/s, %.2f MiB/s",
+		static_cast<unsigned long long>(done), static_cast<unsigned long long>(sample.found), (sample.enumerationComplete) ? "" : "+",
+		static_cast<unsigned long long>(sample.failed), static_cast<unsigned long long>(sample.inFlight),
+		sample.mapsPerSecond, sample.bytesPerSecond / (1024.0 * 1024.0));
+	std::string line = "Progress: ";
+	line.append(buffer);
+	if (final)
+	{
+		line.append(", elapsed " + formatDuration(sample.elapsedSeconds));
+	}
+	else
+	{
+		line.append(", ETA " + ((sample.etaSeconds >= 0) ? formatDuration(sample.etaSeconds) : std::string((sample.enumerationComplete) ? "?" : "? (still finding inputs)")));
+	}
+	if (statusLineIsTerminal)
+	{
+		// (overwrite the previous status line)
+		fprintf(stderr, "\r%s\033[K%s", line.c_str(), (final) ? "\n" : "");
+	}
+	else
+	{
+		fprintf(stderr, "%s\n", line.c_str());
+	}
+	fflush(stderr);
+}
+
+void outputJSONSample(const ProgressSample& sample, bool final)
+{
+	nlohmann::ordered_json output = nlohmann::ordered_json::object();
+	output["found"] = sample.found;
+	output["enumeration_complete"] = sample.enumerationComplete;
+	output["completed"] = sample.succeeded;
+	output["failed"] = sample.failed;
+	output["skipped"] = sample.skipped;
+	output["in_flight"] = sample.inFlight;
+	output["bytes_done"] = sample.bytesDone;
+	output["bytes_total"] = sample.bytesTotal;
+	output["maps_per_sec"] = sample.mapsPerSecond;
+	output["bytes_per_sec"] = sample.bytesPerSecond;
+	output["eta_sec"] = (sample.etaSeconds >= 0) ? nlohmann::ordered_json(sample.etaSeconds) : nlohmann::ordered_json(nullptr);
+	output["elapsed_sec"] = sample.elapsedSeconds;
+	output["finished"] = final;
+	writeToFd(progressJsonFd, output.dump() + "\n");
+}
+
+void reporterMain()
+{
+	MapToolsTrace::setThreadName("progress reporter");
+	auto startTime = std::chrono::steady_clock::now();
+	auto lastSampleTime = startTime;
+	auto lastStatusLineTime = startTime;
+	auto lastJSONTime = startTime;
+	uint64_t lastFinished = 0;
+	uint64_t lastBytesProcessed = 0;
+	ProgressSample sample;
+	bool haveThroughput = false;
+	while (true)
+	{
+		bool final = false;
+		{
+			std::unique_lock<std::mutex> lock(reporterMutex);
+			reporterWake.wait_for(lock, SampleInterval, []() { return reporterStopping; });
+			final = reporterStopping;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		sample.found = numFound.load(std::memory_order_relaxed);
+		sample.bytesTotal = bytesFound.load(std::memory_order_relaxed);
+		sample.enumerationComplete = enumerationComplete.load(std::memory_order_relaxed);
+		sample.succeeded = numSucceeded.load(std::memory_order_relaxed);
+		sample.failed = numFailed.load(std::memory_order_relaxed);
+		sample.skipped = numSkipped.load(std::memory_order_relaxed);
+		uint64_t finished = sample.succeeded + sample.failed;
+		uint64_t started = numStarted.load(std::memory_order_relaxed);
+		sample.inFlight = (started > finished) ? started - finished : 0;
+		uint64_t processedBytes = bytesProcessed.load(std::memory_order_relaxed);
+		sample.bytesDone = processedBytes + bytesSkipped.load(std::memory_order_relaxed);
+		sample.elapsedSeconds = std::chrono::duration<double>(now - startTime).count();
+
+		// smoothed throughput (of processed inputs - skipped inputs are excluded)
+		double intervalSeconds = std::chrono::duration<double>(now - lastSampleTime).count();
+		if (final && sample.elapsedSeconds > 0)
+		{
+			// (the final update reports the average over the whole run)
+			sample.mapsPerSecond = static_cast<double>(finished) / sample.elapsedSeconds;
+			sample.bytesPerSecond = static_cast<double>(processedBytes) / sample.elapsedSeconds;
+		}
+		else if (intervalSeconds >= std::chrono::duration<double>(SampleInterval).count() / 2 && finished > 0)
+		{
+			double mapsPerSecond = static_cast<double>(finished - lastFinished) / intervalSeconds;
+			double bytesPerSecond = static_cast<double>(processedBytes - lastBytesProcessed) / intervalSeconds;
+			if (!haveThroughput)
+			{
+				// (the first sample since anything finished covers the whole run so far)
+				sample.mapsPerSecond = static_cast<double>(finished) / sample.elapsedSeconds;
+				sample.bytesPerSecond = static_cast<double>(processedBytes) / sample.elapsedSeconds;
+				haveThroughput = true;
+			}
+			else
+			{
+				sample.mapsPerSecond = (ThroughputSmoothing * mapsPerSecond) + ((1.0 - ThroughputSmoothing) * sample.mapsPerSecond);
+				sample.bytesPerSecond = (ThroughputSmoothing * bytesPerSecond) + ((1.0 - ThroughputSmoothing) * sample.bytesPerSecond);
+			}
+			lastFinished = finished;
+			lastBytesProcessed = processedBytes;
+			lastSampleTime = now;
+		}
+
+		// ETA (by bytes remaining - or, for inputs without a size (folders), by count)
+		sample.etaSeconds = -1;
+		if (sample.enumerationComplete)
+		{
+			uint64_t bytesRemaining = (sample.bytesTotal > sample.bytesDone) ? sample.bytesTotal - sample.bytesDone : 0;
+			uint64_t done = finished + sample.skipped;
+			uint64_t inputsRemaining = (sample.found > done) ? sample.found - done : 0;
+			if (inputsRemaining == 0)
+			{
+				sample.etaSeconds = 0;
+			}
+			else if (bytesRemaining > 0 && sample.bytesPerSecond > 0)
+			{
+				sample.etaSeconds = static_cast<double>(bytesRemaining) / sample.bytesPerSecond;
+			}
+			else if (sample.mapsPerSecond > 0)
+			{
+				sample.etaSeconds = static_cast<double>(inputsRemaining) / sample.mapsPerSecond;
+			}
+		}
+
+		if (outputStatusLine && (final || now - lastStatusLineTime >= ((statusLineIsTerminal) ? SampleInterval : StatusLineInterval_NotTerminal)))
+		{
+			outputStatusLineSample(sample, final);
+			lastStatusLineTime = now;
+		}
+		if (progressJsonFd >= 0 && (final || now - lastJSONTime >= JSONInterval))
+		{
+			outputJSONSample(sample, final);
+			lastJSONTime = now;
+		}
+		if (final)
+		{
+			break;
+		}
+	}
+}
+
+} // anonymous namespace
+
+bool MapToolsProgress::enable(bool statusLine, int jsonFd)
+{
+	if (jsonFd >= 0 && !isValidFd(jsonFd))
+	{
+		return false;
+	}
+	outputStatusLine = statusLine;
+	statusLineIsTerminal = statusLine && isTerminal(stderr);
+	progressJsonFd = jsonFd;
+	progressEnabled.store(statusLine || jsonFd >= 0, std::memory_order_relaxed);
+	return true;
+}
+
+bool MapToolsProgress::isEnabled()
+{
+	return progressEnabled.load(std::memory_order_relaxed);
+}
+
+void MapToolsProgress::start()
+{
+	if (!isEnabled() || reporterThread.joinable())
+	{
+		return;
+	}
+	reporterStopping = false;
+	reporterThread = std::thread(reporterMain);
+}
+
+void MapToolsProgress::stop()
+{
+	if (!reporterThread.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(reporterMutex);
+		reporterStopping = true;
+	}
+	reporterWake.notify_one();
+	reporterThread.join();
+}
+
+void MapToolsProgress::inputFound(uint64_t inputSize)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+	numFound.fetch_add(1, std::memory_order_relaxed);
+	bytesFound.fetch_add(inputSize, std::memory_order_relaxed);
+}
+
+void MapToolsProgress::enumerationFinished()
+{
+	enumerationComplete.store(true, std::memory_order_relaxed);
+}
+
+void MapToolsProgress::inputStarted()
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+	numStarted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MapToolsProgress::inputFinished(uint64_t inputSize, bool succeeded)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+	((succeeded) ? numSucceeded : numFailed).fetch_add(1, std::memory_order_relaxed);
+	bytesProcessed.fetch_add(inputSize, std::memory_order_relaxed);
+}
+
+void MapToolsProgress::inputSkipped(uint64_t inputSize)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+	numSkipped.fetch_add(1, std::memory_order_relaxed);
+	bytesSkipped.fetch_add(inputSize, std::memory_order_relaxed);
+}
+
+void MapToolsProgress::inputDiscarded(uint64_t inputSize)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+	numFound.fetch_sub(1, std::memory_order_relaxed);
+	bytesFound.fetch_sub(inputSize, std::memory_order_relaxed);
+}
@@ -0,0 +1,52 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Live progress reporting for batch runs (--progress, --progress-fd)
+ *
+ * Worker threads only update atomic counters - a single reporter thread samples them, and outputs a (throttled)
+ * status line to stderr and / or a JSON line to a file descriptor. The ETA is based on the bytes remaining
+ * (of the inputs found so far) and the recent throughput, so it isn't thrown off by a mix of small + large maps.
+ */
+namespace MapToolsProgress {
+
+// statusLine: output a status line to stderr; jsonFd: if >= 0, output JSON progress lines to this file descriptor
+bool enable(bool statusLine, int jsonFd);
+bool isEnabled();
+
+// Starts / stops the reporter thread (stop outputs a final update)
+void start();
+void stop();
+
+// (all thread-safe)
+void inputFound(uint64_t inputSize);
+void enumerationFinished();
+void inputStarted();
+void inputFinished(uint64_t inputSize, bool succeeded);
+// An input that was found, but won't be processed (ex. already completed, according to the journal)
+void inputSkipped(uint64_t inputSize);
+// An input that was found, but turned out not to be part of the run (ex. not in the shard)
+void inputDiscarded(uint64_t inputSize);
+
+} // namespace MapToolsProgress
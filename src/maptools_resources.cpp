@@ -0,0 +1,368 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_resources.h"
+#include "maptools_timings.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// The estimated memory usage of a map = a fixed overhead + a multiple of its uncompressed contents
+// (the JSON map formats are parsed into a DOM, which takes several times the size of the text)
+static const uint64_t MapMemoryBaseEstimate = 16 * 1024 * 1024;
+static const uint64_t MapMemoryPerUncompressedByte = 8;
+// (if an archive's uncompressed size can't be read, it is assumed to have compressed to this fraction of its size)
+static const uint64_t MapArchiveAssumedCompressionRatio = 4;
+// Only this much of the memory still available is budgeted for maps (the rest is left for everything else)
+static const uint64_t AvailableMemoryBudgetPercent = 90;
+
+static const char* CgroupMountPath = "/sys/fs/cgroup";
+
+#if defined(__linux__)
+
+static bool readFirstLine(const fs::path& path, std::string& line)
+{
+	std::ifstream file(path);
+	return file.is_open() && std::getline(file, line) && !line.empty();
+}
+
+// Returns the (cgroup v2) directory of this process' cgroup, and of each of its ancestors (innermost first)
+static std::vector<fs::path> cgroupHierarchy()
+{
+	std::vector<fs::path> result;
+	std::ifstream cgroupFile("/proc/self/cgroup");
+	std::string line;
+	std::string cgroupPath;
+	bool foundUnified = false;
+	while (std::getline(cgroupFile, line))
+	{
+		// the unified (v2) hierarchy is listed as "0::<path>"
+		if (line.compare(0, 3, "0::") == 0)
+		{
+			cgroupPath = line.substr(3);
+			foundUnified = true;
+			break;
+		}
+	}
+	if (!foundUnified)
+	{
+		return result;
+	}
+	std::error_code ec;
+	fs::path mountPath(CgroupMountPath);
+	fs::path cgroupDir = mountPath / fs::path(cgroupPath).relative_path();
+	if (!fs::is_directory(cgroupDir, ec))
+	{
+		// (ex. in a container without its own cgroup namespace, only its own cgroup is mounted)
+		cgroupDir = mountPath;
+	}
+	while (true)
+	{
+		result.push_back(cgroupDir);
+		if (cgroupDir == mountPath || !cgroupDir.has_relative_path())
+		{
+			break;
+		}
+		cgroupDir = cgroupDir.parent_path();
+	}
+	return result;
+}
+
+// Parses cpu.max ("<quota> <period>", or "max <period>") - returns the CPU limit, or 0 if there is none
+static double readCgroupCPULimit(const fs::path& cgroupDir)
+{
+	std::string line;
+	if (!readFirstLine(cgroupDir / "cpu.max", line))
+	{
+		return 0;
+	}
+	std::istringstream values(line);
+	std::string quota;
+	double period = 0;
+	if (!(values >> quota >> period) || quota == "max" || period <= 0)
+	{
+		return 0;
+	}
+	try
+	{
+		return std::max(std::stod(quota), 0.0) / period;
+	}
+	catch (const std::exception&)
+	{
+		return 0;
+	}
+}
+
+// Reads a memory value (ex. memory.max) - returns false if it is "max" (or can't be read)
+static bool readCgroupMemoryValue(const fs::path& path, uint64_t& value)
+{
+	std::string line;
+	if (!readFirstLine(path, line) || line == "max")
+	{
+		return false;
+	}
+	try
+	{
+		value = std::stoull(line);
+		return true;
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+}
+
+static unsigned affinityCPUs()
+{
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) != 0)
+	{
+		return 0;
+	}
+	return static_cast<unsigned>(CPU_COUNT(&cpuSet));
+}
+
+#endif // defined(__linux__)
+
+unsigned MapToolsResources::availableCPUs()
+{
+	unsigned numCPUs = std::thread::hardware_concurrency();
+#if defined(__linux__)
+	unsigned numAffinityCPUs = affinityCPUs();
+	if (numAffinityCPUs > 0)
+	{
+		numCPUs = (numCPUs > 0) ? std::min(numCPUs, numAffinityCPUs) : numAffinityCPUs;
+	}
+	for (const auto& cgroupDir : cgroupHierarchy())
+	{
+		double cpuLimit = readCgroupCPULimit(cgroupDir);
+		if (cpuLimit > 0)
+		{
+			// (a fractional quota, ex. 1.5 CPUs, can still keep 2 workers partly busy)
+			unsigned quotaCPUs = static_cast<unsigned>(std::min<double>(std::ceil(cpuLimit), std::numeric_limits<unsigned>::max()));
+			numCPUs = (numCPUs > 0) ? std::min(numCPUs, quotaCPUs) : quotaCPUs;
+		}
+	}
+#endif
+	return std::max(numCPUs, 1u);
+}
+
+uint64_t MapToolsResources::availableMemory()
+{
+	uint64_t result = 0;
+#if defined(__linux__)
+	for (const auto& cgroupDir : cgroupHierarchy())
+	{
+		uint64_t memoryLimit = 0;
+		if (!readCgroupMemoryValue(cgroupDir / "memory.max", memoryLimit))
+		{
+			continue;
+		}
+		uint64_t memoryUsed = 0;
+		readCgroupMemoryValue(cgroupDir / "memory.current", memoryUsed);
+		uint64_t memoryAvailable = (memoryLimit > memoryUsed) ? memoryLimit - memoryUsed : 0;
+		result = (result > 0) ? std::min(result, memoryAvailable) : std::max<uint64_t>(memoryAvailable, 1);
+	}
+#endif
+	return result;
+}
+
+uint64_t MapToolsResources::mapMemoryBudget()
+{
+	return availableMemory() / 100 * AvailableMemoryBudgetPercent;
+}
+
+static uint32_t readLE32(const unsigned char* data)
+{
+	return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static uint16_t readLE16(const unsigned char* data)
+{
+	return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+// Sums the uncompressed sizes of the entries in a zip archive's central directory
+// (only reads the end of the archive - returns false for zip64 archives, or if the archive can't be read)
+static bool readZipUncompressedSize(const std::string& archivePath, uint64_t archiveSize, uint64_t& uncompressedSize)
+{
+	const size_t EndRecordSize = 22;
+	const size_t MaxCommentSize = 0xFFFF;
+	const size_t CentralHeaderSize = 46;
+	const uint64_t MaxCentralDirectorySize = 64 * 1024 * 1024;
+	if (archiveSize < EndRecordSize)
+	{
+		return false;
+	}
+	std::ifstream archive(archivePath, std::ios::binary);
+	if (!archive.is_open())
+	{
+		return false;
+	}
+
+	// find the end of central directory record (followed by an optional comment)
+	size_t tailSize = static_cast<size_t>(std::min<uint64_t>(archiveSize, EndRecordSize + MaxCommentSize));
+	std::vector<unsigned char> tail(tailSize);
+	archive.seekg(static_cast<std::streamoff>(archiveSize - tailSize));
+	if (!archive.read(reinterpret_cast<char*>(tail.data()), static_cast<std::streamsize>(tailSize)))
+	{
+		return false;
+	}
+	size_t endRecordPos = tailSize - EndRecordSize;
+	while (readLE32(&tail[endRecordPos]) != 0x06054b50)
+	{
+		if (endRecordPos == 0)
+		{
+			return false;
+		}
+		--endRecordPos;
+	}
+	const unsigned char* endRecord = &tail[endRecordPos];
+	uint16_t numEntries = readLE16(endRecord + 10);
+	uint32_t centralDirectorySize = readLE32(endRecord + 12);
+	uint32_t centralDirectoryOffset = readLE32(endRecord + 16);
+	if (numEntries == 0xFFFF || centralDirectorySize == 0xFFFFFFFF || centralDirectoryOffset == 0xFFFFFFFF
+		|| centralDirectorySize > MaxCentralDirectorySize || static_cast<uint64_t>(centralDirectoryOffset) + centralDirectorySize > archiveSize)
+	{
+		return false;
+	}
+
+	std::vector<unsigned char> centralDirectory(centralDirectorySize);
+	archive.seekg(static_cast<std::streamoff>(centralDirectoryOffset));
+	if (!archive.read(reinterpret_cast<char*>(centralDirectory.data()), static_cast<std::streamsize>(centralDirectorySize)))
+	{
+		return false;
+	}
+	uint64_t total = 0;
+	size_t pos = 0;
+	for (uint16_t i = 0; i < numEntries; ++i)
+	{
+		if (pos + CentralHeaderSize > centralDirectory.size() || readLE32(&centralDirectory[pos]) != 0x02014b50)
+		{
+			return false;
+		}
+		const unsigned char* header = &centralDirectory[pos];
+		uint32_t entryUncompressedSize = readLE32(header + 24);
+		if (entryUncompressedSize == 0xFFFFFFFF)
+		{
+			return false;
+		}
+		total += entryUncompressedSize;
+		pos += CentralHeaderSize + readLE16(header + 28) + readLE16(header + 30) + readLE16(header + 32);
+	}
+	uncompressedSize = total;
+	return true;
+}
+
+uint64_t MapToolsResources::estimateMapMemoryUsage(const std::string& inputPath)
+{
+	std::error_code ec;
+	uint64_t contentsSize = 0;
+	if (fs::is_directory(inputPath, ec))
+	{
+		// an extracted package
+		for (auto it = fs::recursive_directory_iterator(inputPath, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+		{
+			std::error_code entryEc;
+			if (it->is_regular_file(entryEc))
+			{
+				uintmax_t fileSize = it->file_size(entryEc);
+				contentsSize += (entryEc) ? 0 : static_cast<uint64_t>(fileSize);
+			}
+		}
+	}
+	else
+	{
+		uintmax_t archiveSize = fs::file_size(inputPath, ec);
+		if (!ec && !readZipUncompressedSize(inputPath, static_cast<uint64_t>(archiveSize), contentsSize))
+		{
+			contentsSize = static_cast<uint64_t>(archiveSize) * MapArchiveAssumedCompressionRatio;
+		}
+	}
+	uint64_t maxContentsSize = (std::numeric_limits<uint64_t>::max() - MapMemoryBaseEstimate) / MapMemoryPerUncompressedByte;
+	return MapMemoryBaseEstimate + std::min(contentsSize, maxContentsSize) * MapMemoryPerUncompressedByte;
+}
+
+MapToolsMemoryBudget::MapToolsMemoryBudget(uint64_t limit)
+: memoryLimit(std::max<uint64_t>(limit, 1))
+{ }
+
+uint64_t MapToolsMemoryBudget::reserve(uint64_t amount)
+{
+	// (a single map larger than the whole budget waits until nothing else is reserved, then reserves all of it)
+	amount = std::min(amount, memoryLimit);
+	std::unique_lock<std::mutex> lock(reservedMutex);
+	uint64_t ticket = nextTicket++;
+	auto canReserve = [this, amount, ticket]() { return ticket == nextServedTicket && memoryReserved + amount <= memoryLimit; };
+	if (!canReserve())
+	{
+		MapToolsScopedPhase waitPhase("memory wait");
+		memoryReleased.wait(lock, canReserve);
+	}
+	memoryReserved += amount;
+	++nextServedTicket;
+	lock.unlock();
+	// (the next ticket may fit in what's left)
+	memoryReleased.notify_all();
+	return amount;
+}
+
+void MapToolsMemoryBudget::release(uint64_t reserved)
+{
+	{
+		std::lock_guard<std::mutex> lock(reservedMutex);
+		memoryReserved -= std::min(reserved, memoryReserved);
+	}
+	memoryReleased.notify_all();
+}
+
+MapToolsMemoryReservation::MapToolsMemoryReservation(MapToolsMemoryBudget* pBudget, const std::string& inputPath)
+: pBudget(pBudget)
+{
+	if (pBudget)
+	{
+		reserved = pBudget->reserve(MapToolsResources::estimateMapMemoryUsage(inputPath));
+	}
+}
+
+MapToolsMemoryReservation::~MapToolsMemoryReservation()
+{
+	release();
+}
+
+void MapToolsMemoryReservation::release()
+{
+	if (pBudget)
+	{
+		pBudget->release(reserved);
+		pBudget = nullptr;
+	}
+}
@@ -0,0 +1,96 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * The CPU + memory available to this process - used to size the worker pool when --jobs is auto (0)
+ *
+ * In a container, std::thread::hardware_concurrency() reports the host's CPUs - so the CPU quota (cpu.max) and
+ * memory limit (memory.max) of this process' cgroup (v2), and of each of its ancestors, are applied as well.
+ */
+namespace MapToolsResources {
+
+// The number of CPUs this process may use: the CPUs it may run on, limited by the cgroup CPU quota (rounded up)
+unsigned availableCPUs();
+
+// The memory this process may still use, before reaching the cgroup memory limit (0 if there is no limit)
+uint64_t availableMemory();
+// The memory to budget for the maps being processed at once (most of availableMemory() - 0 if there is no limit)
+uint64_t mapMemoryBudget();
+
+// Estimates the peak memory used to load + process a map package - from the uncompressed size of an archive's
+// contents (read from its zip central directory), or the total size of an extracted package's files
+uint64_t estimateMapMemoryUsage(const std::string& inputPath);
+
+} // namespace MapToolsResources
+
+// Limits the maps processed at once, so the sum of their estimated memory usage stays within a limit
+// (a map whose estimate alone exceeds the limit is still processed - once nothing else is)
+// Reservations are granted in the order they were requested, so a large map isn't starved by a stream of smaller ones
+class MapToolsMemoryBudget
+{
+public:
+	explicit MapToolsMemoryBudget(uint64_t limit);
+
+	MapToolsMemoryBudget(const MapToolsMemoryBudget&) = delete;
+	MapToolsMemoryBudget& operator=(const MapToolsMemoryBudget&) = delete;
+
+public:
+	// Blocks until amount fits within the limit (and every earlier reservation has been granted) - returns the amount
+	// actually reserved (to pass to release)
+	uint64_t reserve(uint64_t amount);
+	void release(uint64_t reserved);
+
+	uint64_t limit() const { return memoryLimit; }
+
+private:
+	uint64_t memoryLimit;
+	uint64_t memoryReserved = 0;
+	// (each reserve() call takes a ticket - and waits until it is the next to be served)
+	uint64_t nextTicket = 0;
+	uint64_t nextServedTicket = 0;
+	std::mutex reservedMutex;
+	std::condition_variable memoryReleased;
+};
+
+// Reserves an input's estimated memory usage for the lifetime of this object (a null budget reserves nothing)
+class MapToolsMemoryReservation
+{
+public:
+	MapToolsMemoryReservation(MapToolsMemoryBudget* pBudget, const std::string& inputPath);
+	~MapToolsMemoryReservation();
+
+	MapToolsMemoryReservation(const MapToolsMemoryReservation&) = delete;
+	MapToolsMemoryReservation& operator=(const MapToolsMemoryReservation&) = delete;
+
+public:
+	// Releases the reservation early (ex. once the map has been processed, before waiting to output the result)
+	void release();
+
+private:
+	MapToolsMemoryBudget* pBudget;
+	uint64_t reserved = 0;
+};
@@ -0,0 +1,265 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_stats.h"
+#include "maptools_timings.h"
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Values below this are recorded exactly - above it, each power-of-2 range is split into LinearSubBuckets buckets
+static const size_t ExactBuckets = 128;
+static const size_t LinearSubBuckets = 64;
+static const size_t NumHistogramBuckets = ExactBuckets + (56 * LinearSubBuckets); // (enough for any uint64_t)
+
+static unsigned highestBitSet(uint64_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index = 0;
+	_BitScanReverse64(&index, value);
+	return static_cast<unsigned>(index);
+#else
+	return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+}
+
+MapToolsLatencyHistogram::MapToolsLatencyHistogram()
+: counts(NumHistogramBuckets, 0)
+{ }
+
+size_t MapToolsLatencyHistogram::bucketIndex(uint64_t value)
+{
+	if (value < ExactBuckets)
+	{
+		return static_cast<size_t>(value);
+	}
+	// (value >> shift) is in [LinearSubBuckets, 2 * LinearSubBuckets)
+	unsigned shift = highestBitSet(value) - 6;
+	return ExactBuckets + ((shift - 1) * LinearSubBuckets) + static_cast<size_t>((value >> shift) - LinearSubBuckets);
+}
+
+uint64_t MapToolsLatencyHistogram::bucketUpperBound(size_t index)
+{
+	if (index < ExactBuckets)
+	{
+		return index;
+	}
+	unsigned shift = static_cast<unsigned>((index - ExactBuckets) / LinearSubBuckets) + 1;
+	uint64_t subBucket = ((index - ExactBuckets) % LinearSubBuckets) + LinearSubBuckets;
+	return ((subBucket + 1) << shift) - 1;
+}
+
+void MapToolsLatencyHistogram::record(std::chrono::steady_clock::duration duration)
+{
+	int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	uint64_t value = (nanoseconds > 0) ? static_cast<uint64_t>(nanoseconds) : 0;
+	++counts[bucketIndex(value)];
+	++totalCount;
+	maxValue = std::max(maxValue, value);
+}
+
+std::chrono::nanoseconds MapToolsLatencyHistogram::percentile(double percentile) const
+{
+	if (totalCount == 0)
+	{
+		return std::chrono::nanoseconds(0);
+	}
+	uint64_t targetCount = static_cast<uint64_t>(std::ceil((percentile / 100.0) * static_cast<double>(totalCount)));
+	targetCount = std::min(std::max<uint64_t>(targetCount, 1), totalCount);
+	uint64_t cumulativeCount = 0;
+	for (size_t i = 0; i < counts.size(); ++i)
+	{
+		cumulativeCount += counts[i];
+		if (cumulativeCount >= targetCount)
+		{
+			return std::chrono::nanoseconds(static_cast<int64_t>(std::min(bucketUpperBound(i), maxValue)));
+		}
+	}
+	return std::chrono::nanoseconds(static_cast<int64_t>(maxValue));
+}
+
+namespace {
+
+const size_t NumSlowestInputs = 10;
+
+struct InputLatency
+{
+	std::string inputPath;
+	uint64_t inputSize;
+	std::chrono::steady_clock::duration duration;
+};
+
+std::atomic<bool> statsEnabled(false);
+std::chrono::steady_clock::time_point statsStartTime;
+std::mutex statsMutex;
+MapToolsLatencyHistogram inputLatencies;
+uint64_t numFailedInputs = 0;
+uint64_t totalInputBytes = 0;
+std::vector<InputLatency> slowestInputs; // (slowest first)
+
+double toMilliseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+double toSeconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double>(duration).count();
+}
+
+// Calls func for the per-map latencies, then each phase's latencies
+void forEachLatencyHistogram(const std::function<void (const char* name, const MapToolsLatencyHistogram& histogram)>& func)
+{
+	func("map", inputLatencies);
+	MapToolsTimings::forEachPhase(func);
+}
+
+} // anonymous namespace
+
+void MapToolsStats::enable()
+{
+	statsStartTime = std::chrono::steady_clock::now();
+	statsEnabled.store(true, std::memory_order_relaxed);
+	// (the per-phase latencies are recorded by the timings)
+	MapToolsTimings::enable();
+}
+
+bool MapToolsStats::isEnabled()
+{
+	return statsEnabled.load(std::memory_order_relaxed);
+}
+
+void MapToolsStats::recordInput(const std::string& inputPath, uint64_t inputSize, std::chrono::steady_clock::duration duration, bool succeeded)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(statsMutex);
+	inputLatencies.record(duration);
+	totalInputBytes += inputSize;
+	if (!succeeded)
+	{
+		++numFailedInputs;
+	}
+	if (slowestInputs.size() < NumSlowestInputs || duration > slowestInputs.back().duration)
+	{
+		auto it = std::upper_bound(slowestInputs.begin(), slowestInputs.end(), duration, [](std::chrono::steady_clock::duration value, const InputLatency& input) {
+			return value > input.duration;
+		});
+		slowestInputs.insert(it, InputLatency{inputPath, inputSize, duration});
+		if (slowestInputs.size() > NumSlowestInputs)
+		{
+			slowestInputs.pop_back();
+		}
+	}
+}
+
+void MapToolsStats::printSummary(std::ostream& os)
+{
+	auto elapsed = std::chrono::steady_clock::now() - statsStartTime;
+	std::lock_guard<std::mutex> lock(statsMutex);
+	double elapsedSeconds = toSeconds(elapsed);
+
+	std::ios_base::fmtflags originalFlags = os.flags();
+	os << std::fixed << std::setprecision(3);
+	os << "Stats:" << std::endl;
+	os << "  inputs: " << inputLatencies.count() << " (" << numFailedInputs << " failed), " << (static_cast<double>(totalInputBytes) / (1024.0 * 1024.0)) << " MiB in " << elapsedSeconds << " s" << std::endl;
+	if (elapsedSeconds > 0)
+	{
+		os << "  throughput: " << (static_cast<double>(inputLatencies.count()) / elapsedSeconds) << " maps/s, "
+			<< (static_cast<double>(totalInputBytes) / (1024.0 * 1024.0) / elapsedSeconds) << " MiB/s" << std::endl;
+	}
+
+	os << "  " << std::left << std::setw(16) << "latency (ms)" << std::right
+		<< std::setw(8) << "count" << std::setw(11) << "p50" << std::setw(11) << "p90" << std::setw(11) << "p99" << std::setw(11) << "max" << std::endl;
+	forEachLatencyHistogram([&os](const char* name, const MapToolsLatencyHistogram& histogram) {
+		os << "  " << std::left << std::setw(16) << name << std::right
+			<< std::setw(8) << histogram.count()
+			<< std::setw(11) << toMilliseconds(histogram.percentile(50))
+			<< std::setw(11) << toMilliseconds(histogram.percentile(90))
+			<< std::setw(11) << toMilliseconds(histogram.percentile(99))
+			<< std::setw(11) << toMilliseconds(histogram.max()) << std::endl;
+	});
+
+	if (!slowestInputs.empty())
+	{
+		os << "  slowest inputs:" << std::endl;
+		for (const auto& input : slowestInputs)
+		{
+			os << "  " << std::setw(14) << toMilliseconds(input.duration) << " ms  " << input.inputPath << std::endl;
+		}
+	}
+	os.flags(originalFlags);
+}
+
+bool MapToolsStats::writeJSON(const std::string& outputPath)
+{
+	auto elapsed = std::chrono::steady_clock::now() - statsStartTime;
+	std::lock_guard<std::mutex> lock(statsMutex);
+	double elapsedSeconds = toSeconds(elapsed);
+
+	nlohmann::ordered_json output = nlohmann::ordered_json::object();
+	output["elapsed_ms"] = toMilliseconds(elapsed);
+	output["inputs"] = inputLatencies.count();
+	output["failed"] = numFailedInputs;
+	output["bytes"] = totalInputBytes;
+	output["maps_per_sec"] = (elapsedSeconds > 0) ? static_cast<double>(inputLatencies.count()) / elapsedSeconds : 0.0;
+	output["bytes_per_sec"] = (elapsedSeconds > 0) ? static_cast<double>(totalInputBytes) / elapsedSeconds : 0.0;
+	nlohmann::ordered_json latencies = nlohmann::ordered_json::array();
+	forEachLatencyHistogram([&latencies](const char* name, const MapToolsLatencyHistogram& histogram) {
+		nlohmann::ordered_json latency = nlohmann::ordered_json::object();
+		latency["name"] = name;
+		latency["count"] = histogram.count();
+		latency["p50_ms"] = toMilliseconds(histogram.percentile(50));
+		latency["p90_ms"] = toMilliseconds(histogram.percentile(90));
+		latency["p99_ms"] = toMilliseconds(histogram.percentile(99));
+		latency["max_ms"] = toMilliseconds(histogram.max());
+		latencies.push_back(std::move(latency));
+	});
+	output["latency"] = std::move(latencies);
+	nlohmann::ordered_json slowest = nlohmann::ordered_json::array();
+	for (const auto& input : slowestInputs)
+	{
+		nlohmann::ordered_json entry = nlohmann::ordered_json::object();
+		entry["input"] = input.inputPath;
+		entry["ms"] = toMilliseconds(input.duration);
+		entry["bytes"] = input.inputSize;
+		slowest.push_back(std::move(entry));
+	}
+	output["slowest"] = std::move(slowest);
+
+	std::ofstream outputFile(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+	outputFile << output.dump(4, ' ', false, nlohmann::ordered_json::error_handler_t::replace) << std::endl;
+	if (!outputFile.good())
+	{
+		std::cerr << "Failed to write stats JSON to: " << outputPath << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,74 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+/*
+ * A latency histogram with log-linear buckets (in the style of HdrHistogram): each power-of-2 range is split
+ * into 64 linear sub-buckets, so any recorded value (from 1 ns up) is reported to within ~1.5%, in constant
+ * memory, with O(1) recording.
+ */
+class MapToolsLatencyHistogram
+{
+public:
+	MapToolsLatencyHistogram();
+
+	void record(std::chrono::steady_clock::duration duration);
+
+	uint64_t count() const { return totalCount; }
+	std::chrono::nanoseconds max() const { return std::chrono::nanoseconds(maxValue); }
+	// The value that percentile % of the recorded values are <= to (ex. 99.0 for p99)
+	std::chrono::nanoseconds percentile(double percentile) const;
+
+private:
+	static size_t bucketIndex(uint64_t value);
+	static uint64_t bucketUpperBound(size_t index);
+
+private:
+	std::vector<uint64_t> counts;
+	uint64_t totalCount = 0;
+	uint64_t maxValue = 0;
+};
+
+/*
+ * Throughput + latency statistics for batch / serve runs (--stats, --stats-json)
+ *
+ * Each processed input (or serve request) is recorded with its size and end-to-end latency. The per-phase
+ * latencies are recorded by MapToolsTimings (which --stats enables).
+ */
+namespace MapToolsStats {
+
+void enable();
+bool isEnabled();
+
+// Records a processed input (thread-safe)
+void recordInput(const std::string& inputPath, uint64_t inputSize, std::chrono::steady_clock::duration duration, bool succeeded);
+
+// Outputs a summary: maps/sec, bytes/sec, latency percentiles (per map, and per phase), and the slowest inputs
+void printSummary(std::ostream& os);
+bool writeJSON(const std::string& outputPath);
+
+} // namespace MapToolsStats
@@ -0,0 +1,402 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_subprocess.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#if !defined(_WIN32)
+#include <spawn.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+extern char **environ;
+#endif
+
+static std::string executablePath;
+
+bool MapToolsSubprocess::isSupported()
+{
+#if !defined(_WIN32)
+	return true;
+#else
+	return false;
+#endif
+}
+
+void MapToolsSubprocess::setExecutablePath(const std::string& argv0)
+{
+	executablePath = argv0;
+}
+
+#if !defined(_WIN32)
+
+// Pipes + spawning are serialized, so a child never inherits the (not-yet-close-on-exec) pipe fds meant for another child
+static std::mutex spawnMutex;
+
+static bool createCloseOnExecPipe(int fds[2])
+{
+	if (pipe(fds) != 0)
+	{
+		return false;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return true;
+}
+
+bool MapToolsSubprocessWorker::start()
+{
+	if (isRunning())
+	{
+		return true;
+	}
+	static std::once_flag ignoreSigPipe;
+	std::call_once(ignoreSigPipe, []() {
+		// writing to a child that has exited should fail with EPIPE, not kill this process
+		signal(SIGPIPE, SIG_IGN);
+	});
+
+	std::lock_guard<std::mutex> lock(spawnMutex);
+	int requestPipe[2];
+	int responsePipe[2];
+	if (!createCloseOnExecPipe(requestPipe))
+	{
+		return false;
+	}
+	if (!createCloseOnExecPipe(responsePipe))
+	{
+		close(requestPipe[0]);
+		close(requestPipe[1]);
+		return false;
+	}
+
+	posix_spawn_file_actions_t fileActions;
+	posix_spawn_file_actions_init(&fileActions);
+	posix_spawn_file_actions_adddup2(&fileActions, requestPipe[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&fileActions, responsePipe[1], STDOUT_FILENO);
+
+#if defined(__linux__)
+	std::string childExecutable = "/proc/self/exe";
+#else
+	std::string childExecutable = (executablePath.empty()) ? "maptools" : executablePath;
+#endif
+	std::string argv0 = (executablePath.empty()) ? "maptools" : executablePath;
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(argv0.c_str()));
+	for (const auto& argument : childArguments)
+	{
+		argv.push_back(const_cast<char*>(argument.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	pid_t pid = -1;
+	int spawnResult = posix_spawnp(&pid, childExecutable.c_str(), &fileActions, nullptr, argv.data(), environ);
+	posix_spawn_file_actions_destroy(&fileActions);
+	close(requestPipe[0]);
+	close(responsePipe[1]);
+	if (spawnResult != 0)
+	{
+		std::cerr << "Failed to start child process: " << childExecutable << " (" << strerror(spawnResult) << ")" << std::endl;
+		close(requestPipe[1]);
+		close(responsePipe[0]);
+		return false;
+	}
+
+	childPid = pid;
+	toChild = requestPipe[1];
+	fromChild = responsePipe[0];
+	readBuffer.clear();
+	return true;
+}
+
+// (a fixed table, as strsignal isn't thread-safe - and workers are stopped from the threads that send requests)
+static const char* signalName(int sig)
+{
+	switch (sig)
+	{
+		case SIGHUP: return "SIGHUP";
+		case SIGINT: return "SIGINT";
+		case SIGQUIT: return "SIGQUIT";
+		case SIGILL: return "SIGILL";
+		case SIGTRAP: return "SIGTRAP";
+		case SIGABRT: return "SIGABRT";
+		case SIGBUS: return "SIGBUS";
+		case SIGFPE: return "SIGFPE";
+		case SIGKILL: return "SIGKILL";
+		case SIGSEGV: return "SIGSEGV";
+		case SIGPIPE: return "SIGPIPE";
+		case SIGALRM: return "SIGALRM";
+		case SIGTERM: return "SIGTERM";
+		case SIGXCPU: return "SIGXCPU";
+		case SIGXFSZ: return "SIGXFSZ";
+		case SIGSYS: return "SIGSYS";
+	}
+	return nullptr;
+}
+
+void MapToolsSubprocessWorker::stop(bool kill)
+{
+	if (childPid < 0)
+	{
+		return;
+	}
+	if (kill)
+	{
+		::kill(static_cast<pid_t>(childPid), SIGKILL);
+	}
+	// (closing stdin makes an idle child exit)
+	close(toChild);
+	close(fromChild);
+	int status = 0;
+	while (waitpid(static_cast<pid_t>(childPid), &status, 0) < 0 && errno == EINTR) { }
+	if (WIFSIGNALED(status))
+	{
+		const char* name = signalName(WTERMSIG(status));
+		exitReason = "killed by signal " + ((name) ? std::string(name) : std::to_string(WTERMSIG(status)));
+	}
+	else if (WIFEXITED(status))
+	{
+		exitReason = "exited with status " + std::to_string(WEXITSTATUS(status));
+	}
+	childPid = -1;
+	toChild = -1;
+	fromChild = -1;
+	readBuffer.clear();
+}
+
+static bool writeAll(int fd, const std::string& data)
+{
+	size_t written = 0;
+	while (written < data.size())
+	{
+		ssize_t result = write(fd, data.data() + written, data.size() - written);
+		if (result < 0)
+		{
+			if (errno == EINTR) { continue; }
+			return false;
+		}
+		written += static_cast<size_t>(result);
+	}
+	return true;
+}
+
+MapToolsSubprocessWorker::Result MapToolsSubprocessWorker::request(const std::string& requestLine, std::chrono::milliseconds timeout, std::string& responseLine)
+{
+	if (!start())
+	{
+		return Result::StartFailed;
+	}
+	if (!writeAll(toChild, requestLine + "\n"))
+	{
+		// the (idle) child has gone away since its last request - so replace it, and retry once
+		stop(true);
+		if (!start() || !writeAll(toChild, requestLine + "\n"))
+		{
+			stop(true);
+			return Result::StartFailed;
+		}
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (true)
+	{
+		size_t newline = readBuffer.find('\n');
+		if (newline != std::string::npos)
+		{
+			responseLine = readBuffer.substr(0, newline);
+			readBuffer.erase(0, newline + 1);
+			return Result::OK;
+		}
+
+		int pollTimeout = -1;
+		if (timeout.count() > 0)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (remaining <= 0)
+			{
+				stop(true);
+				return Result::TimedOut;
+			}
+			pollTimeout = static_cast<int>(std::min<long long>(remaining, std::numeric_limits<int>::max()));
+		}
+		struct pollfd pfd = {fromChild, POLLIN, 0};
+		int pollResult = poll(&pfd, 1, pollTimeout);
+		if (pollResult < 0)
+		{
+			if (errno == EINTR) { continue; }
+			stop(true);
+			return Result::Exited;
+		}
+		if (pollResult == 0)
+		{
+			continue; // (the deadline is checked above)
+		}
+		char buffer[65536];
+		ssize_t bytesRead = read(fromChild, buffer, sizeof(buffer));
+		if (bytesRead < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (bytesRead <= 0)
+		{
+			// the child exited (or crashed)
+			stop(true);
+			return Result::Exited;
+		}
+		readBuffer.append(buffer, static_cast<size_t>(bytesRead));
+	}
+}
+
+#else // defined(_WIN32)
+
+bool MapToolsSubprocessWorker::start()
+{
+	std::cerr << "Child processes are not supported on this platform" << std::endl;
+	return false;
+}
+
+void MapToolsSubprocessWorker::stop(bool)
+{ }
+
+MapToolsSubprocessWorker::Result MapToolsSubprocessWorker::request(const std::string&, std::chrono::milliseconds, std::string&)
+{
+	start();
+	return Result::StartFailed;
+}
+
+#endif // !defined(_WIN32)
+
+MapToolsSubprocessWorker::MapToolsSubprocessWorker(const std::vector<std::string>& childArguments)
+: childArguments(childArguments)
+{ }
+
+MapToolsSubprocessWorker::~MapToolsSubprocessWorker()
+{
+	stop(false);
+}
+
+MapToolsSubprocessPool::MapToolsSubprocessPool(const std::vector<std::string>& childArguments, size_t numWorkers)
+: workers(std::max<size_t>(numWorkers, 1))
+{
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i].process = std::make_unique<MapToolsSubprocessWorker>(childArguments);
+		idleWorkers.push_back(workers.size() - 1 - i); // (so the first worker is used first)
+	}
+}
+
+bool MapToolsSubprocessPool::prestart()
+{
+	std::lock_guard<std::mutex> lock(workersMutex);
+	for (auto& worker : workers)
+	{
+		if (!worker.process->start())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+MapToolsSubprocessWorker::Result MapToolsSubprocessPool::request(const std::string& inputPath, const std::string& requestLine, std::chrono::milliseconds timeout, std::string& responseLine, std::string* pExitReason)
+{
+	size_t workerIdx = 0;
+	{
+		std::unique_lock<std::mutex> lock(workersMutex);
+		workerReleased.wait(lock, [this]() { return !idleWorkers.empty(); });
+		workerIdx = idleWorkers.back();
+		idleWorkers.pop_back();
+	}
+	Worker& worker = workers[workerIdx];
+
+	// (only the thread that took this worker uses its process, until it is released)
+	auto result = worker.process->request(requestLine, timeout, responseLine);
+	if (result == MapToolsSubprocessWorker::Result::Exited && pExitReason)
+	{
+		*pExitReason = worker.process->lastExitReason();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(workersMutex);
+		++worker.numRequests;
+		if (result == MapToolsSubprocessWorker::Result::TimedOut)
+		{
+			++worker.numTimeouts;
+		}
+		else if (result == MapToolsSubprocessWorker::Result::Exited)
+		{
+			worker.crashes.push_back(Crash{inputPath, worker.process->lastExitReason()});
+		}
+		idleWorkers.push_back(workerIdx);
+	}
+	workerReleased.notify_one();
+	return result;
+}
+
+size_t MapToolsSubprocessPool::numCrashes() const
+{
+	std::lock_guard<std::mutex> lock(workersMutex);
+	size_t total = 0;
+	for (const auto& worker : workers)
+	{
+		total += worker.crashes.size();
+	}
+	return total;
+}
+
+size_t MapToolsSubprocessPool::numTimeouts() const
+{
+	std::lock_guard<std::mutex> lock(workersMutex);
+	size_t total = 0;
+	for (const auto& worker : workers)
+	{
+		total += worker.numTimeouts;
+	}
+	return total;
+}
+
+void MapToolsSubprocessPool::printCrashReport(std::ostream& os) const
+{
+	std::lock_guard<std::mutex> lock(workersMutex);
+	os << "Child process crashes + timeouts (each child was restarted):" << std::endl;
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		const Worker& worker = workers[i];
+		if (worker.crashes.empty() && worker.numTimeouts == 0)
+		{
+			continue;
+		}
+		os << "\t - worker " << (i + 1) << ": " << worker.crashes.size() << " crash(es)";
+		if (worker.numTimeouts > 0)
+		{
+			os << " + " << worker.numTimeouts << " timeout(s)";
+		}
+		os << " in " << worker.numRequests << " requests" << std::endl;
+		for (const auto& crash : worker.crashes)
+		{
+			os << "\t\t" << crash.inputPath << " (" << crash.reason << ")" << std::endl;
+		}
+	}
+}
@@ -0,0 +1,127 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <ostream>
+
+/*
+ * Child maptools processes, which requests are sent to over pipes
+ *
+ * Each child runs "maptools serve" (one request at a time), so a request that hangs (ex. a looping map script - which
+ * can't be cancelled in-thread) can be abandoned by killing the child, and a request that crashes the child (ex. a
+ * malformed upload) only takes that child down - either way, it is then replaced by a fresh one.
+ */
+namespace MapToolsSubprocess {
+
+// Whether child processes are supported on this platform
+bool isSupported();
+
+// Sets the path of the maptools executable (from argv[0]) - used where the running executable can't be determined otherwise
+void setExecutablePath(const std::string& argv0);
+
+} // namespace MapToolsSubprocess
+
+class MapToolsSubprocessWorker
+{
+public:
+	enum class Result
+	{
+		OK,
+		TimedOut,   // the child was killed
+		Exited,     // the child exited (or crashed) without responding
+		StartFailed
+	};
+
+public:
+	// childArguments are passed to the child maptools process (ex. {"serve", "-j", "1"})
+	explicit MapToolsSubprocessWorker(const std::vector<std::string>& childArguments);
+	~MapToolsSubprocessWorker();
+
+	MapToolsSubprocessWorker(const MapToolsSubprocessWorker&) = delete;
+	MapToolsSubprocessWorker& operator=(const MapToolsSubprocessWorker&) = delete;
+
+public:
+	// Starts the child (if it isn't already running)
+	bool start();
+
+	// Sends a request line, and waits for the response line (for up to timeout, if non-zero)
+	// Unless the result is OK, the child is gone - and a new one is started for the next request
+	Result request(const std::string& requestLine, std::chrono::milliseconds timeout, std::string& responseLine);
+
+	// How the last child exited (ex. "killed by signal 11: Segmentation fault")
+	const std::string& lastExitReason() const { return exitReason; }
+
+private:
+	bool isRunning() const { return childPid >= 0; }
+	void stop(bool kill);
+
+private:
+	std::vector<std::string> childArguments;
+	long long childPid = -1;
+	int toChild = -1;
+	int fromChild = -1;
+	std::string readBuffer;
+	std::string exitReason;
+};
+
+// A fixed-size pool of long-lived child processes, shared by the threads that send requests
+// (a child that crashes is replaced, and each crash is recorded against the worker + the input that caused it)
+class MapToolsSubprocessPool
+{
+public:
+	MapToolsSubprocessPool(const std::vector<std::string>& childArguments, size_t numWorkers);
+
+	// Starts all of the children up-front (so the first requests don't pay for process startup)
+	bool prestart();
+
+	// Sends a request to an idle worker (waiting for one, if all are busy) - inputPath is only used to record crashes
+	MapToolsSubprocessWorker::Result request(const std::string& inputPath, const std::string& requestLine, std::chrono::milliseconds timeout, std::string& responseLine, std::string* pExitReason = nullptr);
+
+	size_t numCrashes() const;
+	size_t numTimeouts() const;
+	// Outputs the number of crashes + timeouts per worker, and the input that caused each crash
+	void printCrashReport(std::ostream& os) const;
+
+private:
+	struct Crash
+	{
+		std::string inputPath;
+		std::string reason;
+	};
+	struct Worker
+	{
+		std::unique_ptr<MapToolsSubprocessWorker> process;
+		size_t numRequests = 0;
+		size_t numTimeouts = 0;
+		std::vector<Crash> crashes;
+	};
+
+	mutable std::mutex workersMutex;
+	std::condition_variable workerReleased;
+	std::vector<Worker> workers;
+	std::vector<size_t> idleWorkers;
+};
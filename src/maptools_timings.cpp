@@ -0,0 +1,146 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_timings.h"
+#include "maptools_stats.h"
+#include <nlohmann/json.hpp>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+struct PhaseStats
+{
+	const char* name = nullptr;
+	uint64_t count = 0;
+	std::chrono::steady_clock::duration total = std::chrono::steady_clock::duration::zero();
+	std::chrono::steady_clock::duration min = std::chrono::steady_clock::duration::max();
+	std::chrono::steady_clock::duration max = std::chrono::steady_clock::duration::zero();
+	std::unique_ptr<MapToolsLatencyHistogram> histogram = std::make_unique<MapToolsLatencyHistogram>();
+};
+
+std::atomic<bool> timingsEnabled(false);
+std::chrono::steady_clock::time_point timingsStartTime;
+std::mutex phasesMutex;
+std::vector<PhaseStats> phases; // in order of first occurrence
+
+double toMilliseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+} // anonymous namespace
+
+void MapToolsTimings::enable()
+{
+	timingsStartTime = std::chrono::steady_clock::now();
+	timingsEnabled.store(true, std::memory_order_relaxed);
+}
+
+bool MapToolsTimings::isEnabled()
+{
+	return timingsEnabled.load(std::memory_order_relaxed);
+}
+
+void MapToolsTimings::recordPhase(const char* phaseName, std::chrono::steady_clock::duration duration)
+{
+	std::lock_guard<std::mutex> lock(phasesMutex);
+	auto it = std::find_if(phases.begin(), phases.end(), [phaseName](const PhaseStats& stats) {
+		return stats.name == phaseName || strcmp(stats.name, phaseName) == 0;
+	});
+	if (it == phases.end())
+	{
+		phases.push_back(PhaseStats());
+		it = std::prev(phases.end());
+		it->name = phaseName;
+	}
+	++(it->count);
+	it->total += duration;
+	it->min = std::min(it->min, duration);
+	it->max = std::max(it->max, duration);
+	it->histogram->record(duration);
+}
+
+void MapToolsTimings::printTable(std::ostream& os)
+{
+	auto elapsed = std::chrono::steady_clock::now() - timingsStartTime;
+	std::lock_guard<std::mutex> lock(phasesMutex);
+
+	size_t nameWidth = strlen("total elapsed");
+	for (const auto& stats : phases)
+	{
+		nameWidth = std::max(nameWidth, strlen(stats.name));
+	}
+
+	std::ios_base::fmtflags originalFlags = os.flags();
+	os << "Timings:" << std::endl;
+	os << "  " << std::left << std::setw(static_cast<int>(nameWidth)) << "phase" << std::right
+		<< std::setw(8) << "count" << std::setw(13) << "total (ms)" << std::setw(11) << "avg (ms)" << std::setw(11) << "min (ms)" << std::setw(11) << "max (ms)" << std::endl;
+	os << std::fixed << std::setprecision(3);
+	for (const auto& stats : phases)
+	{
+		os << "  " << std::left << std::setw(static_cast<int>(nameWidth)) << stats.name << std::right
+			<< std::setw(8) << stats.count
+			<< std::setw(13) << toMilliseconds(stats.total)
+			<< std::setw(11) << toMilliseconds(stats.total) / static_cast<double>(stats.count)
+			<< std::setw(11) << toMilliseconds(stats.min)
+			<< std::setw(11) << toMilliseconds(stats.max) << std::endl;
+	}
+	os << "  " << std::left << std::setw(static_cast<int>(nameWidth)) << "total elapsed" << std::right
+		<< std::setw(8) << "" << std::setw(13) << toMilliseconds(elapsed) << std::endl;
+	os.flags(originalFlags);
+}
+
+void MapToolsTimings::printJSON(std::ostream& os)
+{
+	auto elapsed = std::chrono::steady_clock::now() - timingsStartTime;
+	std::lock_guard<std::mutex> lock(phasesMutex);
+
+	nlohmann::ordered_json output = nlohmann::ordered_json::object();
+	nlohmann::ordered_json phasesJSON = nlohmann::ordered_json::array();
+	for (const auto& stats : phases)
+	{
+		nlohmann::ordered_json phase = nlohmann::ordered_json::object();
+		phase["phase"] = stats.name;
+		phase["count"] = stats.count;
+		phase["total_ms"] = toMilliseconds(stats.total);
+		phase["avg_ms"] = toMilliseconds(stats.total) / static_cast<double>(stats.count);
+		phase["min_ms"] = toMilliseconds(stats.min);
+		phase["max_ms"] = toMilliseconds(stats.max);
+		phasesJSON.push_back(std::move(phase));
+	}
+	output["phases"] = std::move(phasesJSON);
+	output["elapsed_ms"] = toMilliseconds(elapsed);
+	os << output.dump(-1) << std::endl;
+}
+
+void MapToolsTimings::forEachPhase(const std::function<void (const char* phaseName, const MapToolsLatencyHistogram& histogram)>& func)
+{
+	std::lock_guard<std::mutex> lock(phasesMutex);
+	for (const auto& stats : phases)
+	{
+		func(stats.name, *(stats.histogram));
+	}
+}
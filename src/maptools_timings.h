@@ -0,0 +1,100 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <chrono>
+#include <atomic>
+#include <ostream>
+#include <functional>
+#include "maptools_trace.h"
+
+class MapToolsLatencyHistogram;
+
+/*
+ * Per-phase timing instrumentation (--timings)
+ *
+ * Phases are recorded with a MapToolsScopedPhase around each unit of work (ex. "load map", "encode png"),
+ * and accumulated (per phase name) across all threads. Recording is skipped entirely when timings are disabled.
+ * (If --trace is enabled, each phase is also recorded as a trace span.)
+ */
+namespace MapToolsTimings {
+
+void enable();
+bool isEnabled();
+
+// Records a completed phase (phaseName must be a string literal / have static storage duration)
+void recordPhase(const char* phaseName, std::chrono::steady_clock::duration duration);
+
+// Outputs a table of the recorded phases (and the total elapsed time since enable())
+void printTable(std::ostream& os);
+void printJSON(std::ostream& os);
+
+// Calls func with the latency histogram of each recorded phase (in order of first occurrence)
+void forEachPhase(const std::function<void (const char* phaseName, const MapToolsLatencyHistogram& histogram)>& func);
+
+} // namespace MapToolsTimings
+
+class MapToolsScopedPhase
+{
+public:
+	explicit MapToolsScopedPhase(const char* phaseName)
+	: phaseName(phaseName)
+	, active(MapToolsTimings::isEnabled())
+	, tracing(MapToolsTrace::isEnabled())
+	{
+		if (active)
+		{
+			startTime = std::chrono::steady_clock::now();
+		}
+		if (tracing)
+		{
+			MapToolsTrace::beginSpan(phaseName);
+		}
+	}
+	~MapToolsScopedPhase()
+	{
+		stop();
+	}
+
+	MapToolsScopedPhase(const MapToolsScopedPhase&) = delete;
+	MapToolsScopedPhase& operator=(const MapToolsScopedPhase&) = delete;
+
+	// Ends the phase early (before the end of the scope)
+	void stop()
+	{
+		if (active)
+		{
+			MapToolsTimings::recordPhase(phaseName, std::chrono::steady_clock::now() - startTime);
+			active = false;
+		}
+		if (tracing)
+		{
+			MapToolsTrace::endSpan(phaseName);
+			tracing = false;
+		}
+	}
+
+private:
+	const char* phaseName;
+	bool active;
+	bool tracing;
+	std::chrono::steady_clock::time_point startTime;
+};
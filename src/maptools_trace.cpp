@@ -0,0 +1,154 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "maptools_trace.h"
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+struct TraceEvent
+{
+	const char* name;
+	char phase; // 'B' or 'E'
+	std::chrono::steady_clock::time_point timestamp;
+	std::string input;
+};
+
+struct ThreadTraceBuffer
+{
+	uint32_t threadId = 0;
+	std::string threadName;
+	std::vector<TraceEvent> events;
+};
+
+std::atomic<bool> traceEnabled(false);
+std::chrono::steady_clock::time_point traceStartTime;
+
+// All thread buffers are owned here (so they outlive their threads)
+std::mutex threadBuffersMutex;
+std::vector<std::shared_ptr<ThreadTraceBuffer>> threadBuffers;
+
+ThreadTraceBuffer& currentThreadBuffer()
+{
+	thread_local std::shared_ptr<ThreadTraceBuffer> buffer;
+	if (!buffer)
+	{
+		buffer = std::make_shared<ThreadTraceBuffer>();
+		buffer->events.reserve(1024);
+		std::lock_guard<std::mutex> lock(threadBuffersMutex);
+		buffer->threadId = static_cast<uint32_t>(threadBuffers.size()) + 1;
+		threadBuffers.push_back(buffer);
+	}
+	return *buffer;
+}
+
+} // anonymous namespace
+
+void MapToolsTrace::enable()
+{
+	traceStartTime = std::chrono::steady_clock::now();
+	traceEnabled.store(true, std::memory_order_relaxed);
+	setThreadName("main");
+}
+
+bool MapToolsTrace::isEnabled()
+{
+	return traceEnabled.load(std::memory_order_relaxed);
+}
+
+void MapToolsTrace::setThreadName(const std::string& name)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+	currentThreadBuffer().threadName = name;
+}
+
+void MapToolsTrace::beginSpan(const char* name, const std::string& input)
+{
+	currentThreadBuffer().events.push_back(TraceEvent{name, 'B', std::chrono::steady_clock::now(), input});
+}
+
+void MapToolsTrace::endSpan(const char* name)
+{
+	currentThreadBuffer().events.push_back(TraceEvent{name, 'E', std::chrono::steady_clock::now(), std::string()});
+}
+
+bool MapToolsTrace::writeTraceFile(const std::string& outputPath)
+{
+	std::ofstream outputFile(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!outputFile.is_open())
+	{
+		std::cerr << "Failed to open trace output file: " << outputPath << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(threadBuffersMutex);
+	bool firstEvent = true;
+	auto writeEvent = [&outputFile, &firstEvent](const nlohmann::ordered_json& event) {
+		outputFile << ((firstEvent) ? "\n" : ",\n") << event.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::replace);
+		firstEvent = false;
+	};
+
+	outputFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (const auto& buffer : threadBuffers)
+	{
+		if (!buffer->threadName.empty())
+		{
+			nlohmann::ordered_json threadNameEvent = nlohmann::ordered_json::object();
+			threadNameEvent["name"] = "thread_name";
+			threadNameEvent["ph"] = "M";
+			threadNameEvent["pid"] = 1;
+			threadNameEvent["tid"] = buffer->threadId;
+			threadNameEvent["args"] = nlohmann::ordered_json::object({{"name", buffer->threadName}});
+			writeEvent(threadNameEvent);
+		}
+		for (const auto& traceEvent : buffer->events)
+		{
+			nlohmann::ordered_json event = nlohmann::ordered_json::object();
+			event["name"] = traceEvent.name;
+			event["ph"] = std::string(1, traceEvent.phase);
+			event["ts"] = std::chrono::duration<double, std::micro>(traceEvent.timestamp - traceStartTime).count();
+			event["pid"] = 1;
+			event["tid"] = buffer->threadId;
+			if (!traceEvent.input.empty())
+			{
+				event["args"] = nlohmann::ordered_json::object({{"input", traceEvent.input}});
+			}
+			writeEvent(event);
+		}
+	}
+	outputFile << "\n]}\n";
+
+	outputFile.close();
+	if (outputFile.fail())
+	{
+		std::cerr << "Failed to write trace output file: " << outputPath << std::endl;
+		return false;
+	}
+	return true;
+}
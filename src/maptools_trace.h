@@ -0,0 +1,76 @@
+// Warzone 2100 MapTools
+/*
+	This file is part of Warzone 2100.
+	Copyright (C) 2025  Warzone 2100 Project
+
+	Warzone 2100 is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	Warzone 2100 is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Warzone 2100; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#pragma once
+
+#include <string>
+#include <atomic>
+
+/*
+ * Chrome / Perfetto trace-event output (--trace)
+ *
+ * Spans are recorded as begin / end ("B" / "E") events into per-thread buffers (so recording never takes a lock),
+ * which are merged and written out as a trace JSON file at exit.
+ */
+namespace MapToolsTrace {
+
+void enable();
+bool isEnabled();
+
+// Names the calling thread in the trace
+void setThreadName(const std::string& name);
+
+// name must be a string literal / have static storage duration
+void beginSpan(const char* name, const std::string& input = std::string());
+void endSpan(const char* name);
+
+// Writes all recorded events to a trace JSON file
+bool writeTraceFile(const std::string& outputPath);
+
+} // namespace MapToolsTrace
+
+// Records a trace span for the lifetime of the object (ex. the processing of one map in a batch)
+class MapToolsTraceSpan
+{
+public:
+	explicit MapToolsTraceSpan(const char* name, const std::string& input = std::string())
+	: name(name)
+	, active(MapToolsTrace::isEnabled())
+	{
+		if (active)
+		{
+			MapToolsTrace::beginSpan(name, input);
+		}
+	}
+	~MapToolsTraceSpan()
+	{
+		if (active)
+		{
+			MapToolsTrace::endSpan(name);
+		}
+	}
+
+	MapToolsTraceSpan(const MapToolsTraceSpan&) = delete;
+	MapToolsTraceSpan& operator=(const MapToolsTraceSpan&) = delete;
+
+private:
+	const char* name;
+	bool active;
+};
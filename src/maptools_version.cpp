@@ -26,6 +26,9 @@
 #include <ZipIOProvider.h>
 #endif
 #include <png.h>
+#if defined(WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+#include <libdeflate.h>
+#endif
 
 #define stringify__(s) #s
 #define stringify_(s) stringify__(s)
@@ -44,6 +47,9 @@ std::string generateMapToolsVersionInfo()
 	}
 #endif
 	versionInfo << " libpng/" << PNG_LIBPNG_VER_STRING;
+#if defined(WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+	versionInfo << " libdeflate/" << LIBDEFLATE_VERSION_STRING;
+#endif
 	return versionInfo.str();
 }
 
@@ -19,10 +19,22 @@
 */
 
 #include "pngsave.h"
+#include "maptools_parallel.h"
 #include <wzmaplib/map_debug.h>
 #include <png.h>
+#include <zlib.h>
+#if defined(WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+#include <libdeflate.h>
+#endif
 #include <cstdlib>
 #include <cstdarg>
+#include <cstring>
+#include <climits>
+#include <unordered_map>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <algorithm>
 
 template <unsigned N>
 static inline int vssprintf(char (&dest)[N], char const *format, va_list params) { return vsnprintf(dest, N, format, params); }
@@ -41,26 +53,888 @@ static inline void PNGWriteCleanup(png_infop *info_ptr, png_structp *png_ptr, FI
 	fprintf(stderr, __VA_ARGS__); \
 } while(0)
 
+// Appends the encoded PNG data to a growable (std::vector) buffer
+static void wzpng_write_data(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+	std::vector<uint8_t> *outputBuffer = static_cast<std::vector<uint8_t> *>(png_get_io_ptr(png_ptr));
+	// (an exception must not propagate through libpng's C frames - so report it through png_error, once it's caught)
+	bool outOfMemory = false;
+	try
+	{
+		outputBuffer->insert(outputBuffer->end(), data, data + length);
+	}
+	catch (const std::bad_alloc&)
+	{
+		outOfMemory = true;
+	}
+	if (outOfMemory)
+	{
+		png_error(png_ptr, "Out of memory");
+	}
+}
+
+static void wzpng_flush_data(png_structp png_ptr)
+{
+	(void)png_ptr; // nothing to flush
+}
+
+struct PngZlibSettings
+{
+	int level;
+	int strategy;
+	int memLevel;
+	int windowBits;
+};
+
+static PngZlibSettings getZlibSettings(PngCompressionProfile profile)
+{
+	switch (profile)
+	{
+		case PngCompressionProfile::Fast:
+			// Z_RLE only looks for runs (distance 1), so a smaller window wouldn't change the output - the default (15) is kept, as for the other profiles
+			return {Z_BEST_SPEED, Z_RLE, 9, 15};
+		case PngCompressionProfile::Default:
+			return {Z_DEFAULT_COMPRESSION, Z_FILTERED, 8, 15};
+		case PngCompressionProfile::Max:
+			// (libpng's own settings, at level 9 - so savePng's default output is unchanged)
+			return {Z_BEST_COMPRESSION, Z_FILTERED, 8, 15};
+	}
+	return {Z_DEFAULT_COMPRESSION, Z_FILTERED, 8, 15}; // silence warning
+}
+
+/**************************************************************************
+  Integer upscaling (PngSaveOptions::scale)
+
+  The encoders read the image through a PngRowSource, which produces the
+  rows of the scaled image on demand: each source row is expanded
+  horizontally (nearest-neighbour) once, into one of two row buffers, and
+  is then returned for each of the scale output rows it covers.
+**************************************************************************/
+
+// Repeats each pixel of a row scale times (PixelBytes is a constant, so the inner copy compiles to a few moves)
+template <size_t PixelBytes>
+static void expandPngRowPixels(const uint8_t *src, unsigned w, unsigned scale, uint8_t *dst)
+{
+	for (unsigned x = 0; x < w; ++x, src += PixelBytes)
+	{
+		for (unsigned i = 0; i < scale; ++i, dst += PixelBytes)
+		{
+			memcpy(dst, src, PixelBytes);
+		}
+	}
+}
+
+// Repeats each pixel of a row of packed (1, 2 or 4-bit) pixels scale times
+static void expandPngRowPacked(const uint8_t *src, unsigned w, unsigned scale, int bitdepth, uint8_t *dst, size_t dstRowBytes)
+{
+	const unsigned pixelsPerByte = 8 / static_cast<unsigned>(bitdepth);
+	const unsigned mask = (1u << bitdepth) - 1;
+	memset(dst, 0, dstRowBytes);
+	size_t dstX = 0;
+	for (unsigned x = 0; x < w; ++x)
+	{
+		unsigned value = (src[x / pixelsPerByte] >> (static_cast<unsigned>(bitdepth) * (pixelsPerByte - 1 - (x % pixelsPerByte)))) & mask;
+		for (unsigned i = 0; i < scale; ++i, ++dstX)
+		{
+			dst[dstX / pixelsPerByte] |= static_cast<uint8_t>(value << (static_cast<unsigned>(bitdepth) * (pixelsPerByte - 1 - (dstX % pixelsPerByte))));
+		}
+	}
+}
+
+class PngRowSource
+{
+public:
+	PngRowSource(const uint8_t *pixels, unsigned w, unsigned h, int bitdepth, unsigned channelsPerPixel, unsigned scale)
+	: pixels(pixels)
+	, srcWidth(w)
+	, srcRowBytes((static_cast<size_t>(w) * channelsPerPixel * static_cast<unsigned>(bitdepth) + 7) / 8)
+	, bitdepth(bitdepth)
+	, pixelBytes((channelsPerPixel * static_cast<unsigned>(bitdepth)) / 8)
+	, scale(std::max(scale, 1u))
+	, scaledHeight(h * this->scale)
+	, scaledRowBytes((static_cast<size_t>(w) * this->scale * channelsPerPixel * static_cast<unsigned>(bitdepth) + 7) / 8)
+	{
+		if (this->scale > 1)
+		{
+			// (allocated up-front, so the buffers never move - see savePngInternal)
+			for (auto& rowBuffer : rowBuffers)
+			{
+				rowBuffer.resize(scaledRowBytes);
+			}
+		}
+	}
+
+	unsigned height() const { return scaledHeight; }
+	size_t rowBytes() const { return scaledRowBytes; }
+
+	// Returns row y of the (scaled) image - which stays valid until rows from two other source rows have been requested
+	// (so the current + previous rows can be used together, when filtering)
+	const uint8_t *row(unsigned y)
+	{
+		if (scale == 1)
+		{
+			return pixels + (srcRowBytes * y);
+		}
+		unsigned srcY = y / scale;
+		for (size_t i = 0; i < 2; ++i)
+		{
+			if (bufferSrcRows[i] == srcY)
+			{
+				// (so the other buffer is replaced next)
+				nextBuffer = 1 - i;
+				return rowBuffers[i].data();
+			}
+		}
+		// (replace the least recently used buffer)
+		uint8_t *dst = rowBuffers[nextBuffer].data();
+		const uint8_t *src = pixels + (srcRowBytes * srcY);
+		switch (pixelBytes)
+		{
+			case 0: expandPngRowPacked(src, srcWidth, scale, bitdepth, dst, scaledRowBytes); break;
+			case 1: expandPngRowPixels<1>(src, srcWidth, scale, dst); break;
+			case 2: expandPngRowPixels<2>(src, srcWidth, scale, dst); break;
+			case 3: expandPngRowPixels<3>(src, srcWidth, scale, dst); break;
+			case 4: expandPngRowPixels<4>(src, srcWidth, scale, dst); break;
+			case 6: expandPngRowPixels<6>(src, srcWidth, scale, dst); break;
+			case 8: expandPngRowPixels<8>(src, srcWidth, scale, dst); break;
+			default:
+				for (unsigned x = 0; x < srcWidth; ++x)
+				{
+					for (unsigned i = 0; i < scale; ++i)
+					{
+						memcpy(dst + ((static_cast<size_t>(x) * scale + i) * pixelBytes), src + (static_cast<size_t>(x) * pixelBytes), pixelBytes);
+					}
+				}
+				break;
+		}
+		bufferSrcRows[nextBuffer] = srcY;
+		nextBuffer = 1 - nextBuffer;
+		return dst;
+	}
+
+private:
+	const uint8_t *pixels;
+	unsigned srcWidth;
+	size_t srcRowBytes;
+	int bitdepth;
+	size_t pixelBytes; // (0 for packed, sub-byte pixels)
+	unsigned scale;
+	unsigned scaledHeight;
+	size_t scaledRowBytes;
+	std::vector<uint8_t> rowBuffers[2];
+	unsigned bufferSrcRows[2] = {UINT_MAX, UINT_MAX};
+	size_t nextBuffer = 0;
+};
+
+/**************************************************************************
+  Parallel (strip-based) encoding
+
+  The image is split into strips of whole rows, which are filtered and
+  deflated concurrently as raw deflate streams - each primed with the last
+  32 KB of the previous strip as its dictionary (so matches can still reach
+  back across the strip boundary), and ended with a sync flush (except the
+  last). The strips are concatenated into one zlib stream, with an Adler-32
+  combined from the per-strip checksums.
+
+  Each strip task filters its own rows (plus, again, the rows before it
+  that the dictionary needs), so only the strips in progress are ever held
+  filtered - not the whole (ex. upscaled) image.
+**************************************************************************/
+
+// Strips are at least this large (so smaller images are left to libpng)
+static const size_t ParallelMinStripSize = 128 * 1024;
+// ... and at most this large (which bounds the memory for the strips in progress)
+static const size_t ParallelMaxStripSize = 1024 * 1024;
+// Each thread gets ~this many strips (more strips balance the load better, at a small cost in size)
+static const size_t ParallelStripsPerThread = 2;
+static const size_t DeflateWindowSize = 32 * 1024;
+static const unsigned ParallelFilterRowsPerTask = 16;
+
+enum PngRowFilter
+{
+	PngRowFilter_None = 0,
+	PngRowFilter_Sub = 1,
+	PngRowFilter_Up = 2,
+	PngRowFilter_Average = 3,
+	PngRowFilter_Paeth = 4
+};
+
+// (written without branches - the predictor is effectively random per byte, so branches would mispredict constantly)
+static inline int paethPredictor(int a, int b, int c)
+{
+	int pa = abs(b - c);
+	int pb = abs(a - c);
+	int pc = abs(a + b - 2 * c);
+	int bOrC = (pb <= pc) ? b : c;
+	return (pa <= pb && pa <= pc) ? a : bOrC;
+}
+
+template <int Filter>
+static inline int predictPngByte(int left, int up, int upLeft)
+{
+	switch (Filter)
+	{
+		case PngRowFilter_Sub: return left;
+		case PngRowFilter_Up: return up;
+		case PngRowFilter_Average: return (left + up) >> 1;
+		case PngRowFilter_Paeth: return paethPredictor(left, up, upLeft);
+		default: return 0;
+	}
+}
+
+// Filters one row (prevRow is all zeroes for the first row), writing the filter type byte + the filtered row to out
+// Returns the sum of the filtered bytes as signed values (libpng's heuristic - the smaller the sum, the better the row
+// compresses), or stops early (returning maxCost) once the sum reaches maxCost
+template <int Filter>
+static uint64_t filterPngRow(const uint8_t *row, const uint8_t *prevRow, size_t rowBytes, size_t bpp, uint8_t *out, uint64_t maxCost)
+{
+	out[0] = static_cast<uint8_t>(Filter);
+	++out;
+	uint64_t cost = 0;
+	size_t i = 0;
+	// (the first bpp bytes have no left neighbour)
+	for (; i < bpp && i < rowBytes; ++i)
+	{
+		int8_t filtered = static_cast<int8_t>(row[i] - predictPngByte<Filter>(0, prevRow[i], 0));
+		out[i] = static_cast<uint8_t>(filtered);
+		cost += static_cast<uint64_t>(abs(filtered));
+	}
+	for (; i < rowBytes; ++i)
+	{
+		int8_t filtered = static_cast<int8_t>(row[i] - predictPngByte<Filter>(row[i - bpp], prevRow[i], prevRow[i - bpp]));
+		out[i] = static_cast<uint8_t>(filtered);
+		cost += static_cast<uint64_t>(abs(filtered));
+		if (cost >= maxCost)
+		{
+			return maxCost;
+		}
+	}
+	return cost;
+}
+
+static const uint64_t NoMaxCost = UINT64_MAX;
+
+// Filters one row with the filter that has the lowest cost (libpng's adaptive filtering)
+static void filterPngRowAdaptive(const uint8_t *row, const uint8_t *prevRow, size_t rowBytes, size_t bpp, uint8_t *out, std::vector<uint8_t>& scratch)
+{
+	scratch.resize(rowBytes + 1);
+	uint8_t *candidate = scratch.data();
+	uint64_t bestCost = filterPngRow<PngRowFilter_None>(row, prevRow, rowBytes, bpp, out, NoMaxCost);
+	uint64_t (*const filters[])(const uint8_t *, const uint8_t *, size_t, size_t, uint8_t *, uint64_t) = {
+		filterPngRow<PngRowFilter_Sub>, filterPngRow<PngRowFilter_Up>, filterPngRow<PngRowFilter_Average>, filterPngRow<PngRowFilter_Paeth>
+	};
+	for (auto filterFunc : filters)
+	{
+		if (bestCost == 0)
+		{
+			break;
+		}
+		uint64_t cost = filterFunc(row, prevRow, rowBytes, bpp, candidate, bestCost);
+		if (cost < bestCost)
+		{
+			// (swap buffers rather than copying, and copy the best row into place once at the end)
+			bestCost = cost;
+			std::swap(out, candidate);
+		}
+	}
+	if (out == scratch.data())
+	{
+		memcpy(candidate, out, rowBytes + 1);
+	}
+}
+
+// Filters one row with filterMode (which must already be resolved - see resolvePngFilterMode)
+static void filterPngRowWithMode(PngFilterMode filterMode, const uint8_t *row, const uint8_t *prevRow, size_t rowBytes, size_t bpp, uint8_t *out, std::vector<uint8_t>& scratch)
+{
+	switch (filterMode)
+	{
+		case PngFilterMode::Sub:
+			filterPngRow<PngRowFilter_Sub>(row, prevRow, rowBytes, bpp, out, NoMaxCost);
+			return;
+		case PngFilterMode::Up:
+			filterPngRow<PngRowFilter_Up>(row, prevRow, rowBytes, bpp, out, NoMaxCost);
+			return;
+		case PngFilterMode::Paeth:
+			filterPngRow<PngRowFilter_Paeth>(row, prevRow, rowBytes, bpp, out, NoMaxCost);
+			return;
+		case PngFilterMode::Adaptive:
+			filterPngRowAdaptive(row, prevRow, rowBytes, bpp, out, scratch);
+			return;
+		case PngFilterMode::None:
+		case PngFilterMode::Auto:
+			break;
+	}
+	out[0] = PngRowFilter_None;
+	memcpy(out + 1, row, rowBytes);
+}
+
+// Compresses one strip as a raw deflate stream, ended with a sync flush (or, for the last strip, a final block)
+static bool deflateStrip(const uint8_t *dictionary, size_t dictionaryLength, const uint8_t *data, size_t length, bool lastStrip, const PngZlibSettings& zlibSettings, std::vector<uint8_t>& output)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, zlibSettings.level, Z_DEFLATED, -zlibSettings.windowBits, zlibSettings.memLevel, zlibSettings.strategy) != Z_OK)
+	{
+		return false;
+	}
+	if (dictionaryLength > 0 && deflateSetDictionary(&stream, dictionary, static_cast<uInt>(dictionaryLength)) != Z_OK)
+	{
+		deflateEnd(&stream);
+		return false;
+	}
+	// (a sync flush adds an empty stored block - 5 bytes, plus up to 1 byte of padding)
+	output.resize(deflateBound(&stream, static_cast<uLong>(length)) + 16);
+	stream.next_in = const_cast<Bytef *>(data);
+	stream.avail_in = static_cast<uInt>(length);
+	stream.next_out = output.data();
+	stream.avail_out = static_cast<uInt>(output.size());
+	int flush = (lastStrip) ? Z_FINISH : Z_SYNC_FLUSH;
+	int result = Z_OK;
+	while (true)
+	{
+		result = deflate(&stream, flush);
+		if (result == Z_STREAM_END || (result == Z_OK && stream.avail_in == 0 && stream.avail_out > 0 && !lastStrip))
+		{
+			break;
+		}
+		if (result != Z_OK && result != Z_BUF_ERROR)
+		{
+			deflateEnd(&stream);
+			return false;
+		}
+		// out of output space - grow the buffer, and continue
+		size_t used = output.size() - stream.avail_out;
+		output.resize(output.size() * 2);
+		stream.next_out = output.data() + used;
+		stream.avail_out = static_cast<uInt>(output.size() - used);
+	}
+	output.resize(output.size() - stream.avail_out);
+	// (the strips are all held until they are assembled - so don't keep the deflateBound-sized buffer)
+	output.shrink_to_fit();
+	deflateEnd(&stream);
+	return true;
+}
+
+static void appendBigEndian32(std::vector<uint8_t>& output, uint32_t value)
+{
+	uint8_t bytes[4] = {static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+	output.insert(output.end(), bytes, bytes + 4);
+}
+
+// Appends a PNG chunk: length, type, data, CRC-32 (of the type + data)
+static void appendPngChunk(std::vector<uint8_t>& output, const char *type, const uint8_t *data, size_t length)
+{
+	appendBigEndian32(output, static_cast<uint32_t>(length));
+	output.insert(output.end(), type, type + 4);
+	if (length > 0)
+	{
+		output.insert(output.end(), data, data + length);
+	}
+	uLong crc = crc32(0L, reinterpret_cast<const Bytef *>(type), 4);
+	if (length > 0)
+	{
+		crc = crc32(crc, data, static_cast<uInt>(length));
+	}
+	appendBigEndian32(output, static_cast<uint32_t>(crc));
+}
+
+// The 2-byte zlib stream header (the compression level bits are informational only, but match what zlib would write)
+static void appendZlibHeader(std::vector<uint8_t>& output, const PngZlibSettings& zlibSettings)
+{
+	unsigned levelFlags = 2;
+	if (zlibSettings.strategy >= Z_HUFFMAN_ONLY || (zlibSettings.level >= 0 && zlibSettings.level < 2)) { levelFlags = 0; }
+	else if (zlibSettings.level >= 0 && zlibSettings.level < 6) { levelFlags = 1; }
+	else if (zlibSettings.level > 6) { levelFlags = 3; }
+	unsigned cmf = (static_cast<unsigned>(zlibSettings.windowBits - 8) << 4) | Z_DEFLATED;
+	unsigned flg = levelFlags << 6;
+	flg += 31 - (((cmf << 8) | flg) % 31);
+	output.push_back(static_cast<uint8_t>(cmf));
+	output.push_back(static_cast<uint8_t>(flg));
+}
+
+// The number of bytes to the corresponding byte of the previous pixel (1 for sub-byte pixels)
+static size_t getPngFilterBytesPerPixel(unsigned channelsPerPixel, int bitdepth)
+{
+	return std::max<size_t>((channelsPerPixel * static_cast<unsigned>(bitdepth)) / 8, 1);
+}
+
+// Filters rows [firstRow, endRow) of the image to out - each row only depends on the unfiltered previous row
+static void filterPngRows(PngRowSource& rows, unsigned firstRow, unsigned endRow, size_t bpp, PngFilterMode filterMode, uint8_t *out, std::vector<uint8_t>& scratch)
+{
+	const size_t rowBytes = rows.rowBytes();
+	const std::vector<uint8_t> zeroRow((firstRow == 0) ? rowBytes : 0, 0);
+	for (unsigned y = firstRow; y < endRow; ++y)
+	{
+		const uint8_t *row = rows.row(y);
+		const uint8_t *prevRow = (y > 0) ? rows.row(y - 1) : zeroRow.data();
+		filterPngRowWithMode(filterMode, row, prevRow, rowBytes, bpp, out + ((rowBytes + 1) * (y - firstRow)), scratch);
+	}
+}
+
+// Filters the whole image (on up to numThreads threads) - rows are independent, so are filtered in parallel tasks
+static std::vector<uint8_t> filterPngImage(const PngRowSource& rows, size_t bpp, PngFilterMode filterMode, unsigned numThreads)
+{
+	const unsigned h = rows.height();
+	const size_t filteredRowBytes = rows.rowBytes() + 1;
+	std::vector<uint8_t> filtered(filteredRowBytes * h);
+	size_t numRowTasks = (h + ParallelFilterRowsPerTask - 1) / ParallelFilterRowsPerTask;
+	parallelFor(numRowTasks, std::max(numThreads, 1u), [&](size_t task) {
+		PngRowSource taskRows = rows; // (each task expands rows into its own buffers)
+		std::vector<uint8_t> scratch;
+		unsigned firstRow = static_cast<unsigned>(task * ParallelFilterRowsPerTask);
+		unsigned endRow = std::min(h, firstRow + ParallelFilterRowsPerTask);
+		filterPngRows(taskRows, firstRow, endRow, bpp, filterMode, filtered.data() + (filteredRowBytes * firstRow), scratch);
+	});
+	return filtered;
+}
+
+// Appends the PNG signature, IHDR, and (for palette images) PLTE chunks - the same chunks libpng writes
+static void appendPngHeader(std::vector<uint8_t>& output, unsigned w, unsigned h, int bitdepth, int color_type, const std::vector<png_color>* palette)
+{
+	static const uint8_t pngSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	output.insert(output.end(), pngSignature, pngSignature + sizeof(pngSignature));
+
+	std::vector<uint8_t> chunkData;
+	appendBigEndian32(chunkData, w);
+	appendBigEndian32(chunkData, h);
+	chunkData.push_back(static_cast<uint8_t>(bitdepth));
+	chunkData.push_back(static_cast<uint8_t>(color_type));
+	chunkData.push_back(PNG_COMPRESSION_TYPE_DEFAULT);
+	chunkData.push_back(PNG_FILTER_TYPE_DEFAULT);
+	chunkData.push_back(PNG_INTERLACE_NONE);
+	appendPngChunk(output, "IHDR", chunkData.data(), chunkData.size());
+
+	if (color_type == PNG_COLOR_TYPE_PALETTE)
+	{
+		chunkData.clear();
+		for (const auto& color : *palette)
+		{
+			chunkData.push_back(color.red);
+			chunkData.push_back(color.green);
+			chunkData.push_back(color.blue);
+		}
+		appendPngChunk(output, "PLTE", chunkData.data(), chunkData.size());
+	}
+}
+
+// Encodes a complete PNG to output, filtering + compressing strips of the image on up to options.numThreads threads
+static bool encodePngParallel(std::vector<uint8_t>& output, const PngRowSource& rows, unsigned w, unsigned h, int bitdepth, int color_type, unsigned channelsPerPixel, PngFilterMode filterMode, const PngSaveOptions& options, const std::vector<png_color>* palette)
+{
+	// 1. split the rows into strips
+	const size_t bpp = getPngFilterBytesPerPixel(channelsPerPixel, bitdepth);
+	const size_t filteredRowBytes = rows.rowBytes() + 1;
+	const size_t filteredSize = filteredRowBytes * h;
+	size_t stripSize = (filteredSize + (options.numThreads * ParallelStripsPerThread) - 1) / (options.numThreads * ParallelStripsPerThread);
+	stripSize = std::min(std::max(stripSize, ParallelMinStripSize), ParallelMaxStripSize);
+	const unsigned rowsPerStrip = static_cast<unsigned>(std::max<size_t>(stripSize / filteredRowBytes, 1));
+	const size_t numStrips = (h + rowsPerStrip - 1) / rowsPerStrip;
+	// (the rows before a strip that hold the last DeflateWindowSize bytes of the previous strip)
+	const unsigned dictionaryRows = static_cast<unsigned>((DeflateWindowSize + filteredRowBytes - 1) / filteredRowBytes);
+
+	// 2. filter + deflate the strips (+ compute their Adler-32s)
+	std::vector<std::vector<uint8_t>> compressedStrips(numStrips);
+	std::vector<uLong> stripAdlers(numStrips);
+	std::atomic<bool> failed(false);
+	PngZlibSettings zlibSettings = getZlibSettings(options.compressionProfile);
+	parallelFor(numStrips, options.numThreads, [&](size_t strip) {
+		PngRowSource stripRows = rows; // (each task expands rows into its own buffers)
+		unsigned firstRow = static_cast<unsigned>(strip * rowsPerStrip);
+		unsigned endRow = std::min(h, firstRow + rowsPerStrip);
+		unsigned firstDictionaryRow = firstRow - std::min(firstRow, dictionaryRows);
+		std::vector<uint8_t> filtered(filteredRowBytes * (endRow - firstDictionaryRow));
+		std::vector<uint8_t> scratch;
+		filterPngRows(stripRows, firstDictionaryRow, endRow, bpp, filterMode, filtered.data(), scratch);
+		size_t dictionaryLength = std::min(filteredRowBytes * (firstRow - firstDictionaryRow), DeflateWindowSize);
+		const uint8_t *data = filtered.data() + (filteredRowBytes * (firstRow - firstDictionaryRow));
+		size_t length = filteredRowBytes * (endRow - firstRow);
+		if (!deflateStrip(data - dictionaryLength, dictionaryLength, data, length, strip + 1 == numStrips, zlibSettings, compressedStrips[strip]))
+		{
+			failed = true;
+		}
+		stripAdlers[strip] = adler32(adler32(0L, Z_NULL, 0), data, static_cast<uInt>(length));
+	});
+	if (failed)
+	{
+		debug_error("savePng: Error compressing PNG data\n");
+		return false;
+	}
+	uLong adler = stripAdlers[0];
+	for (size_t strip = 1; strip < numStrips; ++strip)
+	{
+		unsigned stripRowCount = std::min(h - static_cast<unsigned>(strip * rowsPerStrip), rowsPerStrip);
+		adler = adler32_combine(adler, stripAdlers[strip], static_cast<z_off_t>(filteredRowBytes * stripRowCount));
+	}
+
+	// 3. assemble the PNG
+	size_t compressedSize = 0;
+	for (const auto& compressedStrip : compressedStrips)
+	{
+		compressedSize += compressedStrip.size();
+	}
+	output.reserve(output.size() + compressedSize + 1024);
+	appendPngHeader(output, w, h, bitdepth, color_type, palette);
+
+	// (one IDAT chunk per strip - the zlib header goes in the first, and the Adler-32 in the last)
+	std::vector<uint8_t> chunkData;
+	for (size_t strip = 0; strip < numStrips; ++strip)
+	{
+		chunkData.clear();
+		if (strip == 0)
+		{
+			appendZlibHeader(chunkData, zlibSettings);
+		}
+		chunkData.insert(chunkData.end(), compressedStrips[strip].begin(), compressedStrips[strip].end());
+		std::vector<uint8_t>().swap(compressedStrips[strip]);
+		if (strip + 1 == numStrips)
+		{
+			appendBigEndian32(chunkData, static_cast<uint32_t>(adler));
+		}
+		appendPngChunk(output, "IDAT", chunkData.data(), chunkData.size());
+	}
+	appendPngChunk(output, "IEND", NULL, 0);
+	return true;
+}
+
+/**************************************************************************
+  libdeflate encoding (if compiled with WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+
+  libdeflate only compresses whole buffers (no streaming), but is much
+  faster than zlib at the same compression level - so the whole filtered
+  image is compressed in one shot, and the chunks are written directly.
+**************************************************************************/
+
+bool pngDeflateBackendIsAvailable(PngDeflateBackend backend)
+{
+	switch (backend)
+	{
+		case PngDeflateBackend::Zlib:
+			return true;
+		case PngDeflateBackend::Libdeflate:
+#if defined(WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+			return true;
+#else
+			return false;
+#endif
+	}
+	return false; // silence warning
+}
+
+#if defined(WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+
+// Below are some benchmarks (encode time, throughput of the raw image / file size) done on the same synthetic map previews
+// as the table in savePngInternal (with the auto filter mode), on one thread, zlib 1.2.13 / libdeflate 1.14:
+//
+// | profile | backend    | 128x128                    | 250x250                     | 1000x1000                    |
+// | :------ | :--------- | :------------------------- | :-------------------------- | :--------------------------- |
+// | fast    | zlib       | 0.86 ms, 57 MB/s / 4.1 KB  | 1.94 ms, 97 MB/s / 14.5 KB  | 12.30 ms, 244 MB/s / 24.1 KB |
+// | fast    | libdeflate | 0.79 ms, 62 MB/s / 3.8 KB  | 2.01 ms, 93 MB/s / 13.0 KB  | 17.11 ms, 175 MB/s / 26.6 KB |
+// | default | zlib       | 1.03 ms, 48 MB/s / 3.1 KB  | 2.84 ms, 66 MB/s / 10.4 KB  | 12.42 ms, 241 MB/s / 20.4 KB |
+// | default | libdeflate | 0.75 ms, 66 MB/s / 3.2 KB  | 1.75 ms, 107 MB/s / 10.5 KB | 10.23 ms, 293 MB/s / 21.8 KB |
+// | max     | zlib       | 5.98 ms, 8 MB/s / 2.9 KB   | 17.77 ms, 11 MB/s / 9.5 KB  | 41.94 ms, 72 MB/s / 17.7 KB  |
+// | max     | libdeflate | 3.27 ms, 15 MB/s / 2.9 KB  | 9.64 ms, 19 MB/s / 9.7 KB   | 24.09 ms, 125 MB/s / 19.3 KB |
+//
+// (zlib's fast profile is Z_RLE, which libdeflate's level 1 doesn't beat on large images)
+// (libdeflate's level 12 is smaller still - 8.1 KB for 250x250 - but 144 ms, ~8x slower than zlib's level 9)
+static int getLibdeflateLevel(PngCompressionProfile profile)
+{
+	switch (profile)
+	{
+		case PngCompressionProfile::Fast:
+			return 1;
+		case PngCompressionProfile::Default:
+			return 6;
+		case PngCompressionProfile::Max:
+			return 9;
+	}
+	return 6; // silence warning
+}
+
+// Compressors are relatively expensive to allocate (they hold the match-finder tables), so one is kept per thread
+class LibdeflateCompressorCache
+{
+public:
+	~LibdeflateCompressorCache()
+	{
+		if (compressor != NULL)
+		{
+			libdeflate_free_compressor(compressor);
+		}
+	}
+
+	libdeflate_compressor *get(int level)
+	{
+		if (compressor != NULL && compressorLevel != level)
+		{
+			libdeflate_free_compressor(compressor);
+			compressor = NULL;
+		}
+		if (compressor == NULL)
+		{
+			compressor = libdeflate_alloc_compressor(level);
+			compressorLevel = level;
+		}
+		return compressor;
+	}
+
+private:
+	libdeflate_compressor *compressor = NULL;
+	int compressorLevel = -1;
+};
+
+static bool encodePngLibdeflate(std::vector<uint8_t>& output, const PngRowSource& rows, unsigned w, unsigned h, int bitdepth, int color_type, unsigned channelsPerPixel, PngFilterMode filterMode, const PngSaveOptions& options, const std::vector<png_color>* palette)
+{
+	static thread_local LibdeflateCompressorCache compressorCache;
+	libdeflate_compressor *compressor = compressorCache.get(getLibdeflateLevel(options.compressionProfile));
+	if (compressor == NULL)
+	{
+		debug_error("savePng: Unable to create libdeflate compressor\n");
+		return false;
+	}
+
+	// (the rows are still filtered on up to options.numThreads threads - only the compression is single-threaded)
+	std::vector<uint8_t> filtered = filterPngImage(rows, getPngFilterBytesPerPixel(channelsPerPixel, bitdepth), filterMode, options.numThreads);
+	std::vector<uint8_t> compressed(libdeflate_zlib_compress_bound(compressor, filtered.size()));
+	size_t compressedSize = libdeflate_zlib_compress(compressor, filtered.data(), filtered.size(), compressed.data(), compressed.size());
+	if (compressedSize == 0)
+	{
+		debug_error("savePng: Error compressing PNG data\n");
+		return false;
+	}
+
+	output.reserve(output.size() + compressedSize + 1024);
+	appendPngHeader(output, w, h, bitdepth, color_type, palette);
+	appendPngChunk(output, "IDAT", compressed.data(), compressedSize);
+	appendPngChunk(output, "IEND", NULL, 0);
+	return true;
+}
+
+#endif // defined(WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+
+/**************************************************************************
+  Automatic filter selection (PngFilterMode::Auto)
+
+  A sample of the rows is filtered with each candidate mode, and test-
+  compressed at zlib's fastest level (with the profile's strategy) - the
+  mode with the smallest output wins. Small images are sampled whole, so
+  for them this is a brute-force search.
+**************************************************************************/
+
+// At most this much (filtered) data is test-compressed per candidate mode
+static const size_t AutoFilterMaxSampleSize = 8 * 1024;
+// Larger images are sampled in runs of this many consecutive rows, spread evenly over the image (so the sample still
+// has the vertical redundancy that Up / Paeth + matches against the previous rows rely on)
+static const unsigned AutoFilterSampleRunRows = 4;
+
+// (in order of preference, if two compress to the same size - the cheapest to filter first)
+static const PngFilterMode AutoFilterCandidates[] = {
+	PngFilterMode::None, PngFilterMode::Sub, PngFilterMode::Up, PngFilterMode::Paeth, PngFilterMode::Adaptive
+};
+
+// The rows test-compressed by resolvePngFilterMode
+static std::vector<unsigned> getAutoFilterSampleRows(unsigned h, size_t rowBytes)
+{
+	std::vector<unsigned> sampleRows;
+	size_t maxSampleRows = std::max<size_t>(AutoFilterMaxSampleSize / (rowBytes + 1), 1);
+	if (maxSampleRows >= h)
+	{
+		for (unsigned y = 0; y < h; ++y)
+		{
+			sampleRows.push_back(y);
+		}
+		return sampleRows;
+	}
+	unsigned runRows = static_cast<unsigned>(std::min<size_t>(maxSampleRows, AutoFilterSampleRunRows));
+	size_t numRuns = maxSampleRows / runRows;
+	for (size_t run = 0; run < numRuns; ++run)
+	{
+		// (the middle of each of numRuns equal slices of the image)
+		unsigned firstRow = static_cast<unsigned>(((h - runRows) * (2 * run + 1)) / (2 * numRuns));
+		for (unsigned y = firstRow; y < firstRow + runRows; ++y)
+		{
+			sampleRows.push_back(y);
+		}
+	}
+	return sampleRows;
+}
+
+// Compresses data with an already-initialized stream (which is reset first), returning the compressed size
+static size_t getTestCompressedSize(z_stream& stream, const std::vector<uint8_t>& data, std::vector<uint8_t>& output)
+{
+	if (deflateReset(&stream) != Z_OK)
+	{
+		return SIZE_MAX;
+	}
+	output.resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+	stream.next_in = const_cast<Bytef *>(data.data());
+	stream.avail_in = static_cast<uInt>(data.size());
+	stream.next_out = output.data();
+	stream.avail_out = static_cast<uInt>(output.size());
+	return (deflate(&stream, Z_FINISH) == Z_STREAM_END) ? static_cast<size_t>(stream.total_out) : SIZE_MAX;
+}
+
+// Returns options.filterMode, or (for Auto) the candidate mode whose filtered sample rows compress the smallest
+//
+// Below are some benchmarks (encode time / file size, for each filter mode) done on the same synthetic map previews as
+// the table in savePngInternal (whose rows are the auto rows here), with zlib, on one thread:
+//
+// | profile | filter   | 128x128            | 250x250            | 1000x1000            |
+// | :------ | :------- | :----------------- | :----------------- | :------------------- |
+// | fast    | auto     | 0.86 ms / 4.1 KB   | 1.94 ms / 14.5 KB  | 12.30 ms / 24.1 KB   |
+// | fast    | none     | 0.43 ms / 32.7 KB  | 2.00 ms / 124.7 KB | 24.71 ms / 1925.9 KB |
+// | fast    | sub      | 0.25 ms / 8.7 KB   | 1.16 ms / 32.0 KB  | 10.29 ms / 145.2 KB  |
+// | fast    | up       | 0.26 ms / 6.9 KB   | 1.09 ms / 24.6 KB  | 8.51 ms / 77.5 KB    |
+// | fast    | paeth    | 0.39 ms / 4.3 KB   | 1.14 ms / 15.1 KB  | 12.30 ms / 24.1 KB   |
+// | fast    | adaptive | 0.74 ms / 4.1 KB   | 1.96 ms / 14.5 KB  | 21.08 ms / 23.8 KB   |
+// | default | auto     | 1.03 ms / 3.1 KB   | 2.84 ms / 10.4 KB  | 12.42 ms / 20.4 KB   |
+// | default | none     | 0.70 ms / 3.2 KB   | 2.87 ms / 10.9 KB  | 16.07 ms / 31.1 KB   |
+// | default | sub      | 1.06 ms / 3.9 KB   | 4.77 ms / 13.2 KB  | 17.58 ms / 43.2 KB   |
+// | default | up       | 0.84 ms / 3.1 KB   | 2.67 ms / 10.4 KB  | 12.92 ms / 20.4 KB   |
+// | default | paeth    | 1.19 ms / 3.3 KB   | 3.12 ms / 11.5 KB  | 16.35 ms / 21.9 KB   |
+// | default | adaptive | 1.41 ms / 3.4 KB   | 4.22 ms / 11.2 KB  | 25.21 ms / 21.4 KB   |
+// | max     | auto     | 5.98 ms / 2.9 KB   | 17.77 ms / 9.5 KB  | 41.94 ms / 17.7 KB   |
+// | max     | none     | 3.03 ms / 3.0 KB   | 12.79 ms / 9.9 KB  | 29.16 ms / 27.7 KB   |
+// | max     | sub      | 8.99 ms / 3.6 KB   | 37.15 ms / 12.1 KB | 119.77 ms / 30.8 KB  |
+// | max     | up       | 5.04 ms / 2.9 KB   | 17.22 ms / 9.5 KB  | 45.78 ms / 17.7 KB   |
+// | max     | paeth    | 7.00 ms / 3.1 KB   | 24.09 ms / 10.5 KB | 64.46 ms / 19.8 KB   |
+// | max     | adaptive | 7.43 ms / 3.1 KB   | 23.29 ms / 10.2 KB | 71.29 ms / 19.7 KB   |
+//
+// (choosing costs ~0.2-0.5 ms per image - for these previews, auto picks adaptive / paeth for fast, and up for default + max)
+static PngFilterMode resolvePngFilterMode(const PngSaveOptions& options, PngRowSource& rows, size_t bpp)
+{
+	if (options.filterMode != PngFilterMode::Auto)
+	{
+		return options.filterMode;
+	}
+	// (one stream is reused for all of the candidates - initializing it costs about as much as compressing the sample)
+	PngZlibSettings testSettings = getZlibSettings(options.compressionProfile);
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, testSettings.windowBits, testSettings.memLevel, testSettings.strategy) != Z_OK)
+	{
+		return PngFilterMode::Adaptive;
+	}
+
+	const size_t rowBytes = rows.rowBytes();
+	const std::vector<unsigned> sampleRows = getAutoFilterSampleRows(rows.height(), rowBytes);
+	const std::vector<uint8_t> zeroRow(rowBytes, 0);
+	std::vector<uint8_t> sample((rowBytes + 1) * sampleRows.size());
+	std::vector<uint8_t> scratch;
+	std::vector<uint8_t> compressed;
+	PngFilterMode bestMode = PngFilterMode::Adaptive;
+	size_t bestSize = SIZE_MAX;
+	for (PngFilterMode candidate : AutoFilterCandidates)
+	{
+		for (size_t i = 0; i < sampleRows.size(); ++i)
+		{
+			const uint8_t *row = rows.row(sampleRows[i]);
+			const uint8_t *prevRow = (sampleRows[i] > 0) ? rows.row(sampleRows[i] - 1) : zeroRow.data();
+			filterPngRowWithMode(candidate, row, prevRow, rowBytes, bpp, sample.data() + ((rowBytes + 1) * i), scratch);
+		}
+		size_t compressedSize = getTestCompressedSize(stream, sample, compressed);
+		if (compressedSize < bestSize)
+		{
+			bestSize = compressedSize;
+			bestMode = candidate;
+		}
+	}
+	deflateEnd(&stream);
+	return bestMode;
+}
+
+// The libpng filter flags for a (resolved) filter mode
+static int getLibpngFilters(PngFilterMode filterMode)
+{
+	switch (filterMode)
+	{
+		case PngFilterMode::Sub:
+			return PNG_FILTER_SUB;
+		case PngFilterMode::Up:
+			return PNG_FILTER_UP;
+		case PngFilterMode::Paeth:
+			return PNG_FILTER_PAETH;
+		case PngFilterMode::Adaptive:
+			return PNG_ALL_FILTERS;
+		case PngFilterMode::None:
+		case PngFilterMode::Auto:
+			break;
+	}
+	return PNG_FILTER_NONE;
+}
+
+// Which encoder an image is encoded with (libpng's is the default)
+enum class PngEncoder
+{
+	Libpng,
+	Parallel,
+	Libdeflate
+};
+
+static PngEncoder choosePngEncoder(const PngSaveOptions& options, size_t rowBytes, unsigned h)
+{
+	// (libdeflate compresses the whole filtered image in one piece - so scaled images, which would then be held in memory, use zlib)
+	if (options.deflateBackend == PngDeflateBackend::Libdeflate && pngDeflateBackendIsAvailable(PngDeflateBackend::Libdeflate) && options.scale <= 1)
+	{
+		return PngEncoder::Libdeflate;
+	}
+	// (images too small to split into multiple strips are left to libpng)
+	if (options.numThreads > 1 && (rowBytes + 1) * h >= 2 * ParallelMinStripSize)
+	{
+		return PngEncoder::Parallel;
+	}
+	return PngEncoder::Libpng;
+}
+
+// Encodes with a (non-libpng) encoder, to exactly one of: fp (an open file), or outputBuffer (in-memory)
+static bool savePngDirect(PngEncoder encoder, FILE *fp, std::vector<uint8_t> *outputBuffer, const PngRowSource& rows, unsigned w, unsigned h, int bitdepth, int color_type, unsigned channelsPerPixel, PngFilterMode filterMode, const PngSaveOptions& options, const std::vector<png_color>* palette)
+{
+	std::vector<uint8_t> fileData;
+	std::vector<uint8_t>& output = (outputBuffer != NULL) ? *outputBuffer : fileData;
+	bool result = false;
+	switch (encoder)
+	{
+		case PngEncoder::Parallel:
+			result = encodePngParallel(output, rows, w, h, bitdepth, color_type, channelsPerPixel, filterMode, options, palette);
+			break;
+		case PngEncoder::Libdeflate:
+#if defined(WZ_MAPTOOLS_ENABLE_LIBDEFLATE)
+			result = encodePngLibdeflate(output, rows, w, h, bitdepth, color_type, channelsPerPixel, filterMode, options, palette);
+#endif
+			break;
+		case PngEncoder::Libpng:
+			break;
+	}
+	if (!result || outputBuffer != NULL)
+	{
+		return result;
+	}
+	if (fwrite(fileData.data(), 1, fileData.size(), fp) != fileData.size())
+	{
+		debug_error("savePng: Failed to write PNG data\n");
+		return false;
+	}
+	return true;
+}
+
 #if defined(_MSC_VER)
 // FIXME?: disable MSVC warning C4611: interaction between '_setjmp' and C++ object destruction is non-portable
 __pragma(warning( push )) // see matching "pop" below
 __pragma(warning( disable : 4611 ))
 #endif
 
-static bool savePngInternal(const char *fileName, uint8_t *pixels, unsigned w, unsigned h, int bitdepth, int color_type)
+// Encodes to exactly one of: fp (an open file), or outputBuffer (in-memory)
+static bool savePngInternal(FILE *fp, std::vector<uint8_t> *outputBuffer, uint8_t *pixels, unsigned w, unsigned h, int bitdepth, int color_type, const PngSaveOptions& options = PngSaveOptions(), const std::vector<png_color>* palette = NULL)
 {
-	uint8_t **scanlines = NULL;
 	png_infop info_ptr = NULL;
 	png_structp png_ptr = NULL;
-	FILE *fp;
-	
-	if (fileName == NULL || *fileName == '\0' || pixels == NULL)
+
+	if ((fp == NULL && outputBuffer == NULL) || pixels == NULL)
 	{
 		return false;
 	}
-	if (w <= 0 || h <= 0)
+	const unsigned scale = std::max(options.scale, 1u);
+	if (w <= 0 || h <= 0 || static_cast<uint64_t>(w) * scale > PNG_UINT_31_MAX || static_cast<uint64_t>(h) * scale > PNG_UINT_31_MAX)
 	{
-		debug_error("savePng: Unsupported image dimensions: %d x %d", w, h);
+		debug_error("savePng: Unsupported image dimensions: %d x %d (scale: %u)", w, h, scale);
 		return false;
 	}
 	if (bitdepth <= 0)
@@ -68,17 +942,48 @@ static bool savePngInternal(const char *fileName, uint8_t *pixels, unsigned w, u
 		debug_error("savePng: Unsupported bit depth: %d", bitdepth);
 		return false;
 	}
-	if (!(fp = fopen(fileName, "wb")))
+
+	unsigned channelsPerPixel;
+	switch (color_type)
 	{
-		debug_error("savePng: %s won't open for writing!", fileName);
-		return false;
+		case PNG_COLOR_TYPE_GRAY:
+			channelsPerPixel = 1;
+			break;
+		case PNG_COLOR_TYPE_RGB:
+			channelsPerPixel = 3;
+			break;
+		case PNG_COLOR_TYPE_RGBA:
+			channelsPerPixel = 4;
+			break;
+		case PNG_COLOR_TYPE_PALETTE:
+			if (palette == NULL || palette->empty())
+			{
+				debug_error("savePng: Missing palette.\n");
+				return false;
+			}
+			channelsPerPixel = 1;
+			break;
+		default:
+			debug_error("savePng: Unsupported pixel format.\n");
+			return false;
+	}
+
+	// (the row source is created before setjmp below, so a libpng error can't jump past its construction)
+	PngRowSource rows(pixels, w, h, bitdepth, channelsPerPixel, scale);
+	const unsigned scaledWidth = w * scale;
+	const unsigned scaledHeight = rows.height();
+	PngFilterMode filterMode = resolvePngFilterMode(options, rows, getPngFilterBytesPerPixel(channelsPerPixel, bitdepth));
+	PngEncoder encoder = choosePngEncoder(options, rows.rowBytes(), scaledHeight);
+	if (encoder != PngEncoder::Libpng)
+	{
+		return savePngDirect(encoder, fp, outputBuffer, rows, scaledWidth, scaledHeight, bitdepth, color_type, channelsPerPixel, filterMode, options, palette);
 	}
 
 	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (png_ptr == NULL)
 	{
 		debug_error("savePng: Unable to create png struct\n");
-		PNGWriteCleanup(&info_ptr, &png_ptr, fp);
+		PNGWriteCleanup(&info_ptr, &png_ptr, NULL);
 		return false;
 	}
 
@@ -86,7 +991,7 @@ static bool savePngInternal(const char *fileName, uint8_t *pixels, unsigned w, u
 	if (info_ptr == NULL)
 	{
 		debug_error("savePng: Unable to create png info struct\n");
-		PNGWriteCleanup(&info_ptr, &png_ptr, fp);
+		PNGWriteCleanup(&info_ptr, &png_ptr, NULL);
 		return false;
 	}
 
@@ -94,87 +999,57 @@ static bool savePngInternal(const char *fileName, uint8_t *pixels, unsigned w, u
 	if (setjmp(png_jmpbuf(png_ptr)))
 	{
 		debug_error("savePng: Error encoding PNG data\n");
-		PNGWriteCleanup(&info_ptr, &png_ptr, fp);
+		PNGWriteCleanup(&info_ptr, &png_ptr, NULL);
 		return false;
 	}
 	else
 	{
-		unsigned currentRow, row_stride;
-		unsigned channelsPerPixel;
-
-		switch (color_type)
+		if (outputBuffer != NULL)
 		{
-			case PNG_COLOR_TYPE_GRAY:
-				channelsPerPixel = 1;
-				break;
-			case PNG_COLOR_TYPE_RGB:
-				channelsPerPixel = 3;
-				break;
-			case PNG_COLOR_TYPE_RGBA:
-				channelsPerPixel = 4;
-				break;
-			default:
-				debug_error("savePng: Unsupported pixel format.\n");
-				PNGWriteCleanup(&info_ptr, &png_ptr, fp);
-				return false;
+			png_set_write_fn(png_ptr, outputBuffer, wzpng_write_data, wzpng_flush_data);
 		}
-
-		row_stride = w * channelsPerPixel * bitdepth / 8;
-
-		scanlines = (uint8_t **)malloc(sizeof(uint8_t *) * h);
-		if (scanlines == NULL)
+		else
 		{
-			debug_error("savePng: Couldn't allocate memory\n");
-			PNGWriteCleanup(&info_ptr, &png_ptr, fp);
-			return false;
+			png_init_io(png_ptr, fp);
 		}
 
-		png_init_io(png_ptr, fp);
-		
-		//png_set_write_fn(png_ptr, fp, wzpng_write_data, wzpng_flush_data);
-
-		// Set the compression level of ZLIB
-		// Right now we stick with the default, since that one is the
-		// fastest which still produces acceptable filesizes.
-		// The highest compression level hardly produces smaller files than default.
-		//
-		// Below are some benchmarks done while taking screenshots at 1280x1024
-		// Z_NO_COMPRESSION:
-		// black (except for GUI): 398 msec
-		// 381, 391, 404, 360 msec
+		// Set the ZLIB compression settings
+		// The zlib level is by far the largest CPU cost when encoding previews, and higher levels
+		// hardly produce smaller files for flat-color images (which are run-length friendly).
 		//
-		// Z_BEST_SPEED:
-		// black (except for GUI): 325 msec
-		// 611, 406, 461, 608 msec
+		// Below are some benchmarks (encode time / file size) done on synthetic map previews - 1 pixel per tile,
+		// height-shaded terrain colors + structures (1000x1000 is a 4x nearest-neighbour upscale of 250x250) - with the
+		// auto filter mode (the CLI default), on one thread, zlib 1.2.13 (best of 7 runs):
 		//
-		// Z_DEFAULT_COMPRESSION:
-		// black (except for GUI): 374 msec
-		// 1154, 1121, 627, 790 msec
-		//
-		// Z_BEST_COMPRESSION:
-		// black (except for GUI): 439 msec
-		// 1600, 1078, 1613, 1700 msec
-
-		// Not calling this function is equal to using the default
-		// so to spare some CPU cycles we comment this out.
-		png_set_compression_level(png_ptr, 9);
-		png_set_IHDR(png_ptr, info_ptr, w, h, bitdepth,
+		// | profile | 128x128          | 250x250           | 1000x1000          |
+		// | :------ | :--------------- | :---------------- | :----------------- |
+		// | fast    | 0.86 ms / 4.1 KB | 1.94 ms / 14.5 KB | 12.30 ms / 24.1 KB |
+		// | default | 1.03 ms / 3.1 KB | 2.84 ms / 10.4 KB | 12.42 ms / 20.4 KB |
+		// | max     | 5.98 ms / 2.9 KB | 17.77 ms / 9.5 KB | 41.94 ms / 17.7 KB |
+		PngZlibSettings zlibSettings = getZlibSettings(options.compressionProfile);
+		png_set_compression_level(png_ptr, zlibSettings.level);
+		png_set_compression_strategy(png_ptr, zlibSettings.strategy);
+		png_set_compression_mem_level(png_ptr, zlibSettings.memLevel);
+		png_set_compression_window_bits(png_ptr, zlibSettings.windowBits);
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, getLibpngFilters(filterMode));
+		png_set_IHDR(png_ptr, info_ptr, scaledWidth, scaledHeight, bitdepth,
 					 color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-		// Create an array of scanlines
-		for (currentRow = 0; currentRow < h; ++currentRow)
+		if (color_type == PNG_COLOR_TYPE_PALETTE)
 		{
-			// png scanlines are ordered from top-to-bottom
-			scanlines[currentRow] = pixels + (row_stride * currentRow);
+			png_set_PLTE(png_ptr, info_ptr, palette->data(), static_cast<int>(palette->size()));
 		}
 
-		png_set_rows(png_ptr, info_ptr, (png_bytepp)scanlines);
-
-		png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+		// Write the rows one at a time (png scanlines are ordered from top-to-bottom), so scaled rows are only
+		// ever expanded into the row source's buffers
+		png_write_info(png_ptr, info_ptr);
+		for (unsigned currentRow = 0; currentRow < scaledHeight; ++currentRow)
+		{
+			png_write_row(png_ptr, rows.row(currentRow));
+		}
+		png_write_end(png_ptr, info_ptr);
 	}
 
-	free(scanlines);
-	PNGWriteCleanup(&info_ptr, &png_ptr, fp);
+	PNGWriteCleanup(&info_ptr, &png_ptr, NULL);
 
 	return true;
 }
@@ -183,12 +1058,172 @@ static bool savePngInternal(const char *fileName, uint8_t *pixels, unsigned w, u
 __pragma(warning( pop )) // FIXME?: re-enable MSVC warning C4611: interaction between '_setjmp' and C++ object destruction is non-portable
 #endif
 
+// Opens fileName for writing, encodes the PNG to it (with encode), and closes it
+static bool savePngFile(const char *fileName, const uint8_t *pixels, const std::function<bool (FILE *fp)>& encode)
+{
+	FILE *fp;
+
+	if (fileName == NULL || *fileName == '\0' || pixels == NULL)
+	{
+		return false;
+	}
+	if (!(fp = fopen(fileName, "wb")))
+	{
+		debug_error("savePng: %s won't open for writing!", fileName);
+		return false;
+	}
+
+	bool result = encode(fp);
+	if (fclose(fp) != 0)
+	{
+		debug_error("savePng: Failed to write: %s\n", fileName);
+		result = false;
+	}
+	return result;
+}
+
+static bool savePngFileInternal(const char *fileName, uint8_t *pixels, unsigned w, unsigned h, int bitdepth, int color_type)
+{
+	return savePngFile(fileName, pixels, [&](FILE *fp) {
+		return savePngInternal(fp, NULL, pixels, w, h, bitdepth, color_type);
+	});
+}
+
+static inline uint32_t packRGB(uint8_t r, uint8_t g, uint8_t b)
+{
+	return (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | static_cast<uint32_t>(b);
+}
+
+/**************************************************************************
+  Convert an RGB888 image buffer to packed palette indices.
+  Returns false if the image has more than 256 distinct colors.
+**************************************************************************/
+static bool convertRGBToIndexed(const uint8_t *pixels, unsigned w, unsigned h, const std::vector<PngPaletteColor>& paletteHint, std::vector<png_color>& palette, std::vector<uint8_t>& indexedPixels, int& bitdepth)
+{
+	const size_t numPixels = static_cast<size_t>(w) * h;
+	std::vector<uint8_t> indices(numPixels);
+	std::unordered_map<uint32_t, uint8_t> colorToIndex;
+	std::vector<uint32_t> discoveredColors;
+
+	// Assign indices in order of first appearance (the hinted colors are re-ordered to the front afterwards)
+	uint32_t lastColor = 0;
+	uint8_t lastIndex = 0;
+	bool hasLastColor = false;
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		const uint8_t *p = pixels + (i * 3);
+		uint32_t color = packRGB(p[0], p[1], p[2]);
+		if (!hasLastColor || color != lastColor)
+		{
+			auto it = colorToIndex.find(color);
+			if (it == colorToIndex.end())
+			{
+				if (discoveredColors.size() >= 256)
+				{
+					return false;
+				}
+				it = colorToIndex.emplace(color, static_cast<uint8_t>(discoveredColors.size())).first;
+				discoveredColors.push_back(color);
+			}
+			lastColor = color;
+			lastIndex = it->second;
+			hasLastColor = true;
+		}
+		indices[i] = lastIndex;
+	}
+
+	// Build the final palette: used hint colors first, then all other colors
+	std::vector<uint8_t> remap(discoveredColors.size());
+	std::vector<bool> placed(discoveredColors.size(), false);
+	palette.clear();
+	for (const auto& hintColor : paletteHint)
+	{
+		auto it = colorToIndex.find(packRGB(hintColor.r, hintColor.g, hintColor.b));
+		if (it == colorToIndex.end() || placed[it->second])
+		{
+			continue;
+		}
+		remap[it->second] = static_cast<uint8_t>(palette.size());
+		placed[it->second] = true;
+		palette.push_back(png_color{hintColor.r, hintColor.g, hintColor.b});
+	}
+	for (size_t idx = 0; idx < discoveredColors.size(); ++idx)
+	{
+		if (placed[idx])
+		{
+			continue;
+		}
+		uint32_t color = discoveredColors[idx];
+		remap[idx] = static_cast<uint8_t>(palette.size());
+		palette.push_back(png_color{static_cast<png_byte>((color >> 16) & 0xFF), static_cast<png_byte>((color >> 8) & 0xFF), static_cast<png_byte>(color & 0xFF)});
+	}
+
+	// Use the smallest bit depth that fits the palette
+	if (palette.size() <= 2) { bitdepth = 1; }
+	else if (palette.size() <= 4) { bitdepth = 2; }
+	else if (palette.size() <= 16) { bitdepth = 4; }
+	else { bitdepth = 8; }
+
+	// Pack indices (most significant bits first, rows padded to a whole byte)
+	const unsigned pixelsPerByte = 8 / static_cast<unsigned>(bitdepth);
+	const size_t row_stride = (static_cast<size_t>(w) * bitdepth + 7) / 8;
+	indexedPixels.assign(row_stride * h, 0);
+	for (unsigned y = 0; y < h; ++y)
+	{
+		uint8_t *outRow = indexedPixels.data() + (row_stride * y);
+		const uint8_t *inRow = indices.data() + (static_cast<size_t>(w) * y);
+		for (unsigned x = 0; x < w; ++x)
+		{
+			unsigned shift = static_cast<unsigned>(bitdepth) * (pixelsPerByte - 1 - (x % pixelsPerByte));
+			outRow[x / pixelsPerByte] |= static_cast<uint8_t>(remap[inRow[x]] << shift);
+		}
+	}
+
+	return true;
+}
+
+// Encodes an RGB888 image (optionally as an indexed-palette PNG) to a file or buffer
+static bool savePngRGB(FILE *fp, std::vector<uint8_t> *outputBuffer, uint8_t *pixels, unsigned w, unsigned h, const PngSaveOptions& options)
+{
+	if (options.indexedColor && pixels != NULL)
+	{
+		std::vector<png_color> palette;
+		std::vector<uint8_t> indexedPixels;
+		int bitdepth = 8;
+		if (convertRGBToIndexed(pixels, w, h, options.paletteHint, palette, indexedPixels, bitdepth))
+		{
+			return savePngInternal(fp, outputBuffer, indexedPixels.data(), w, h, bitdepth, PNG_COLOR_TYPE_PALETTE, options, &palette);
+		}
+		// Too many colors - fall back to RGB
+	}
+	return savePngInternal(fp, outputBuffer, pixels, w, h, 8, PNG_COLOR_TYPE_RGB, options);
+}
+
 /**************************************************************************
   Save an RGB888 image buffer to a PNG file.
+  (Optionally as an indexed-palette PNG, if the image has <= 256 colors.)
 **************************************************************************/
-bool savePng(const char *filename, uint8_t *pixels, unsigned w, unsigned h)
+bool savePng(const char *filename, uint8_t *pixels, unsigned w, unsigned h, const PngSaveOptions& options)
 {
-	return savePngInternal(filename, pixels, w, h, 8, PNG_COLOR_TYPE_RGB);
+	return savePngFile(filename, pixels, [&](FILE *fp) {
+		return savePngRGB(fp, NULL, pixels, w, h, options);
+	});
+}
+
+/**************************************************************************
+  Encode an RGB888 image buffer to PNG data in memory.
+**************************************************************************/
+bool savePngToMemory(std::vector<uint8_t>& output, uint8_t *pixels, unsigned w, unsigned h, const PngSaveOptions& options)
+{
+	output.clear();
+	// Flat-color previews typically compress to well under a quarter of the raw size
+	output.reserve((static_cast<size_t>(w) * h * 3) / 4 + 1024);
+	if (!savePngRGB(NULL, &output, pixels, w, h, options))
+	{
+		output.clear();
+		return false;
+	}
+	return true;
 }
 
 /**************************************************************************
@@ -196,7 +1231,7 @@ bool savePng(const char *filename, uint8_t *pixels, unsigned w, unsigned h)
 **************************************************************************/
 bool savePngARGB32(const char *filename, uint8_t *pixels, unsigned w, unsigned h)
 {
-	return savePngInternal(filename, pixels, w, h, 8, PNG_COLOR_TYPE_RGBA);
+	return savePngFileInternal(filename, pixels, w, h, 8, PNG_COLOR_TYPE_RGBA);
 }
 
 /**************************************************************************
@@ -204,7 +1239,7 @@ bool savePngARGB32(const char *filename, uint8_t *pixels, unsigned w, unsigned h
 **************************************************************************/
 bool savePngI16(const char *filename, uint16_t *pixels, unsigned w, unsigned h)
 {
-	return savePngInternal(filename, (uint8_t *)pixels, w, h, 16, PNG_COLOR_TYPE_GRAY);
+	return savePngFileInternal(filename, (uint8_t *)pixels, w, h, 16, PNG_COLOR_TYPE_GRAY);
 }
 
 /**************************************************************************
@@ -212,5 +1247,5 @@ bool savePngI16(const char *filename, uint16_t *pixels, unsigned w, unsigned h)
 **************************************************************************/
 bool savePngI8(const char *filename, uint8_t *pixels, int w, int h)
 {
-	return savePngInternal(filename, pixels, w, h, 8, PNG_COLOR_TYPE_GRAY);
+	return savePngFileInternal(filename, pixels, w, h, 8, PNG_COLOR_TYPE_GRAY);
 }
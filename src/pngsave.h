@@ -21,6 +21,79 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
+
+/*
+ * zlib settings presets used when encoding PNGs:
+ * - Fast: zlib level 1 + Z_RLE (flat-color images, such as map previews, still compress well)
+ * - Default: zlib's default level + Z_FILTERED (libpng's default settings)
+ * - Max: zlib level 9 + Z_FILTERED (libpng's settings, at level 9 - the default profile)
+ */
+enum class PngCompressionProfile
+{
+	Fast,
+	Default,
+	Max
+};
+
+/*
+ * The deflate implementation used to compress the PNG data:
+ * - Zlib: libpng + zlib (always available)
+ * - Libdeflate: libdeflate, compressing the whole (filtered) image in one shot - much faster than zlib at the same
+ *   level (only available if compiled with WZ_MAPTOOLS_ENABLE_LIBDEFLATE, otherwise Zlib is used - as it is for
+ *   scaled images, see PngSaveOptions::scale)
+ */
+enum class PngDeflateBackend
+{
+	Zlib,
+	Libdeflate
+};
+
+bool pngDeflateBackendIsAvailable(PngDeflateBackend backend);
+
+/*
+ * The PNG row filter(s) applied before compression:
+ * - Auto: picked per image, by test-compressing a sample of the rows (or all of them, for small images) with each
+ *   of the other modes - flat-color previews often compress best with None or Sub
+ * - None / Sub / Up / Paeth: the same filter for every row
+ * - Adaptive: the lowest-cost filter for each row (libpng's default for RGB images)
+ */
+enum class PngFilterMode
+{
+	Auto,
+	None,
+	Sub,
+	Up,
+	Paeth,
+	Adaptive
+};
+
+struct PngPaletteColor
+{
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+};
+
+struct PngSaveOptions
+{
+	PngCompressionProfile compressionProfile = PngCompressionProfile::Max;
+	// If set, RGB images with <= 256 distinct colors are written as indexed-palette PNGs (1, 2, 4 or 8-bit)
+	// Images with more colors are written as RGB.
+	bool indexedColor = false;
+	// Known colors, placed first in the palette (if they are used by the image)
+	std::vector<PngPaletteColor> paletteHint;
+	// If > 1, large images are filtered + compressed in parallel strips, on up to this many threads
+	// (the output is still a standard PNG, just with a slightly different zlib stream than libpng's single-threaded encoder)
+	unsigned numThreads = 1;
+	PngDeflateBackend deflateBackend = PngDeflateBackend::Zlib;
+	// Adaptive (libpng's default) unless set - the CLI + serve default to Auto
+	PngFilterMode filterMode = PngFilterMode::Adaptive;
+	// If > 1, the image is upscaled by this factor (nearest-neighbour) as it is encoded - each row is expanded on the fly,
+	// so the scaled image is never held in memory (the parallel encoder only holds the strips it is compressing, and
+	// libdeflate - which needs the whole filtered image - isn't used)
+	unsigned scale = 1;
+};
 
 /*
  * The pixels argument should such that
@@ -28,7 +101,9 @@
  * pixels[h-1] is the top left corner
  * Pixel components which exceed one byte are expected in network byte order.
  */
-bool savePng(const char *filename, uint8_t *pixels, unsigned w, unsigned h);
+bool savePng(const char *filename, uint8_t *pixels, unsigned w, unsigned h, const PngSaveOptions& options = PngSaveOptions());
+// Encodes to a PNG in memory (output is replaced with the encoded PNG data)
+bool savePngToMemory(std::vector<uint8_t>& output, uint8_t *pixels, unsigned w, unsigned h, const PngSaveOptions& options = PngSaveOptions());
 bool savePngARGB32(const char *filename, uint8_t *pixels, unsigned w, unsigned h);
 bool savePngI16(const char *filename, uint16_t *pixels, unsigned w, unsigned h);
 bool savePngI8(const char *filename, uint8_t *pixels, unsigned w, unsigned h);